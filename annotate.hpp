@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Annotations that let AddressSanitizer and Valgrind memcheck see inside the memory resources
+ * A free block of a PoolMemory or the unused tail of a MonoMemory is poisoned, so a use after free of a pooled block is reported
+ * AddressSanitizer is detected from the compiler, Valgrind is opt-in with MEM_VALGRIND since it can't be detected at compile time
+ * Without either every function here is empty and inlines away
+ */
+#if defined(__SANITIZE_ADDRESS__)
+#define MEM_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define MEM_ASAN
+#endif
+#endif
+
+#ifdef MEM_ASAN
+#include <sanitizer/asan_interface.h>
+#endif
+
+#ifdef MEM_VALGRIND
+#if defined(__has_include) && !__has_include(<valgrind/memcheck.h>)
+#error "MEM_VALGRIND is defined but <valgrind/memcheck.h> can't be found"
+#endif
+#include <valgrind/memcheck.h>
+#endif
+
+namespace mem
+{
+namespace annotate
+{
+/** The resource itself reads or writes a block its user doesn't own, like a free list link or a canary */
+inline void expose([[maybe_unused]] const void *pblock, [[maybe_unused]] std::size_t size)
+{
+#ifdef MEM_ASAN
+    ASAN_UNPOISON_MEMORY_REGION(pblock, size);
+#endif
+#ifdef MEM_VALGRIND
+    VALGRIND_MAKE_MEM_DEFINED(pblock, size);
+#endif
+}
+inline void hide([[maybe_unused]] const void *pblock, [[maybe_unused]] std::size_t size)
+{
+#ifdef MEM_ASAN
+    ASAN_POISON_MEMORY_REGION(pblock, size);
+#endif
+#ifdef MEM_VALGRIND
+    VALGRIND_MAKE_MEM_NOACCESS(pblock, size);
+#endif
+}
+
+/** A resource starts managing [pmemory, pmemory + size), nothing of it is handed out yet */
+inline void pool_create([[maybe_unused]] const void *resource, [[maybe_unused]] const void *pmemory, [[maybe_unused]] std::size_t size)
+{
+#ifdef MEM_ASAN
+    ASAN_POISON_MEMORY_REGION(pmemory, size);
+#endif
+#ifdef MEM_VALGRIND
+    VALGRIND_CREATE_MEMPOOL(resource, 0, 0);
+    VALGRIND_MAKE_MEM_NOACCESS(pmemory, size);
+#endif
+}
+
+/** The resource gives the memory back, to the heap or to the upstream it came from */
+inline void pool_destroy([[maybe_unused]] const void *resource, [[maybe_unused]] const void *pmemory, [[maybe_unused]] std::size_t size)
+{
+#ifdef MEM_ASAN
+    ASAN_UNPOISON_MEMORY_REGION(pmemory, size);
+#endif
+#ifdef MEM_VALGRIND
+    VALGRIND_DESTROY_MEMPOOL(resource);
+    VALGRIND_MAKE_MEM_UNDEFINED(pmemory, size);
+#endif
+}
+
+/** A block is handed out by get(), its content is undefined */
+inline void pool_alloc([[maybe_unused]] const void *resource, [[maybe_unused]] const void *pblock, [[maybe_unused]] std::size_t size)
+{
+#ifdef MEM_ASAN
+    ASAN_UNPOISON_MEMORY_REGION(pblock, size);
+#endif
+#ifdef MEM_VALGRIND
+    VALGRIND_MEMPOOL_ALLOC(resource, pblock, size);
+#endif
+}
+
+/** A block comes back through free(), any access to it is an error until get() hands it out again */
+inline void pool_free([[maybe_unused]] const void *resource, [[maybe_unused]] const void *pblock, [[maybe_unused]] std::size_t size)
+{
+#ifdef MEM_ASAN
+    ASAN_POISON_MEMORY_REGION(pblock, size);
+#endif
+#ifdef MEM_VALGRIND
+    VALGRIND_MEMPOOL_FREE(resource, pblock);
+#endif
+}
+}  // namespace annotate
+}  // namespace mem
@@ -0,0 +1,555 @@
+/**
+ * Microbenchmarks for the memory resources and the allocators built on top of them
+ * Every resource is measured across object sizes, thread counts and access patterns, each thread working on its own instance
+ *
+ * Usage: bench [--filter SUBSTRING] [--threads 1,2,4] [--min-time SECONDS] [--json FILE]
+ * Pass --json - to print the JSON report to stdout instead of the table
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bench.hpp"
+#include "frame.hpp"
+#include "myAllocator.hpp"
+#include "naive.hpp"
+#include "pool.hpp"
+#include "worker.hpp"
+
+constexpr std::size_t window = 256;  // number of live objects a fixture holds at its peak, a batch is window gets and window frees
+
+template <std::size_t Size>
+struct Object {
+    std::byte data[Size];
+};
+
+/** Access patterns: in which order the window of live objects is given back */
+enum class Pattern {
+    lifo,    // reverse order of allocation, like a stack
+    fifo,    // order of allocation, like a queue
+    random,  // a shuffled order, like a long running heap after churn
+};
+
+const char *pattern_name(Pattern pattern)
+{
+    switch (pattern) {
+        case Pattern::lifo: return "lifo";
+        case Pattern::fifo: return "fifo";
+        default: return "random";
+    }
+}
+
+/** Adapters giving the memory resources and the allocators the same get/put interface */
+template <std::size_t Size>
+class PoolResource
+{
+   public:
+    void *get() { return m_pool.get(); }
+    void put(void *pblock) { m_pool.free(pblock); }
+
+   private:
+    mem::PoolMemory m_pool{Size, window};
+};
+
+template <std::size_t Size>
+class SlabResource  // pools in 64 KiB slabs, a block goes back to the pool its address masks to
+{
+   public:
+    ~SlabResource()
+    {
+        for (mem::PoolMemory *pool : m_slabs) mem::PoolMemory::destroy_slab(pool, slab_bytes);
+    }
+
+    void *get()
+    {
+        void *pblock = m_current == nullptr ? nullptr : m_current->get<mem::oom::Null>();
+        if (pblock == nullptr) MEM_UNLIKELY {
+            m_current = nullptr;
+            for (mem::PoolMemory *pool : m_slabs)
+                if (!pool->full()) m_current = pool;
+            if (m_current == nullptr) m_current = m_slabs.emplace_back(mem::PoolMemory::make_slab(Size, slab_bytes));
+            pblock = m_current->get();
+        }
+        return pblock;
+    }
+    void put(void *pblock) { mem::PoolMemory::slab_of(pblock, slab_bytes)->free(pblock); }
+
+   private:
+    static constexpr std::size_t slab_bytes = 64 * 1024;
+    std::vector<mem::PoolMemory *> m_slabs;
+    mem::PoolMemory *m_current = nullptr;
+};
+
+template <std::size_t Size>
+class MonoResource  // only usable with Pattern::lifo
+{
+   public:
+    void *get() { return m_mono.get(Size); }
+    void put(void *pblock) { m_mono.free(pblock, Size); }
+
+   private:
+    mem::MonoMemory m_mono{Size * window};
+};
+
+template <std::size_t Size>
+class WorkerResource  // one worker of a heap shared by every thread of the benchmark
+{
+   public:
+    void *get() { return heap().get(m_worker, Size); }
+    void put(void *pblock) { heap().free(m_worker, pblock); }
+
+   private:
+    static constexpr std::size_t num_workers = 64;  // more than the threads of a run, the ids go round between runs
+    static mem::WorkerHeap &heap()
+    {
+        static mem::WorkerHeap s_heap(num_workers, window);
+        return s_heap;
+    }
+    static inline std::atomic<std::size_t> s_next_worker{0};
+
+    std::size_t m_worker = s_next_worker.fetch_add(1) % num_workers;
+};
+
+template <class Alloc>
+class AllocResource
+{
+   public:
+    void *get() { return m_alloc.allocate(1); }
+    void put(void *pblock) { m_alloc.deallocate(static_cast<typename std::allocator_traits<Alloc>::pointer>(pblock), 1); }
+
+   private:
+    Alloc m_alloc;
+};
+
+/** Get a window of objects, touch them and give them back in the order given by the pattern */
+template <class Resource, Pattern P>
+class Churn
+{
+   public:
+    Churn() : m_ptrs(window), m_order(window)
+    {
+        for (std::size_t i = 0; i < window; i++) m_order[i] = P == Pattern::lifo ? window - 1 - i : i;
+        if (P == Pattern::random) {
+            std::uint32_t state = 2463534242u;  // xorshift, we want the same shuffle on every run
+            for (std::size_t i = window - 1; i > 0; i--) {
+                state ^= state << 13, state ^= state >> 17, state ^= state << 5;
+                std::swap(m_order[i], m_order[state % (i + 1)]);
+            }
+        }
+    }
+
+    std::size_t batch()
+    {
+        for (std::size_t i = 0; i < window; i++) {
+            m_ptrs[i] = m_resource.get();
+            *static_cast<unsigned char *>(m_ptrs[i]) = static_cast<unsigned char>(i);  // touch the block like a user would
+        }
+        for (std::size_t i = 0; i < window; i++) {
+            bench::do_not_optimize(*static_cast<unsigned char *>(m_ptrs[m_order[i]]));
+            m_resource.put(m_ptrs[m_order[i]]);
+        }
+        return 2 * window;
+    }
+
+   private:
+    Resource m_resource;
+    std::vector<void *> m_ptrs;
+    std::vector<std::size_t> m_order;
+};
+
+/** Fill a std::list with a window of nodes and drain it from the front, one node allocation per push */
+template <template <class> class Alloc, std::size_t Size>
+class ListFill
+{
+   public:
+    std::size_t batch()
+    {
+        for (std::size_t i = 0; i < window; i++) m_list.emplace_back();
+        for (std::size_t i = 0; i < window; i++) m_list.pop_front();
+        return 2 * window;
+    }
+
+   private:
+    std::list<Object<Size>, Alloc<Object<Size>>> m_list;
+};
+
+/** Grow a std::vector by push_back to a window of elements and release its storage again */
+template <template <class> class Alloc, std::size_t Size>
+class VectorGrow
+{
+   public:
+    std::size_t batch()
+    {
+        for (std::size_t i = 0; i < window; i++) m_vector.emplace_back();
+        m_vector.clear();
+        m_vector.shrink_to_fit();
+        return window;
+    }
+
+   private:
+    std::vector<Object<Size>, Alloc<Object<Size>>> m_vector;
+};
+
+/**
+ * Walk many short linked lists in lockstep, each list's nodes in its own slab, like the inner lists of test_list.cpp
+ * Without colors the n-th node of every list sits at the same offset of its slab and all of them compete for one cache set
+ */
+template <std::size_t Size, bool Colored>
+class SlabTraversal
+{
+   public:
+    SlabTraversal()
+    {
+        for (std::size_t list = 0; list < num_lists; list++) {
+            mem::PoolMemory *pslab = mem::PoolMemory::make_slab(Size, slab_bytes, Colored ? list : 0);
+            m_slabs.push_back(pslab);
+            Node **plink = &m_heads[list];
+            for (std::size_t i = 0; i < length; i++) {
+                *plink = static_cast<Node *>(pslab->get());
+                (*plink)->payload[0] = static_cast<std::byte>(i);
+                plink = &(*plink)->next;
+            }
+            *plink = nullptr;
+        }
+    }
+    ~SlabTraversal()
+    {
+        for (mem::PoolMemory *pslab : m_slabs) mem::PoolMemory::destroy_slab(pslab, slab_bytes);
+    }
+
+    std::size_t batch()
+    {
+        Node *cursors[num_lists];
+        std::copy(std::begin(m_heads), std::end(m_heads), cursors);
+        unsigned sum = 0;
+        for (std::size_t i = 0; i < length; i++) {
+            for (std::size_t list = 0; list < num_lists; list++) {
+                sum += static_cast<unsigned>(cursors[list]->payload[0]);
+                cursors[list] = cursors[list]->next;
+            }
+        }
+        bench::do_not_optimize(sum);
+        return num_lists * length;
+    }
+
+   private:
+    struct Node {
+        Node *next;
+        std::byte payload[Size - sizeof(Node *)];
+    };
+    static constexpr std::size_t slab_bytes = 64 * 1024;
+    static constexpr std::size_t num_lists = 64;  // more than the ways of an L1 set
+    static constexpr std::size_t length = 16;
+
+    std::vector<mem::PoolMemory *> m_slabs;
+    Node *m_heads[num_lists];
+};
+
+/** How a block gotten on one thread goes back to its pool from another one */
+enum class Handoff {
+    remote,  // remote_free(), reclaimed by the owner on a miss
+    locked,  // a mutex around the pool, taken by the owner's get() too
+};
+
+/**
+ * Blocks are gotten on one thread and freed on another, like a producer consumer pipeline
+ * Every thread gets a window of blocks from its own pool and swaps them through a mailbox for another thread's window,
+ * which it frees back to that thread's pool (with a single thread it gets its own previous window back)
+ */
+template <std::size_t Size, Handoff H>
+class CrossThread
+{
+   public:
+    struct Batch {
+        CrossThread *owner;
+        void *ptrs[window];
+        std::atomic<bool> busy{false};  // in the mailbox or being freed by another thread
+    };
+
+    ~CrossThread()
+    {
+        // our windows may still be in the mailbox or being freed into our pool, wait for them
+        // whatever sits in the mailbox is given back to its owner, which waits for it too and so is still alive
+        for (;;) {
+            if (Batch *held = s_mailbox.exchange(nullptr, std::memory_order_acq_rel)) give_back(held);
+
+            bool busy = false;
+            for (auto &batch : m_batches) busy = busy || batch->busy.load(std::memory_order_acquire);
+            if (!busy) break;
+            std::this_thread::yield();
+        }
+    }
+
+    std::size_t batch()
+    {
+        Batch *mine = idle_batch();
+        for (std::size_t i = 0; i < window; i++) {
+            mine->ptrs[i] = get();
+            *static_cast<unsigned char *>(mine->ptrs[i]) = static_cast<unsigned char>(i);  // touch the block like a user would
+        }
+        mine->busy.store(true, std::memory_order_relaxed);
+        if (Batch *theirs = s_mailbox.exchange(mine, std::memory_order_acq_rel)) give_back(theirs);
+        return 2 * window;
+    }
+
+   private:
+    static inline std::atomic<Batch *> s_mailbox{nullptr};
+    static constexpr std::size_t num_blocks = window * 64;  // a window for every thread that may hold one of ours, and then some
+
+    Batch *idle_batch()
+    {
+        for (auto &batch : m_batches)
+            if (!batch->busy.load(std::memory_order_acquire)) return batch.get();
+        m_batches.push_back(std::make_unique<Batch>());
+        m_batches.back()->owner = this;
+        return m_batches.back().get();
+    }
+
+    static void give_back(Batch *batch)
+    {
+        for (std::size_t i = 0; i < window; i++) {
+            bench::do_not_optimize(*static_cast<unsigned char *>(batch->ptrs[i]));
+            batch->owner->put(batch->ptrs[i]);
+        }
+        batch->busy.store(false, std::memory_order_release);
+    }
+
+    void *get()
+    {
+        for (;;) {  // the other threads are about to give some of our blocks back
+            void *pblock;
+            if (H == Handoff::remote) {
+                pblock = m_pool.get<mem::oom::Null>();
+            } else {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                pblock = m_pool.get<mem::oom::Null>();
+            }
+            if (pblock != nullptr) return pblock;
+            std::this_thread::yield();
+        }
+    }
+
+    void put(void *pblock)
+    {
+        if (H == Handoff::remote) {
+            m_pool.remote_free(pblock);
+        } else {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pool.free(pblock);
+        }
+    }
+
+    mem::PoolMemory m_pool{Size, num_blocks};
+    std::mutex m_mutex;  // only taken with Handoff::locked
+    std::vector<std::unique_ptr<Batch>> m_batches;
+};
+
+/** Where the frames of the benchmark coroutines come from */
+struct PooledPromise : mem::PooledFrame {
+};
+struct NewPromise {
+};
+
+/** A lazy coroutine that suspends once in its body, with a frame allocated through the operator new of Base */
+template <class Base>
+class Lazy
+{
+   public:
+    struct promise_type : Base {
+        Lazy get_return_object() { return Lazy(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Lazy() = default;
+    explicit Lazy(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+    Lazy(Lazy &&lazy) noexcept : m_handle(std::exchange(lazy.m_handle, nullptr)) {}
+    Lazy &operator=(Lazy &&rhs) noexcept
+    {
+        std::swap(m_handle, rhs.m_handle);
+        return *this;
+    }
+    ~Lazy()
+    {
+        if (m_handle) m_handle.destroy();
+    }
+
+    void finish()
+    {
+        while (!m_handle.done()) m_handle.resume();
+    }
+
+   private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template <class Base, std::size_t Size>
+Lazy<Base> short_lived(unsigned char seed)
+{
+    unsigned char state[Size];  // kept across the suspension, so the frame holds it
+    state[0] = seed;
+    co_await std::suspend_always{};
+    bench::do_not_optimize(state[0]);
+}
+
+/** Start a window of short-lived coroutines, then run each to completion and destroy it, like a burst of async operations */
+template <class Base, std::size_t Size>
+class CoroutineSpawn
+{
+   public:
+    CoroutineSpawn() : m_tasks(window) {}
+
+    std::size_t batch()
+    {
+        for (std::size_t i = 0; i < window; i++) m_tasks[i] = short_lived<Base, Size>(static_cast<unsigned char>(i));
+        for (std::size_t i = 0; i < window; i++) {
+            m_tasks[i].finish();
+            m_tasks[i] = Lazy<Base>();  // destroys the frame
+        }
+        return 2 * window;
+    }
+
+   private:
+    std::vector<Lazy<Base>> m_tasks;
+};
+
+template <class T>
+using ListAllocator = list::allocator<T>;
+template <class T>
+using PagedListAllocator = list::allocator<T, trait::Allocator_Traits<T>, mem::growth::Paged<>>;
+template <class T>
+using AdaptiveListAllocator = list::allocator<T, trait::Allocator_Traits<T>, mem::growth::Adaptive<>>;
+template <class T>
+using VectorAllocator = vector::allocator<T>;
+template <class T>
+using NaiveAllocator = oop::Allocator<T>;
+template <class T>
+using StdAllocator = std::allocator<T>;
+
+struct Benchmark {
+    std::string resource;
+    std::string pattern;
+    std::size_t object_size;
+    std::function<bench::Result(bench::Result, const bench::Config &)> run;
+};
+
+template <class Fixture>
+void add(std::vector<Benchmark> &benchmarks, const std::string &resource, const std::string &pattern, std::size_t object_size)
+{
+    benchmarks.push_back({resource, pattern, object_size, [](bench::Result result, const bench::Config &config) {
+                              return bench::run<Fixture>(result, config);
+                          }});
+}
+
+template <std::size_t Size, Pattern P>
+void add_churn(std::vector<Benchmark> &benchmarks)
+{
+    add<Churn<PoolResource<Size>, P>>(benchmarks, "pool", pattern_name(P), Size);
+    add<Churn<SlabResource<Size>, P>>(benchmarks, "pool slabs", pattern_name(P), Size);
+    if (P == Pattern::lifo) add<Churn<MonoResource<Size>, P>>(benchmarks, "mono", pattern_name(P), Size);
+    add<Churn<WorkerResource<Size>, P>>(benchmarks, "worker heap", pattern_name(P), Size);
+    add<Churn<AllocResource<ListAllocator<Object<Size>>>, P>>(benchmarks, "list::allocator", pattern_name(P), Size);
+    add<Churn<AllocResource<NaiveAllocator<Object<Size>>>, P>>(benchmarks, "oop::Allocator", pattern_name(P), Size);
+    add<Churn<AllocResource<StdAllocator<Object<Size>>>, P>>(benchmarks, "std::allocator", pattern_name(P), Size);
+}
+
+template <std::size_t Size>
+void add_size(std::vector<Benchmark> &benchmarks)
+{
+    add_churn<Size, Pattern::lifo>(benchmarks);
+    add_churn<Size, Pattern::fifo>(benchmarks);
+    add_churn<Size, Pattern::random>(benchmarks);
+
+    add<ListFill<ListAllocator, Size>>(benchmarks, "list::allocator", "std::list", Size);
+    add<ListFill<PagedListAllocator, Size>>(benchmarks, "list::allocator paged", "std::list", Size);
+    add<ListFill<AdaptiveListAllocator, Size>>(benchmarks, "list::allocator adaptive", "std::list", Size);
+    add<ListFill<NaiveAllocator, Size>>(benchmarks, "oop::Allocator", "std::list", Size);
+    add<ListFill<StdAllocator, Size>>(benchmarks, "std::allocator", "std::list", Size);
+
+    add<VectorGrow<VectorAllocator, Size>>(benchmarks, "vector::allocator", "std::vector", Size);
+    add<VectorGrow<NaiveAllocator, Size>>(benchmarks, "oop::Allocator", "std::vector", Size);
+    add<VectorGrow<StdAllocator, Size>>(benchmarks, "std::allocator", "std::vector", Size);
+
+    if constexpr (Size >= 64) {
+        add<SlabTraversal<Size, true>>(benchmarks, "slabs colored", "list traversal", Size);
+        add<SlabTraversal<Size, false>>(benchmarks, "slabs one color", "list traversal", Size);
+    }
+
+    add<CrossThread<Size, Handoff::remote>>(benchmarks, "pool remote_free", "cross-thread", Size);
+    add<CrossThread<Size, Handoff::locked>>(benchmarks, "pool + mutex", "cross-thread", Size);
+
+    add<CoroutineSpawn<PooledPromise, Size>>(benchmarks, "mem::PooledFrame", "coroutine", Size);
+    add<CoroutineSpawn<NewPromise, Size>>(benchmarks, "operator new", "coroutine", Size);
+}
+
+int main(int argc, char **argv)
+{
+    bench::Config config;
+    std::string filter;
+    std::string json;
+    std::vector<std::size_t> thread_counts = {1, 2, 4};
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            config.min_time = std::stod(argv[++i]);
+        } else if (arg == "--json" && i + 1 < argc) {
+            json = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            thread_counts.clear();
+            std::stringstream list(argv[++i]);
+            for (std::string count; std::getline(list, count, ',');) thread_counts.push_back(std::stoul(count));
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--filter SUBSTRING] [--threads 1,2,4] [--min-time SECONDS] [--json FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Benchmark> benchmarks;
+    add_size<8>(benchmarks);
+    add_size<64>(benchmarks);
+    add_size<256>(benchmarks);
+    add_size<1024>(benchmarks);
+
+    std::vector<bench::Result> results;
+    bool table = json != "-";
+    if (table) bench::print_header(std::cout);
+    for (auto &benchmark : benchmarks) {
+        for (auto threads : thread_counts) {
+            bench::Result result;
+            result.resource = benchmark.resource;
+            result.pattern = benchmark.pattern;
+            result.object_size = benchmark.object_size;
+            result.threads = threads;
+            result.name = benchmark.resource + "/" + benchmark.pattern + "/" + std::to_string(benchmark.object_size) + "/threads:" + std::to_string(threads);
+            if (result.name.find(filter) == std::string::npos) continue;
+
+            results.push_back(benchmark.run(result, config));
+            if (table) bench::print_row(std::cout, results.back());
+        }
+    }
+
+    if (json == "-") {
+        bench::print_json(std::cout, results);
+    } else if (!json.empty()) {
+        std::ofstream file(json);
+        bench::print_json(file, results);
+    }
+    return 0;
+}
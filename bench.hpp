@@ -0,0 +1,302 @@
+#pragma once
+
+/**
+ * A tiny google-benchmark style harness
+ * Every benchmark is a fixture constructed once per thread, whose batch() runs a batch of operations and returns how many it did
+ * We time whole batches instead of single operations so that the clock overhead doesn't dominate the result,
+ * and report the mean, percentiles of the per batch ns/op and hardware counters from perf_event_open when the kernel lets us
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench
+{
+using clock = std::chrono::steady_clock;
+
+/** Keep the compiler from optimizing away a value we computed only for the sake of measuring it */
+template <class T>
+inline void do_not_optimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const T *sink;
+    sink = &value;
+#endif
+}
+
+/** Hardware counters of the calling thread, all disabled if perf_event_open is unavailable or not permitted */
+class PerfCounters
+{
+   public:
+    struct Event {
+        const char *name;     // key used in the report, like "cycles"
+        std::uint32_t type;   // perf_event_attr::type
+        std::uint64_t config;  // perf_event_attr::config
+    };
+
+    static const std::vector<Event> &events()
+    {
+#if defined(__linux__)
+        static const std::vector<Event> list = {
+            {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {"L1d_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+            {"LLC_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        };
+#else
+        static const std::vector<Event> list;
+#endif
+        return list;
+    }
+
+    PerfCounters() : m_fds(events().size(), -1), m_values(events().size(), 0)
+    {
+#if defined(__linux__)
+        for (std::size_t i = 0; i < m_fds.size(); i++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events()[i].type;
+            attr.config = events()[i].config;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            m_fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));  // this thread, any cpu
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    ~PerfCounters()
+    {
+#if defined(__linux__)
+        for (auto fd : m_fds)
+            if (fd >= 0) close(fd);
+#endif
+    }
+
+    bool available(std::size_t i) const { return m_fds[i] >= 0; }  // whether the i-th event could be opened
+
+    void start()
+    {
+#if defined(__linux__)
+        for (auto fd : m_fds) {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    void stop()
+    {
+#if defined(__linux__)
+        for (std::size_t i = 0; i < m_fds.size(); i++) {
+            if (m_fds[i] < 0) continue;
+            ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            std::uint64_t value = 0;
+            if (read(m_fds[i], &value, sizeof(value)) == sizeof(value)) m_values[i] = value;
+        }
+#endif
+    }
+
+    std::uint64_t value(std::size_t i) const { return m_values[i]; }  // the i-th event's count between start() and stop()
+
+   private:
+    std::vector<int> m_fds;
+    std::vector<std::uint64_t> m_values;
+};
+
+struct Config {
+    double min_time = 0.2;            // seconds each thread keeps running batches
+    std::size_t min_batches = 16;     // even a slow benchmark gets this many samples
+    std::size_t max_batches = 100000;  // and a fast one no more than this
+};
+
+/** What we know about a finished benchmark */
+struct Result {
+    std::string name;
+    std::string resource;
+    std::string pattern;
+    std::size_t object_size = 0;
+    std::size_t threads = 1;
+    std::size_t iterations = 0;  // total number of operations over all threads
+    double ns_per_op = 0;        // mean latency of one operation on one thread
+    double ops_per_sec = 0;      // throughput of all threads together
+    double min_ns = 0, p50_ns = 0, p90_ns = 0, p99_ns = 0, max_ns = 0;  // over the per batch ns/op samples
+    std::vector<double> counters;  // per operation value of every PerfCounters event, NaN if unavailable
+};
+
+/** Run Fixture's batches on threads threads, each with its own fixture built from args */
+template <class Fixture, class... Args>
+Result run(Result result, const Config &config, const Args &...args)
+{
+    struct PerThread {
+        std::vector<double> samples;                                   // ns/op of every batch
+        std::size_t ops = 0;                                           // operations done
+        std::vector<double> counters;                                  // raw counter values
+        std::vector<bool> counted = std::vector<bool>(PerfCounters::events().size(), false);  // whether the counter could be opened
+    };
+
+    std::vector<PerThread> per_thread(result.threads);
+    std::atomic<std::size_t> ready(0);
+    std::atomic<bool> go(false);
+
+    auto body = [&](std::size_t id) {
+        PerThread &mine = per_thread[id];
+        Fixture fixture(args...);
+        fixture.batch();  // warm up the caches and the resource
+        PerfCounters perf;
+
+        ready++;
+        while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+
+        auto deadline = clock::now() + std::chrono::duration<double>(config.min_time);
+        perf.start();
+        while (mine.samples.size() < config.max_batches &&
+               (mine.samples.size() < config.min_batches || clock::now() < deadline)) {
+            auto begin = clock::now();
+            std::size_t ops = fixture.batch();
+            auto end = clock::now();
+            mine.ops += ops;
+            mine.samples.push_back(std::chrono::duration<double, std::nano>(end - begin).count() / ops);
+        }
+        perf.stop();
+
+        for (std::size_t i = 0; i < PerfCounters::events().size(); i++) {
+            mine.counted[i] = perf.available(i);
+            mine.counters.push_back(static_cast<double>(perf.value(i)));
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < result.threads; i++) workers.emplace_back(body, i);
+    std::thread timer([&] {
+        while (ready.load() < result.threads) std::this_thread::yield();
+        go.store(true, std::memory_order_release);
+    });
+    auto begin = clock::now();
+    body(0);
+    for (auto &worker : workers) worker.join();
+    timer.join();
+    double wall = std::chrono::duration<double>(clock::now() - begin).count();
+
+    /** Merge what all the threads have seen */
+    std::vector<double> samples;
+    double total_ns = 0;
+    for (auto &mine : per_thread) {
+        for (auto sample : mine.samples) total_ns += sample;  // every sample is weighted equally as batches are of the same size
+        samples.insert(samples.end(), mine.samples.begin(), mine.samples.end());
+        result.iterations += mine.ops;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) { return samples[std::min(samples.size() - 1, static_cast<std::size_t>(p * samples.size()))]; };
+
+    result.ns_per_op = total_ns / samples.size();
+    result.ops_per_sec = result.iterations / wall;
+    result.min_ns = samples.front();
+    result.p50_ns = percentile(0.50);
+    result.p90_ns = percentile(0.90);
+    result.p99_ns = percentile(0.99);
+    result.max_ns = samples.back();
+
+    for (std::size_t i = 0; i < PerfCounters::events().size(); i++) {
+        double sum = 0;
+        bool counted = true;
+        for (auto &mine : per_thread) {
+            counted = counted && mine.counted[i];
+            sum += mine.counters[i];
+        }
+        result.counters.push_back(counted ? sum / result.iterations : std::nan(""));
+    }
+    return result;
+}
+
+/** Print one result as a row of a human readable table */
+inline void print_row(std::ostream &os, const Result &result)
+{
+    os << std::left << std::setw(44) << result.name << std::right << std::fixed << std::setprecision(2)
+       << std::setw(10) << result.ns_per_op
+       << std::setw(10) << result.p50_ns
+       << std::setw(10) << result.p99_ns
+       << std::setw(14) << std::setprecision(0) << result.ops_per_sec;
+    for (auto value : result.counters) {
+        if (std::isnan(value))
+            os << std::setw(16) << "-";
+        else
+            os << std::setw(16) << std::setprecision(2) << value;
+    }
+    os << std::defaultfloat << '\n';
+}
+
+inline void print_header(std::ostream &os)
+{
+    os << std::left << std::setw(44) << "benchmark" << std::right
+       << std::setw(10) << "ns/op"
+       << std::setw(10) << "p50"
+       << std::setw(10) << "p99"
+       << std::setw(14) << "ops/s";
+    for (auto &event : PerfCounters::events()) os << std::setw(16) << (std::string(event.name) + "/op");
+    os << '\n';
+}
+
+/** Dump all the results as a JSON document to be tracked for regressions */
+inline void print_json(std::ostream &os, const std::vector<Result> &results)
+{
+    auto number = [&](double value) {
+        if (std::isnan(value))
+            os << "null";
+        else
+            os << std::setprecision(6) << value;
+    };
+
+    os << "{\n  \"context\": {\"hardware_threads\": " << std::thread::hardware_concurrency() << "},\n";
+    os << "  \"benchmarks\": [\n";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        os << "    {\"name\": \"" << r.name << "\", \"resource\": \"" << r.resource << "\", \"pattern\": \"" << r.pattern
+           << "\", \"object_size\": " << r.object_size << ", \"threads\": " << r.threads << ", \"iterations\": " << r.iterations;
+        os << ", \"ns_per_op\": ";
+        number(r.ns_per_op);
+        os << ", \"ops_per_sec\": ";
+        number(r.ops_per_sec);
+        os << ", \"min_ns\": ";
+        number(r.min_ns);
+        os << ", \"p50_ns\": ";
+        number(r.p50_ns);
+        os << ", \"p90_ns\": ";
+        number(r.p90_ns);
+        os << ", \"p99_ns\": ";
+        number(r.p99_ns);
+        os << ", \"max_ns\": ";
+        number(r.max_ns);
+        for (std::size_t j = 0; j < r.counters.size(); j++) {
+            os << ", \"" << PerfCounters::events()[j].name << "_per_op\": ";
+            number(r.counters[j]);
+        }
+        os << "}" << (i + 1 == results.size() ? "\n" : ",\n");
+    }
+    os << "  ]\n}\n";
+}
+}  // namespace bench
@@ -0,0 +1,263 @@
+/**
+ * Throughput of message passing between threads: producers get a block, write a message into it and enqueue it, consumers
+ * dequeue it, read it and free it. Each pipeline runs on every combination of producer and consumer counts given
+ *
+ * ring + concurrent pool   BlockQueue of ConcurrentPool blocks, no lock and no heap
+ * ring + operator new      the same ring, the messages from the heap
+ * mutex + operator new     a std::deque behind a mutex bounded like the ring, the messages from the heap
+ *
+ * Usage: bench_queue [--producers 1,2,4] [--consumers 1,2,4] [--messages PER_PRODUCER] [--json FILE]
+ * Pass --json - to print the JSON report to stdout instead of the table
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bench.hpp"
+#include "queue.hpp"
+
+constexpr std::size_t message_size = 64;
+constexpr std::size_t ring_capacity = 1024;
+constexpr std::size_t batch = 256;  // messages a thread sends or receives between two looks at the clock
+
+/** Pipelines: a way to get a message block, to pass it on and to free it, all from any thread */
+class RingPool
+{
+   public:
+    void *get() { return m_pool.get<mem::oom::Null>(); }
+    void put(void *pblock) { m_pool.free(pblock); }
+    bool push(void *pblock) { return m_ring.push(pblock); }
+    void *pop() { return m_ring.pop(); }
+
+   private:
+    mem::ConcurrentPool m_pool{message_size, 2 * ring_capacity};  // the ring full and a block in the hands of every thread
+    mem::BlockQueue m_ring{ring_capacity};
+};
+
+class RingNew
+{
+   public:
+    void *get() { return ::operator new(message_size); }
+    void put(void *pblock) { ::operator delete(pblock); }
+    bool push(void *pblock) { return m_ring.push(pblock); }
+    void *pop() { return m_ring.pop(); }
+
+   private:
+    mem::BlockQueue m_ring{ring_capacity};
+};
+
+class MutexNew
+{
+   public:
+    void *get() { return ::operator new(message_size); }
+    void put(void *pblock) { ::operator delete(pblock); }
+    bool push(void *pblock)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.size() == ring_capacity) return false;
+        m_queue.push_back(pblock);
+        return true;
+    }
+    void *pop()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.empty()) return nullptr;
+        void *pblock = m_queue.front();
+        m_queue.pop_front();
+        return pblock;
+    }
+
+   private:
+    std::mutex m_mutex;
+    std::deque<void *> m_queue;
+};
+
+/** What a thread measured */
+struct PerThread {
+    std::vector<double> samples;  // ns per message of every batch
+    std::vector<double> counters;
+    std::vector<bool> counted;
+};
+
+/** Send messages through a Pipeline from producers to consumers, all started at once, and time every batch of each thread */
+template <class Pipeline>
+bench::Result run(bench::Result result, std::size_t producers, std::size_t consumers, std::size_t messages)
+{
+    Pipeline pipeline;
+    std::vector<PerThread> per_thread(producers + consumers);
+    std::atomic<std::size_t> ready(0), producing(producers);
+    std::atomic<bool> go(false);
+
+    auto measure = [&](std::size_t id, auto &&body) {
+        PerThread &mine = per_thread[id];
+        bench::PerfCounters perf;
+        ready++;
+        while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+
+        perf.start();
+        body(mine);
+        perf.stop();
+        for (std::size_t i = 0; i < bench::PerfCounters::events().size(); i++) {
+            mine.counted.push_back(perf.available(i));
+            mine.counters.push_back(static_cast<double>(perf.value(i)));
+        }
+    };
+
+    auto produce = [&](PerThread &mine) {
+        for (std::size_t sent = 0; sent < messages;) {
+            auto begin = bench::clock::now();
+            std::size_t first = sent, end = std::min(messages, sent + batch);
+            for (; sent < end; sent++) {
+                void *pblock;
+                while ((pblock = pipeline.get()) == nullptr) std::this_thread::yield();  // every block is in flight
+                *static_cast<std::size_t *>(pblock) = sent;                            // write the message like a user would
+                while (!pipeline.push(pblock)) std::this_thread::yield();
+            }
+            mine.samples.push_back(std::chrono::duration<double, std::nano>(bench::clock::now() - begin).count() / (end - first));
+        }
+        producing.fetch_sub(1, std::memory_order_release);
+    };
+
+    auto consume = [&](PerThread &mine) {
+        for (bool done = false; !done;) {
+            auto begin = bench::clock::now();
+            std::size_t received = 0;
+            while (received < batch) {
+                void *pblock = pipeline.pop();
+                if (pblock == nullptr) {
+                    // once every producer is done, a ring found empty stays empty
+                    if (producing.load(std::memory_order_acquire) == 0 && (pblock = pipeline.pop()) == nullptr) {
+                        done = true;
+                        break;
+                    }
+                    if (pblock == nullptr) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                }
+                bench::do_not_optimize(*static_cast<std::size_t *>(pblock));
+                pipeline.put(pblock);
+                received++;
+            }
+            if (received != 0) mine.samples.push_back(std::chrono::duration<double, std::nano>(bench::clock::now() - begin).count() / received);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < producers + consumers; i++) {
+        threads.emplace_back([&, i] {
+            if (i < producers)
+                measure(i, produce);
+            else
+                measure(i, consume);
+        });
+    }
+    while (ready.load() < producers + consumers) std::this_thread::yield();
+    auto begin = bench::clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto &thread : threads) thread.join();
+    double wall = std::chrono::duration<double>(bench::clock::now() - begin).count();
+
+    /** Merge what all the threads have seen, a message is one operation however many threads it went through */
+    std::vector<double> samples;
+    for (auto &mine : per_thread) samples.insert(samples.end(), mine.samples.begin(), mine.samples.end());
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) { return samples[std::min(samples.size() - 1, static_cast<std::size_t>(p * samples.size()))]; };
+
+    result.iterations = producers * messages;
+    result.ns_per_op = 0;
+    for (double sample : samples) result.ns_per_op += sample / samples.size();
+    result.ops_per_sec = result.iterations / wall;
+    result.min_ns = samples.front();
+    result.p50_ns = percentile(0.50);
+    result.p90_ns = percentile(0.90);
+    result.p99_ns = percentile(0.99);
+    result.max_ns = samples.back();
+
+    for (std::size_t i = 0; i < bench::PerfCounters::events().size(); i++) {
+        double sum = 0;
+        bool counted = true;
+        for (auto &mine : per_thread) {
+            counted = counted && mine.counted[i];
+            sum += mine.counters[i];
+        }
+        result.counters.push_back(counted ? sum / result.iterations : std::nan(""));
+    }
+    return result;
+}
+
+std::vector<std::size_t> parse_counts(const char *arg)
+{
+    std::vector<std::size_t> counts;
+    std::stringstream list(arg);
+    for (std::string count; std::getline(list, count, ',');) counts.push_back(std::stoul(count));
+    return counts;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::size_t> producer_counts = {1, 2, 4}, consumer_counts = {1, 2, 4};
+    std::size_t messages = 1 << 18;
+    std::string json;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--producers" && i + 1 < argc) {
+            producer_counts = parse_counts(argv[++i]);
+        } else if (arg == "--consumers" && i + 1 < argc) {
+            consumer_counts = parse_counts(argv[++i]);
+        } else if (arg == "--messages" && i + 1 < argc) {
+            messages = std::stoul(argv[++i]);
+        } else if (arg == "--json" && i + 1 < argc) {
+            json = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--producers 1,2,4] [--consumers 1,2,4] [--messages PER_PRODUCER] [--json FILE]" << std::endl;
+            return 1;
+        }
+    }
+
+    using Run = bench::Result (*)(bench::Result, std::size_t, std::size_t, std::size_t);
+    const std::pair<const char *, Run> pipelines[] = {
+        {"ring + concurrent pool", run<RingPool>},
+        {"ring + operator new", run<RingNew>},
+        {"mutex + operator new", run<MutexNew>},
+    };
+
+    std::vector<bench::Result> results;
+    bool table = json != "-";
+    if (table) bench::print_header(std::cout);
+    for (auto [resource, pipeline] : pipelines) {
+        for (std::size_t producers : producer_counts) {
+            for (std::size_t consumers : consumer_counts) {
+                bench::Result result;
+                result.resource = resource;
+                result.pattern = "pipeline";
+                result.object_size = message_size;
+                result.threads = producers + consumers;
+                result.name = std::string(resource) + "/pipeline/" + std::to_string(message_size) + "/" + std::to_string(producers) + "p" + std::to_string(consumers) + "c";
+
+                results.push_back(pipeline(result, producers, consumers, messages));
+                if (table) bench::print_row(std::cout, results.back());
+            }
+        }
+    }
+
+    if (json == "-") {
+        bench::print_json(std::cout, results);
+    } else if (!json.empty()) {
+        std::ofstream file(json);
+        bench::print_json(file, results);
+    }
+    return 0;
+}
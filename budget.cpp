@@ -0,0 +1,82 @@
+#include "budget.hpp"
+
+#include <cassert>
+#include <new>
+#include <utility>
+
+using mem::Budget;
+
+Budget::Budget(std::size_t limit_bytes, Budget *parent) : m_parent(parent), m_used(0), m_limit(limit_bytes), m_peak(0), m_refused(0) {}
+
+Budget::~Budget() { assert(used() == 0 && "a budget is destroyed with bytes still charged"); }
+
+void Budget::on_high(std::size_t high_bytes, Watermark callback)
+{
+    m_high = high_bytes;
+    m_on_high = std::move(callback);
+}
+
+void Budget::on_limit(Shed shed) { m_shed = std::move(shed); }
+
+bool Budget::try_charge_here(std::size_t bytes, std::size_t &before)
+{
+    before = m_used.load(std::memory_order_relaxed);
+    do {
+        std::size_t limit = m_limit.load(std::memory_order_relaxed);
+        if (before > limit || bytes > limit - before) {
+            m_refused.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    } while (!m_used.compare_exchange_weak(before, before + bytes, std::memory_order_relaxed));
+    return true;
+}
+
+Budget *Budget::charge_levels(std::size_t bytes)
+{
+    std::size_t before;
+    if (!try_charge_here(bytes, before)) return this;
+    if (m_parent != nullptr) {
+        if (Budget *refused = m_parent->charge_levels(bytes)) {
+            m_used.fetch_sub(bytes, std::memory_order_relaxed);
+            return refused;
+        }
+    }
+
+    // every level above took it too, so it counts
+    std::size_t peak = m_peak.load(std::memory_order_relaxed);
+    while (before + bytes > peak && !m_peak.compare_exchange_weak(peak, before + bytes, std::memory_order_relaxed)) {
+    }
+    if (m_on_high && before < m_high && before + bytes >= m_high) m_on_high(*this);  // only the charge that crosses it
+    return nullptr;
+}
+
+bool Budget::try_charge(std::size_t bytes)
+{
+    Budget *refused = charge_levels(bytes);
+    if (refused == nullptr) return true;
+    if (!refused->m_shed) return false;
+
+    refused->m_shed(*refused, bytes);  // give it a chance to make room, then once more
+    return charge_levels(bytes) == nullptr;
+}
+
+void Budget::charge(std::size_t bytes)
+{
+    if (!try_charge(bytes)) throw std::bad_alloc();
+}
+
+std::size_t Budget::charge_or_fallback(std::size_t first_blocks, std::size_t next_blocks, std::size_t block_sz_bytes)
+{
+    if (try_charge(next_blocks * block_sz_bytes)) return next_blocks;
+    // a budget that can't take a pool twice as large may still take one of the first size
+    if (next_blocks <= first_blocks || !try_charge(first_blocks * block_sz_bytes)) throw std::bad_alloc();
+    return first_blocks;
+}
+
+void Budget::release(std::size_t bytes)
+{
+    for (Budget *level = this; level != nullptr; level = level->m_parent) {
+        assert(level->used() >= bytes && "a budget released more than it was charged");
+        level->m_used.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+}
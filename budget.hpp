@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace mem
+{
+/**
+ * Memory Budget, caps the bytes the memory resources of a subsystem may take from the system
+ * Budgets form a tree: a charge counts against the budget and every one of its ancestors, and is refused as a whole if it
+ * would take any of them over its limit, so a subsystem can't starve its siblings and the root caps the whole process
+ * Only the growth paths charge, when a resource adds a pool or a chunk, and release it when they give one back, so
+ * the get() and free() of the blocks never touch a budget. The accounting is a CAS per level
+ * The growing resources take one: WorkerHeap and its groups, list::allocator and the coroutine frame caches. A plain
+ * PoolMemory or MonoMemory never grows, its capacity is its limit, and a budget per allocator or per group caps a pool
+ * family on its own. vector::allocator is left out: it's stateless and always equal, so it has nowhere to carry a budget,
+ * and it drops its old chunk on a deallocate() without knowing whether it's the last one, so a charge couldn't be released
+ *
+ * A budget can react before it's hit: the high watermark callback runs on the charge that takes it to high_bytes or above,
+ * once per crossing, for a soft limit that starts trimming or warns. When a charge would go over the limit, the shed
+ * handler of the budget that refuses it gets a chance to give memory back, and the charge is tried once more
+ * The callbacks are set before the budget is shared between threads, and they may be called on any thread that charges
+ */
+class Budget
+{
+   public:
+    using Watermark = std::function<void(Budget &budget)>;
+    using Shed = std::function<void(Budget &budget, std::size_t bytes)>;  // try to release bytes from budget
+
+    // a budget of limit_bytes, under parent if there is one, which has to outlive it
+    explicit Budget(std::size_t limit_bytes = SIZE_MAX, Budget *parent = nullptr);
+
+    Budget(const Budget &budget) = delete;          // delete copy constructor
+    Budget &operator=(const Budget &rhs) = delete;  // delete copy-assignment operator
+    Budget(Budget &&budget) = delete;               // delete move constructor
+    Budget &operator=(Budget &&rhs) = delete;       // delete move-assignment operator
+
+    ~Budget();  // every charge has to be released by now
+
+    // charge bytes to this budget and its ancestors, return false and charge nothing if one of them is out of it
+    bool try_charge(std::size_t bytes);
+    // charge or throw std::bad_alloc
+    void charge(std::size_t bytes);
+    // charge a pool of next_blocks blocks of block_sz_bytes, or one of first_blocks if next_blocks don't fit, for the growth
+    // paths whose pools double, return the blocks charged or throw std::bad_alloc if not even first_blocks fit
+    std::size_t charge_or_fallback(std::size_t first_blocks, std::size_t next_blocks, std::size_t block_sz_bytes);
+    // give back bytes charged before
+    void release(std::size_t bytes);
+
+    void set_limit(std::size_t limit_bytes) { m_limit.store(limit_bytes, std::memory_order_relaxed); }  // a lower limit only refuses the next charges
+    void on_high(std::size_t high_bytes, Watermark callback);
+    void on_limit(Shed shed);
+
+    std::size_t used() { return m_used.load(std::memory_order_relaxed); }    // return the bytes charged now
+    std::size_t limit() { return m_limit.load(std::memory_order_relaxed); }  // return the bytes that may be charged
+    std::size_t peak() { return m_peak.load(std::memory_order_relaxed); }    // return the most bytes ever charged at once
+    std::uint64_t refused() { return m_refused.load(std::memory_order_relaxed); }  // return how many charges this budget refused
+    Budget *parent() { return m_parent; }
+
+   private:
+    bool try_charge_here(std::size_t bytes, std::size_t &before);  // this level alone, before is what it had until then
+    Budget *charge_levels(std::size_t bytes);                     // every level or none, return the level that refused it or nullptr
+
+    Budget *m_parent;
+    std::atomic<std::size_t> m_used;
+    std::atomic<std::size_t> m_limit;
+    std::atomic<std::size_t> m_peak;
+    std::atomic<std::uint64_t> m_refused;
+    std::size_t m_high = SIZE_MAX;
+    Watermark m_on_high;
+    Shed m_shed;
+};
+}  // namespace mem
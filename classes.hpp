@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "budget.hpp"
+#include "pool.hpp"
+
+namespace mem
+{
+/**
+ * Size Class Pools of one owner, the building block of WorkerHeap and the coroutine frame caches
+ * Class i holds blocks of HeaderSize + (MinSize << i) bytes, so that an owner can put a header of its own in front of
+ * every payload, and grows by adding a pool twice as large as its last one whenever all of its pools are exhausted.
+ * The first pool of a class holds first_blocks blocks, or as many as fit in first_bytes if that's more
+ *
+ * With a Budget, every pool is charged to it when it's added and released with the pools: a class whose budget can't take
+ * a pool twice as large falls back to a pool of the first size, and get() throws std::bad_alloc once not even that fits
+ * Only the owner may call get(), the blocks go back with free() from the owner or remote_free() from anyone else
+ */
+template <std::size_t HeaderSize, std::size_t MinSize, std::size_t NumClasses>
+class SizeClasses
+{
+   public:
+    static constexpr std::size_t header_size = HeaderSize;
+    static constexpr std::size_t min_size = MinSize;                       // payload of the smallest class
+    static constexpr std::size_t max_size = MinSize << (NumClasses - 1);  // payload of the largest class
+    static constexpr std::size_t num_classes = NumClasses;
+
+    // the budget has to outlive the pools
+    explicit SizeClasses(std::size_t first_blocks, std::size_t first_bytes = 0, Budget *budget = nullptr)
+        : m_first_blocks(first_blocks == 0 ? 1 : first_blocks), m_first_bytes(first_bytes), m_budget(budget)
+    {
+    }
+
+    SizeClasses(const SizeClasses &classes) = delete;         // delete copy constructor
+    SizeClasses &operator=(const SizeClasses &rhs) = delete;  // delete copy-assignment operator
+    SizeClasses(SizeClasses &&classes) noexcept = default;    // the pools stay where they are, only their owner moves
+    SizeClasses &operator=(SizeClasses &&rhs) = delete;       // delete move-assignment operator
+
+    ~SizeClasses()
+    {
+        if (m_budget == nullptr) return;
+        for (SizeClass &size_class : m_classes)
+            for (auto &pool : size_class.pools) m_budget->release(pool->capacity() * pool->block_size());
+    }
+
+    Budget *budget() { return m_budget; }  // return the budget of the pools, nullptr if there is none
+
+    // return the class of a payload of size bytes, no larger than max_size
+    static std::size_t class_of(std::size_t size)
+    {
+        return size <= min_size ? 0 : std::bit_width(size - 1) - std::bit_width(min_size - 1);  // class i holds (min << (i-1), min << i]
+    }
+    // return the bytes of a block of the class, its header included
+    static std::size_t block_size(std::size_t index) { return header_size + (min_size << index); }
+
+    // return a block of the class and set pool to the pool it came from, throw std::bad_alloc if the system or the budget is out of memory
+    void *get(std::size_t index, PoolMemory *&pool)
+    {
+        SizeClass &size_class = m_classes[index];
+        PoolMemory *current = size_class.current;
+        void *pblock = current == nullptr ? nullptr : current->get<oom::Null>();
+        if (pblock == nullptr) MEM_UNLIKELY {
+            pblock = refill(size_class, index);
+        }
+        pool = size_class.current;
+        return pblock;
+    }
+
+    std::size_t pools()  // return the number of pools grown so far
+    {
+        std::size_t count = 0;
+        for (SizeClass &size_class : m_classes) count += size_class.pools.size();
+        return count;
+    }
+
+    std::size_t size()  // return the number of blocks that aren't back, only from the owner
+    {
+        std::size_t count = 0;
+        for (SizeClass &size_class : m_classes) {
+            for (auto &pool : size_class.pools) {
+                pool->reclaim();  // the blocks the others gave back
+                count += pool->size();
+            }
+        }
+        return count;
+    }
+
+    // call visit(PoolMemory &pool) on every pool, smallest class first
+    template <class Visit>
+    void for_each_pool(Visit visit)
+    {
+        for (SizeClass &size_class : m_classes)
+            for (auto &pool : size_class.pools) visit(*pool);
+    }
+
+   private:
+    struct SizeClass {
+        PoolMemory *current = nullptr;                   // pool the last block came from
+        std::vector<std::unique_ptr<PoolMemory>> pools;  // every pool of the class, the largest last
+    };
+
+    // find a pool of the class with a free block, or add one
+    MEM_COLD void *refill(SizeClass &size_class, std::size_t index)
+    {
+        // the other pools of the class may have blocks back, freed by the owner or reclaimed from the others
+        for (auto it = size_class.pools.rbegin(); it != size_class.pools.rend(); ++it) {
+            PoolMemory *pool = it->get();
+            if (pool == size_class.current) continue;
+            if (void *pblock = pool->get<oom::Null>()) {
+                size_class.current = pool;
+                return pblock;
+            }
+        }
+
+        std::size_t block_sz = block_size(index);
+        std::size_t first_blocks = std::max(m_first_blocks, m_first_bytes / block_sz);
+        std::size_t num_blocks = size_class.pools.empty() ? first_blocks : size_class.pools.back()->capacity() * 2;
+        if (m_budget != nullptr) num_blocks = m_budget->charge_or_fallback(first_blocks, num_blocks, block_sz);
+        try {
+            size_class.pools.push_back(std::make_unique<PoolMemory>(block_sz, num_blocks));
+        } catch (...) {
+            if (m_budget != nullptr) m_budget->release(num_blocks * block_sz);
+            throw;
+        }
+        size_class.current = size_class.pools.back().get();
+        return size_class.current->get();
+    }
+
+    SizeClass m_classes[num_classes];
+    std::size_t m_first_blocks;
+    std::size_t m_first_bytes;
+    Budget *m_budget;  // the pools are charged to it if there is one
+};
+}  // namespace mem
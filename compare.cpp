@@ -0,0 +1,114 @@
+/**
+ * Run a program under the system malloc and under the preload library, and compare the whole process
+ * Each configuration runs the program the given number of times, we report the median of the wall, user and system
+ * times and the largest resident set, all measured by the kernel for the child process
+ *
+ * Usage: compare [--runs N] --preload LIBRARY -- PROGRAM [ARGS...]
+ * The exit status is 1 if any run failed, so that the comparison doubles as a test of the preload library
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>         // to use open
+#include <sys/resource.h>  // to use struct rusage
+#include <sys/wait.h>      // to use wait4
+#include <unistd.h>        // to use fork and execvp
+
+using hiclock = std::chrono::high_resolution_clock;
+using duration = std::chrono::duration<double>;
+
+struct Run {
+    double wall = 0, user = 0, system = 0;  // seconds
+    long max_rss_kb = 0;
+    bool ok = false;
+};
+
+/** Run the program once, with LD_PRELOAD set to preload if it isn't empty, its output goes to /dev/null */
+Run run_once(std::vector<char *> &argv, const std::string &preload)
+{
+    Run run;
+    auto begin = hiclock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (preload.empty())
+            unsetenv("LD_PRELOAD");
+        else
+            setenv("LD_PRELOAD", preload.c_str(), 1);
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDOUT_FILENO);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage {};
+    if (pid < 0 || wait4(pid, &status, 0, &usage) != pid) return run;
+    run.wall = duration(hiclock::now() - begin).count();
+    run.user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6;
+    run.system = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+    run.max_rss_kb = usage.ru_maxrss;
+    run.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    return run;
+}
+
+double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 5;
+    std::string preload;
+    int i = 1;
+    for (; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--runs" && i + 1 < argc) {
+            runs = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--preload" && i + 1 < argc) {
+            preload = argv[++i];
+        } else if (arg == "--") {
+            i++;
+            break;
+        } else {
+            break;
+        }
+    }
+    if (preload.empty() || i >= argc) {
+        std::cerr << "Usage: " << argv[0] << " [--runs N] --preload LIBRARY -- PROGRAM [ARGS...]" << std::endl;
+        return 1;
+    }
+    if (preload.find('/') == std::string::npos) preload = "./" + preload;  // the loader only searches its paths otherwise
+
+    std::vector<char *> program(argv + i, argv + argc);
+    program.push_back(nullptr);
+
+    std::cout << std::left << std::setw(16) << "malloc" << std::right << std::setw(10) << "wall s" << std::setw(10) << "user s"
+              << std::setw(10) << "sys s" << std::setw(14) << "max RSS KiB" << std::setw(8) << "failed" << std::endl;
+    bool failed = false;
+    for (const std::string &library : {std::string(), preload}) {
+        std::vector<double> wall, user, system;
+        long max_rss_kb = 0;
+        int num_failed = 0;
+        for (int r = 0; r < runs; r++) {
+            Run run = run_once(program, library);
+            wall.push_back(run.wall);
+            user.push_back(run.user);
+            system.push_back(run.system);
+            max_rss_kb = std::max(max_rss_kb, run.max_rss_kb);
+            num_failed += !run.ok;
+        }
+        failed = failed || num_failed != 0;
+        std::cout << std::left << std::setw(16) << (library.empty() ? "system" : "preload") << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(10) << median(wall) << std::setw(10) << median(user) << std::setw(10) << median(system) << std::setw(14)
+                  << max_rss_kb << std::setw(8) << num_failed << std::endl;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+#include "epoch.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+using mem::EpochDomain;
+
+EpochDomain::EpochDomain(std::size_t batch) : m_batch(batch == 0 ? 1 : batch), m_epoch(0), m_records(nullptr) {}
+
+EpochDomain::~EpochDomain()
+{
+    // nobody can be reading the structures anymore, every block left is past its grace period
+    Record *record = m_records.load(std::memory_order_acquire);
+    while (record != nullptr) {
+        assert(!record->in_use.load(std::memory_order_relaxed) && "a thread is still in the epoch domain");
+        Record *next = record->next;
+        delete record;
+        record = next;
+    }
+    for (Retired &retired : m_orphans) retired.pool->remote_free(retired.pblock);
+}
+
+EpochDomain::Handle EpochDomain::join()
+{
+    // take over the record of a thread that left, or push a new one
+    for (Record *record = m_records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+        bool in_use = false;
+        if (!record->in_use.load(std::memory_order_relaxed) && record->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire))
+            return Handle(*this, *record);
+    }
+
+    Record *record = new Record;
+    record->next = m_records.load(std::memory_order_relaxed);
+    while (!m_records.compare_exchange_weak(record->next, record, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    return Handle(*this, *record);
+}
+
+bool EpochDomain::try_advance()
+{
+    // all sequentially consistent with the exchange of pin(), either we see its pin or it sees our epoch
+    std::uint64_t epoch = m_epoch.load(std::memory_order_seq_cst);
+    for (Record *record = m_records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+        std::uint64_t pinned = record->pinned.load(std::memory_order_seq_cst);
+        if (pinned != 0 && (pinned >> 1) != epoch) return false;  // still reading with what it saw in an older epoch
+    }
+
+    // whoever loses the race has advanced it just as well
+    m_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    return true;
+}
+
+std::size_t EpochDomain::collect(std::vector<Retired> &retired)
+{
+    // the blocks are in the order of their epochs, so the expired ones are a prefix
+    std::uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+    std::size_t num_expired = 0;
+    while (num_expired < retired.size() && retired[num_expired].epoch + 2 <= epoch) {
+        retired[num_expired].pool->remote_free(retired[num_expired].pblock);  // we're not the owner of the pool, or not always
+        num_expired++;
+    }
+    retired.erase(retired.begin(), retired.begin() + num_expired);
+    return num_expired;
+}
+
+void EpochDomain::orphan(std::vector<Retired> &retired)
+{
+    std::lock_guard<std::mutex> lock(m_orphans_mutex);
+    // merged rather than appended, the blocks of a thread that left early may be older than those of one that left before it
+    std::size_t num_orphans = m_orphans.size();
+    m_orphans.insert(m_orphans.end(), retired.begin(), retired.end());
+    std::inplace_merge(m_orphans.begin(), m_orphans.begin() + num_orphans, m_orphans.end(),
+                       [](const Retired &a, const Retired &b) { return a.epoch < b.epoch; });
+    retired.clear();
+}
+
+EpochDomain::Handle::~Handle()
+{
+    if (m_precord == nullptr) return;
+    assert(m_precord->nesting == 0 && "a thread left the epoch domain while pinned");
+    m_precord->pinned.store(0, std::memory_order_release);
+    if (!m_precord->retired.empty()) m_pdomain->orphan(m_precord->retired);
+    m_precord->in_use.store(false, std::memory_order_release);
+}
+
+void EpochDomain::Handle::pin()
+{
+    if (m_precord->nesting++ != 0) return;
+    std::uint64_t epoch = m_pdomain->m_epoch.load(std::memory_order_relaxed);
+    m_precord->pinned.exchange(epoch << 1 | 1, std::memory_order_seq_cst);  // a full barrier, published before we read any node
+}
+
+void EpochDomain::Handle::unpin()
+{
+    assert(m_precord->nesting != 0);
+    if (--m_precord->nesting != 0) return;
+    m_precord->pinned.store(0, std::memory_order_release);  // our reads of the nodes happen before their freeing
+}
+
+void EpochDomain::Handle::retire(PoolMemory &pool, void *pblock)
+{
+    if (pblock == nullptr) return;
+    std::uint64_t epoch = m_pdomain->m_epoch.load(std::memory_order_seq_cst);  // after the unlinking of the block
+    m_precord->retired.push_back(Retired{epoch, &pool, pblock});
+    if (m_precord->retired.size() >= m_pdomain->m_batch) flush();
+}
+
+std::size_t EpochDomain::Handle::flush()
+{
+    m_pdomain->try_advance();
+    std::size_t num_freed = m_pdomain->collect(m_precord->retired);
+
+    // the leftovers of the threads that left, whoever gets the lock frees them, the others don't wait
+    std::unique_lock<std::mutex> lock(m_pdomain->m_orphans_mutex, std::try_to_lock);
+    if (lock.owns_lock() && !m_pdomain->m_orphans.empty()) num_freed += m_pdomain->collect(m_pdomain->m_orphans);
+    return num_freed;
+}
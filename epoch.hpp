@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "pool.hpp"
+
+namespace mem
+{
+/**
+ * Epoch Based Reclamation of pool blocks, for lock-free structures whose nodes come from PoolMemory
+ * A node unlinked from such a structure may still be read by a thread that found it just before, so it can't be freed
+ * right away: it's retired instead, and given back to its pool with remote_free() once every thread that was reading
+ * the structure at the time has stopped doing so
+ *
+ * Every thread joins the domain once and gets a Handle. It pins the handle around each operation on the structure, and
+ * retires the nodes it unlinked through it. The domain keeps a global epoch that only advances when every pinned thread
+ * has seen the current one, so a node retired in epoch e is unreachable by everybody once the epoch reaches e + 2
+ * Retired nodes wait on a list of the retiring thread and are freed in batches, the epoch is only looked at when a batch is full
+ * A thread that stays pinned holds back the freeing of every thread, keep the pinned sections short
+ */
+class EpochDomain
+{
+   public:
+    class Handle;
+
+    // retired blocks wait until a thread has batch of them before it tries to advance the epoch and free the expired ones
+    explicit EpochDomain(std::size_t batch = 64);
+
+    EpochDomain(const EpochDomain &domain) = delete;          // delete copy constructor
+    EpochDomain &operator=(const EpochDomain &rhs) = delete;  // delete copy-assignment operator
+    EpochDomain(EpochDomain &&domain) = delete;               // delete move constructor
+    EpochDomain &operator=(EpochDomain &&rhs) = delete;       // delete move-assignment operator
+
+    ~EpochDomain();  // free every block still retired, every handle has to be gone by now
+
+    Handle join();                                                             // register the calling thread, keep the handle on that thread
+    std::uint64_t epoch() { return m_epoch.load(std::memory_order_relaxed); }  // return the global epoch
+
+   private:
+    struct Retired {
+        std::uint64_t epoch;  // global epoch when the block was retired
+        PoolMemory *pool;     // pool the block goes back to
+        void *pblock;
+    };
+
+    /** What the domain knows of a thread, never freed before the domain so that try_advance() can walk them without locks */
+    struct alignas(64) Record {
+        std::atomic<std::uint64_t> pinned{0};  // epoch << 1 | 1 while the thread is pinned, 0 otherwise
+        std::atomic<bool> in_use{true};        // whether a handle holds the record, a joining thread reuses a released one
+        Record *next = nullptr;                // next record of the domain, set before the record is published
+        std::size_t nesting = 0;               // number of guards the thread holds, only the outermost one pins
+        std::vector<Retired> retired;          // blocks retired by the thread, in the order of their epochs
+    };
+
+    bool try_advance();                                  // advance the epoch if no thread is pinned in an older one
+    std::size_t collect(std::vector<Retired> &retired);  // free the blocks of retired whose grace period has passed, retired is in epoch order
+    void orphan(std::vector<Retired> &retired);          // hand the blocks of a leaving thread to the domain
+
+    std::size_t m_batch;                             // retired blocks a thread gathers before it tries to free them
+    alignas(64) std::atomic<std::uint64_t> m_epoch;  // global epoch, only ever advanced by one
+    std::atomic<Record *> m_records;                 // every record ever registered, pushed at the head
+    std::mutex m_orphans_mutex;                      // protects m_orphans
+    std::vector<Retired> m_orphans;                  // blocks left by threads that left the domain, in epoch order, freed by whoever flushes next
+};
+
+/** A thread's membership in an EpochDomain, only used by the thread that joined */
+class EpochDomain::Handle
+{
+   public:
+    /** Keeps the thread pinned while it lives, the nodes it reads can't be freed until it's gone */
+    class Guard
+    {
+       public:
+        explicit Guard(Handle &handle) : m_phandle(&handle) { handle.pin(); }
+        Guard(const Guard &guard) = delete;
+        Guard &operator=(const Guard &rhs) = delete;
+        ~Guard() { m_phandle->unpin(); }
+
+       private:
+        Handle *m_phandle;
+    };
+
+    Handle(Handle &&handle) noexcept : m_pdomain(handle.m_pdomain), m_precord(handle.m_precord) { handle.m_precord = nullptr; }
+    Handle(const Handle &handle) = delete;
+    Handle &operator=(const Handle &rhs) = delete;
+    Handle &operator=(Handle &&rhs) = delete;
+
+    ~Handle();  // leave the domain, the blocks still retired are freed by the other threads or by the domain
+
+    Guard guard() { return Guard(*this); }  // pin the thread for the scope of the returned guard
+    void pin();                             // pin the thread explicitly, pins nest
+    void unpin();
+
+    // free pblock, gotten from pool, once no pinned thread can be reading it anymore, the caller must have unlinked it already
+    void retire(PoolMemory &pool, void *pblock);
+
+    // try to advance the epoch and free the retired blocks whose grace period has passed, return how many were freed
+    std::size_t flush();
+
+    std::size_t pending() { return m_precord->retired.size(); }  // return the number of blocks this thread retired that wait to be freed
+
+   private:
+    friend class EpochDomain;
+    Handle(EpochDomain &domain, Record &record) : m_pdomain(&domain), m_precord(&record) {}
+
+    EpochDomain *m_pdomain;
+    Record *m_precord;  // nullptr once moved from
+};
+}  // namespace mem
@@ -0,0 +1,291 @@
+#include "frag.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>  // to use sysconf
+#endif
+
+using namespace mem::frag;
+
+namespace
+{
+constexpr int bar_width = 40;  // characters of the longest bar of the histogram
+constexpr int map_width = 64;  // characters per line of a slab map
+constexpr int map_lines = 8;   // lines of a slab map at most, a character stands for several pages beyond that
+
+char page_char(std::size_t carved, std::size_t in_use, std::size_t area)
+{
+    if (carved == 0) return ' ';
+    if (in_use == 0) return '.';
+    if (in_use == area) return '#';
+    return static_cast<char>('0' + (in_use * occupancy_buckets - 1) / area);
+}
+
+void count_page(Occupancy &pages, char page)
+{
+    if (page == ' ')
+        pages.untouched++;
+    else if (page == '.')
+        pages.empty++;
+    else if (page == '#')
+        pages.full++;
+    else
+        pages.partial[page - '0']++;
+}
+
+/** Write text as a JSON string, quoted and escaped, the labels come from the caller and may hold anything */
+void json_string(std::ostream &os, const std::string &text)
+{
+    os << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            os << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+        else
+            os << c;
+    }
+    os << '"';
+}
+
+/** The page least in use of a run of pages, so that a sparse page shows through however many pages a character stands for */
+char least_used(const std::string &pages)
+{
+    auto rank = [](char page) { return page == ' ' ? 100 : page == '.' ? -1 : page == '#' ? 10 : page - '0'; };  // untouched only if every page is
+    return *std::min_element(pages.begin(), pages.end(), [&](char lhs, char rhs) { return rank(lhs) < rank(rhs); });
+}
+
+void print_percent(std::ostream &os, double share) { os << std::fixed << std::setprecision(1) << 100 * share << "%" << std::defaultfloat; }
+}  // namespace
+
+std::uint64_t Occupancy::pages() const
+{
+    std::uint64_t total = untouched + empty + full;
+    for (std::uint64_t count : partial) total += count;
+    return total;
+}
+
+Occupancy &Occupancy::operator+=(const Occupancy &rhs)
+{
+    untouched += rhs.untouched;
+    empty += rhs.empty;
+    full += rhs.full;
+    for (std::size_t i = 0; i < occupancy_buckets; i++) partial[i] += rhs.partial[i];
+    return *this;
+}
+
+double Report::internal() const
+{
+    double requested = 0, served = 0;
+    for (const Class &size_class : classes) {
+        requested += size_class.requested_bytes;
+        served += double(size_class.requests) * size_class.block_size;
+    }
+    return served == 0 ? 0 : 1 - requested / served;
+}
+
+Analyzer::Analyzer(double sparse) : m_sparse(sparse)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    m_page_size = sysconf(_SC_PAGESIZE);
+#else
+    m_page_size = 4096;
+#endif
+}
+
+void Analyzer::add(PoolMemory &pool, const std::string &label)
+{
+    pool.reclaim();
+    std::vector<bool> free = pool.free_map();
+
+    Slab slab;
+    slab.label = label;
+    slab.begin = pool.block(0);
+    slab.block_size = pool.block_size();
+    slab.capacity = pool.capacity();
+    slab.carved = free.size();
+    slab.used = pool.size();
+    if (slab.capacity != 0) {
+        // the bytes of every page the blocks cover, carved and in use, a block may straddle pages and a page hold many blocks
+        std::uintptr_t first_page = reinterpret_cast<std::uintptr_t>(slab.begin) & ~std::uintptr_t(m_page_size - 1);
+        std::uintptr_t end = reinterpret_cast<std::uintptr_t>(pool.block(slab.capacity - 1)) + slab.block_size;
+        std::size_t num_pages = (end - first_page + m_page_size - 1) / m_page_size;
+        std::vector<std::size_t> area(num_pages), carved(num_pages), in_use(num_pages);
+        for (std::size_t i = 0; i < slab.capacity; i++) {
+            std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(pool.block(i)), finish = begin + slab.block_size;
+            for (std::size_t page = (begin - first_page) / m_page_size; page <= (finish - 1 - first_page) / m_page_size; page++) {
+                std::uintptr_t page_begin = first_page + page * m_page_size;
+                std::size_t overlap = std::min(finish, page_begin + m_page_size) - std::max(begin, page_begin);
+                area[page] += overlap;
+                if (i < slab.carved) carved[page] += overlap;
+                if (i < slab.carved && !free[i]) in_use[page] += overlap;
+            }
+        }
+        slab.map.reserve(num_pages);
+        for (std::size_t page = 0; page < num_pages; page++) {
+            slab.map.push_back(page_char(carved[page], in_use[page], area[page]));
+            count_page(slab.pages, slab.map.back());
+        }
+    }
+    m_slabs.push_back(std::move(slab));
+}
+
+void Analyzer::add(WorkerHeap &heap, std::size_t worker)
+{
+    heap.for_each_pool(worker, [&](PoolMemory &pool) { add(pool, "worker " + std::to_string(worker)); });
+}
+
+void Analyzer::request(std::size_t requested, std::size_t block, std::uint64_t count)
+{
+    Requests &requests = m_requests[block];
+    requests.count += count;
+    requests.bytes += requested * count;
+}
+
+Report Analyzer::report() const
+{
+    Report report;
+    report.page_size = m_page_size;
+    report.sparse = m_sparse;
+    report.slabs = m_slabs;
+
+    std::map<std::size_t, Class> classes;
+    std::map<std::size_t, std::vector<std::size_t>> capacities;
+    for (const Slab &slab : m_slabs) {
+        Class &size_class = classes[slab.block_size];
+        size_class.block_size = slab.block_size;
+        size_class.slabs++;
+        size_class.capacity += slab.capacity;
+        size_class.used += slab.used;
+        size_class.pages += slab.pages;
+        capacities[slab.block_size].push_back(slab.capacity);
+
+        // the untouched blocks take no memory, only the carved free ones count
+        std::uint64_t free_bytes = std::uint64_t(slab.carved - slab.used) * slab.block_size;
+        report.used_bytes += std::uint64_t(slab.used) * slab.block_size;
+        report.free_bytes += free_bytes;
+        if (slab.used != 0 && slab.utilization() < m_sparse) size_class.stranded_bytes += free_bytes;
+        report.pages += slab.pages;
+    }
+    for (auto &[block_size, requests] : m_requests) {
+        Class &size_class = classes[block_size];
+        size_class.block_size = block_size;
+        size_class.requests = requests.count;
+        size_class.requested_bytes = requests.bytes;
+    }
+
+    for (auto &[block_size, size_class] : classes) {
+        std::vector<std::size_t> &sizes = capacities[block_size];
+        std::sort(sizes.begin(), sizes.end(), std::greater<>());
+        for (std::uint64_t packed = 0; packed < size_class.used; size_class.packed_slabs++) packed += sizes[size_class.packed_slabs];
+        report.stranded_bytes += size_class.stranded_bytes;
+        report.classes.push_back(size_class);
+    }
+    report.reclaimable_bytes = report.pages.empty * m_page_size;
+    return report;
+}
+
+void mem::frag::dump_text(std::ostream &os, const Report &report, bool maps)
+{
+    os << "Fragmentation of " << report.slabs.size() << " slabs in " << report.pages.pages() << " pages of " << report.page_size << " bytes" << std::endl;
+    os << "  in use:   " << report.used_bytes << " bytes in blocks" << std::endl;
+    os << "  free:     " << report.free_bytes << " bytes in touched blocks, " << report.stranded_bytes << " of them stranded in slabs under ";
+    print_percent(os, report.sparse);
+    os << " use (external fragmentation ";
+    print_percent(os, report.external());
+    os << ")" << std::endl;
+    os << "  pages:    " << report.pages.empty << " empty (" << report.reclaimable_bytes << " bytes trim() can release), "
+       << report.pages.full << " full, " << report.pages.untouched << " never touched" << std::endl;
+    os << "  internal: ";
+    print_percent(os, report.internal());
+    os << " of the bytes of the blocks given to requests unused" << std::endl;
+
+    // the touched pages that hold blocks in use, by how much of them is in use
+    std::uint64_t largest = report.pages.full;
+    for (std::uint64_t count : report.pages.partial) largest = std::max(largest, count);
+    auto bar = [&](const std::string &name, std::uint64_t count) {
+        int width = largest == 0 ? 0 : static_cast<int>((count * bar_width + largest - 1) / largest);
+        os << "  " << std::setw(8) << name << " |" << std::string(width, '#') << std::string(bar_width - width, ' ') << "| " << count << std::endl;
+    };
+    os << "  occupancy of the pages in use" << std::endl;
+    for (std::size_t i = 0; i < occupancy_buckets; i++)
+        bar(std::to_string(i * 100 / occupancy_buckets) + "-" + std::to_string((i + 1) * 100 / occupancy_buckets) + "%", report.pages.partial[i]);
+    bar("full", report.pages.full);
+
+    os << "  block size   slabs        used    capacity  packed slabs  stranded bytes  internal" << std::endl;
+    for (const Class &size_class : report.classes) {
+        os << "  " << std::setw(10) << size_class.block_size << std::setw(8) << size_class.slabs << std::setw(12) << size_class.used
+           << std::setw(12) << size_class.capacity << std::setw(14) << size_class.packed_slabs << std::setw(16) << size_class.stranded_bytes;
+        if (size_class.requests == 0) {
+            os << std::setw(10) << "-" << std::endl;
+        } else {
+            os << std::setw(9) << std::fixed << std::setprecision(1) << 100 * size_class.internal() << "%" << std::defaultfloat << std::endl;
+        }
+    }
+
+    if (!maps) return;
+    os << "  slab maps, a page per character: ' ' never touched, '.' empty, 0-9 tenths in use, '#' full" << std::endl;
+    os << "  (the least used page of the pages a character stands for in a long one)" << std::endl;
+    for (const Slab &slab : report.slabs) {
+        std::size_t per_char = (slab.map.size() + map_width * map_lines - 1) / (map_width * map_lines);
+        std::string map;
+        for (std::size_t at = 0; at < slab.map.size(); at += per_char) map.push_back(least_used(slab.map.substr(at, per_char)));
+
+        os << "  " << slab.label << " " << slab.begin << ", " << slab.capacity << " blocks of " << slab.block_size << " bytes, " << slab.used << " in use (";
+        print_percent(os, slab.utilization());
+        os << ")" << (slab.used != 0 && slab.utilization() < report.sparse ? ", sparse" : "");
+        os << (per_char > 1 ? ", " + std::to_string(per_char) + " pages per character" : "") << std::endl;
+        for (std::size_t at = 0; at < map.size(); at += map_width) os << "    |" << map.substr(at, map_width) << "|" << std::endl;
+    }
+}
+
+void mem::frag::dump_json(std::ostream &os, const Report &report)
+{
+    auto occupancy = [&](const Occupancy &pages) {
+        os << "{\"untouched\": " << pages.untouched << ", \"empty\": " << pages.empty << ", \"partial\": [";
+        for (std::size_t i = 0; i < occupancy_buckets; i++) os << (i == 0 ? "" : ", ") << pages.partial[i];
+        os << "], \"full\": " << pages.full << "}";
+    };
+
+    os << "{\"page_size\": " << report.page_size
+       << ", \"sparse\": " << report.sparse
+       << ", \"used_bytes\": " << report.used_bytes
+       << ", \"free_bytes\": " << report.free_bytes
+       << ", \"stranded_bytes\": " << report.stranded_bytes
+       << ", \"reclaimable_bytes\": " << report.reclaimable_bytes
+       << ", \"external\": " << report.external()
+       << ", \"internal\": " << report.internal()
+       << ", \"pages\": ";
+    occupancy(report.pages);
+    os << ", \"classes\": [";
+    for (std::size_t i = 0; i < report.classes.size(); i++) {
+        const Class &size_class = report.classes[i];
+        os << (i == 0 ? "" : ", ") << "{\"block_size\": " << size_class.block_size
+           << ", \"slabs\": " << size_class.slabs
+           << ", \"used\": " << size_class.used
+           << ", \"capacity\": " << size_class.capacity
+           << ", \"packed_slabs\": " << size_class.packed_slabs
+           << ", \"stranded_bytes\": " << size_class.stranded_bytes
+           << ", \"requests\": " << size_class.requests
+           << ", \"requested_bytes\": " << size_class.requested_bytes
+           << ", \"internal\": " << size_class.internal()
+           << ", \"pages\": ";
+        occupancy(size_class.pages);
+        os << "}";
+    }
+    os << "], \"slabs\": [";
+    for (std::size_t i = 0; i < report.slabs.size(); i++) {
+        const Slab &slab = report.slabs[i];
+        os << (i == 0 ? "" : ", ") << "{\"label\": ";
+        json_string(os, slab.label);
+        os << ", \"block_size\": " << slab.block_size
+           << ", \"capacity\": " << slab.capacity
+           << ", \"carved\": " << slab.carved
+           << ", \"used\": " << slab.used
+           << ", \"map\": \"" << slab.map << "\"}";
+    }
+    os << "]}";
+}
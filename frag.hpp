@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "pool.hpp"
+#include "worker.hpp"
+
+namespace mem
+{
+namespace frag
+{
+/**
+ * Fragmentation and utilization analyzer of pool slabs
+ * An Analyzer walks the blocks of every pool it's given, a lone PoolMemory, the slabs of make_slab() or every pool of
+ * a WorkerHeap worker, and reports how full their pages are, how much of the blocks the requests leave unused (internal
+ * fragmentation) and how many free blocks are stranded in slabs too empty to be worth keeping but not empty enough to
+ * be released (external fragmentation), with the slabs the blocks in use would need if they were packed
+ * dump_text() draws a map of every slab, one character per page, and dump_json() gives the same numbers to a script
+ */
+constexpr std::size_t occupancy_buckets = 10;
+
+/** Pages by the share of their bytes covered by blocks in use */
+struct Occupancy {
+    std::uint64_t untouched = 0;                    // after the watermark, never touched so they take no memory
+    std::uint64_t empty = 0;                        // touched, but no block in use, trim() can release them
+    std::uint64_t partial[occupancy_buckets] = {};  // bucket i is more than i tenths and up to i + 1 tenths in use
+    std::uint64_t full = 0;
+
+    std::uint64_t pages() const;
+    Occupancy &operator+=(const Occupancy &rhs);
+};
+
+struct Slab {
+    std::string label;            // what the slab belongs to, as given to the analyzer
+    const void *begin = nullptr;  // the first block
+    std::size_t block_size = 0;   // bytes of a block
+    std::size_t capacity = 0;     // blocks the slab holds
+    std::size_t carved = 0;       // blocks touched so far, PoolMemory::peak()
+    std::size_t used = 0;         // blocks in use
+    Occupancy pages;
+    std::string map;  // a character per page: ' ' untouched, '.' empty, '0' to '9' its occupancy bucket, '#' full
+
+    double utilization() const { return capacity == 0 ? 0 : double(used) / capacity; }
+};
+
+/** The slabs of one block size, with the requests they serve */
+struct Class {
+    std::size_t block_size = 0;
+    std::size_t slabs = 0;
+    std::uint64_t capacity = 0, used = 0;  // blocks
+    std::size_t packed_slabs = 0;          // slabs the blocks in use would fill if they were packed into the largest ones
+    std::uint64_t stranded_bytes = 0;      // free bytes of the sparse slabs that still have blocks in use
+    std::uint64_t requests = 0;            // requests given with Analyzer::request()
+    std::uint64_t requested_bytes = 0;     // their bytes, out of requests * block_size
+    Occupancy pages;
+
+    double internal() const { return requests == 0 ? 0 : 1 - double(requested_bytes) / (double(requests) * block_size); }
+};
+
+struct Report {
+    std::size_t page_size = 0;
+    double sparse = 0;  // a slab used below this share is sparse
+    std::vector<Slab> slabs;
+    std::vector<Class> classes;  // by block size
+    std::uint64_t used_bytes = 0, free_bytes = 0, stranded_bytes = 0;
+    std::uint64_t reclaimable_bytes = 0;  // of the empty pages, what trim() could give back
+    Occupancy pages;
+
+    double external() const { return free_bytes == 0 ? 0 : double(stranded_bytes) / free_bytes; }  // share of the free bytes stranded
+    double internal() const;  // over every request given, 0 without any
+};
+
+class Analyzer
+{
+   public:
+    // a slab whose share of blocks in use is below sparse counts as mostly empty
+    explicit Analyzer(double sparse = 0.25);
+
+    // walk the blocks of pool now, only its owning thread may call it, and it reclaims the blocks other threads freed
+    void add(PoolMemory &pool, const std::string &label = "pool");
+    // every pool of the worker's size classes, from the worker or once the workers stopped
+    void add(WorkerHeap &heap, std::size_t worker);
+
+    // count requests of requested bytes each served by blocks of block bytes, for the internal fragmentation
+    void request(std::size_t requested, std::size_t block, std::uint64_t count = 1);
+
+    Report report() const;
+
+   private:
+    struct Requests {
+        std::uint64_t count = 0, bytes = 0;
+    };
+
+    double m_sparse;
+    std::size_t m_page_size;
+    std::vector<Slab> m_slabs;
+    std::map<std::size_t, Requests> m_requests;  // by block size
+};
+
+// print a report as text, with the map of every slab if maps is set, or as a JSON object
+void dump_text(std::ostream &os, const Report &report, bool maps = true);
+void dump_json(std::ostream &os, const Report &report);
+}  // namespace frag
+}  // namespace mem
@@ -0,0 +1,58 @@
+#include "frame.hpp"
+
+#include <atomic>
+#include <new>
+
+using mem::frame::Cache;
+
+namespace
+{
+/** Deletes the cache of a thread when it exits, unless some of its frames are still alive somewhere */
+struct Exit {
+    ~Exit()
+    {
+        Cache *pcache = mem::frame::t_cache;
+        mem::frame::t_cache = nullptr;
+        if (pcache != nullptr && pcache->size() == 0) delete pcache;
+    }
+};
+thread_local Exit t_exit;
+
+std::atomic<mem::Budget *> g_budget(nullptr);
+}  // namespace
+
+Cache *mem::frame::make_cache()
+{
+    (void)&t_exit;  // constructs it, and so registers its destructor for this thread
+    t_cache = new Cache(g_budget.load(std::memory_order_acquire));
+    return t_cache;
+}
+
+void mem::frame::set_budget(Budget *budget) { g_budget.store(budget, std::memory_order_release); }
+
+/** A large frame is its Large, then the header, then the frame */
+void *Cache::get_large(std::size_t size)
+{
+    Budget *budget = m_classes.budget();
+    if (budget != nullptr) budget->charge(size);
+    Large *plarge;
+    try {
+        plarge = static_cast<Large *>(::operator new(2 * header_size + size));
+    } catch (...) {
+        if (budget != nullptr) budget->release(size);
+        throw;
+    }
+    plarge->size = size;
+    plarge->budget = budget;
+    auto header = reinterpret_cast<Header *>(reinterpret_cast<std::byte *>(plarge) + header_size);
+    header->pool = nullptr;
+    header->cache = nullptr;
+    return reinterpret_cast<std::byte *>(header) + header_size;
+}
+
+void Cache::free_large(Header *header) noexcept
+{
+    auto plarge = reinterpret_cast<Large *>(reinterpret_cast<std::byte *>(header) - header_size);
+    if (plarge->budget != nullptr) plarge->budget->release(plarge->size);
+    ::operator delete(plarge);
+}
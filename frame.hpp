@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+
+#include "budget.hpp"
+#include "classes.hpp"
+#include "pool.hpp"
+
+namespace mem
+{
+/**
+ * Coroutine Frame Allocation
+ * C++20 coroutines get their frames from operator new of their promise type, PooledFrame routes them to size class
+ * pools of the calling thread instead, so that starting a coroutine costs a pool get and no malloc:
+ *
+ *     struct promise_type : mem::PooledFrame { ... };
+ *
+ * Every thread has a cache of PoolMemory per size class, SizeClasses grown like those of WorkerHeap (see classes.hpp),
+ * whose first pool of a class holds a page worth of frames, at least 16 of them
+ * A frame remembers its pool and cache in a 16 byte header, so a coroutine may be destroyed on another thread than the
+ * one that started it: the frame goes back with remote_free() and its thread reclaims it on its next miss
+ * The cache of a thread that exits with frames still alive stays allocated so that those frames can still go back to it
+ *
+ * With set_budget(), the pools and the large frames of the caches made from then on are charged to a Budget like those of
+ * WorkerHeap: a class whose budget can't take a pool twice as large falls back to a pool of the first size, a frame that
+ * doesn't fit at all throws std::bad_alloc, the pools are released when the cache of an exited thread is deleted and a
+ * large frame when it's destroyed
+ */
+namespace frame
+{
+constexpr std::size_t header_size = 16;  // bytes in front of every frame
+constexpr std::size_t min_size = 64;     // payload of the smallest class, the classes double up to max_size
+constexpr std::size_t num_classes = 7;
+constexpr std::size_t max_size = min_size << (num_classes - 1);  // larger frames go to operator new
+
+/** The size class pools of one thread */
+class Cache
+{
+   public:
+    struct Header {
+        PoolMemory *pool;  // pool the frame came from, nullptr for a frame of operator new
+        Cache *cache;      // cache of the thread that started the coroutine
+    };
+    static_assert(sizeof(Header) == header_size, "the header has to keep the frames aligned");
+
+    // in front of the header of a frame of operator new, so that free_large() knows what to release, the cache may be gone by then
+    struct Large {
+        std::size_t size;  // bytes charged to the budget
+        Budget *budget;    // budget of the cache that got it, nullptr if none
+    };
+    static_assert(sizeof(Large) == header_size, "the size has to keep the frames aligned");
+
+    explicit Cache(Budget *budget = nullptr) : m_classes(16, 4096, budget) {}
+
+    Cache(const Cache &cache) = delete;          // delete copy constructor
+    Cache &operator=(const Cache &rhs) = delete;  // delete copy-assignment operator
+
+    void *get(std::size_t size);
+    static void free(void *pframe) noexcept;  // free a frame of any cache, without making one for the calling thread
+
+    std::size_t size() { return m_classes.size(); }  // return the number of frames of this cache that aren't back, only from the cache's thread
+
+   private:
+    using Classes = SizeClasses<header_size, min_size, num_classes>;
+
+    MEM_COLD void *get_large(std::size_t size);
+    MEM_COLD static void free_large(Header *header) noexcept;
+
+    Classes m_classes;
+};
+
+MEM_COLD Cache *make_cache();                  // create the cache of the calling thread
+MEM_COLD void set_budget(Budget *budget);      // charge the caches made from now on to budget, nullptr for none, which has to outlive them and their frames
+inline thread_local Cache *t_cache = nullptr;  // trivially destructible, so that the fast path has no guard to check
+
+// return the cache of the calling thread
+inline Cache *cache()
+{
+    Cache *pcache = t_cache;
+    if (pcache == nullptr) MEM_UNLIKELY {
+        pcache = make_cache();
+    }
+    return pcache;
+}
+
+// get and free frames like operator new and operator delete of a promise type would
+inline void *allocate(std::size_t size) { return cache()->get(size); }
+inline void deallocate(void *pframe) noexcept { Cache::free(pframe); }
+
+// return the number of frames started on the calling thread that haven't been destroyed yet
+inline std::size_t in_use() { return cache()->size(); }
+}  // namespace frame
+
+/** Mixin for promise types whose coroutine frames should come from the pools */
+struct PooledFrame {
+    static void *operator new(std::size_t size) { return frame::allocate(size); }
+    static void operator delete(void *pframe) { frame::deallocate(pframe); }
+};
+
+/** Coroutine Frame Fast Path, inlined into the coroutines */
+inline void *frame::Cache::get(std::size_t size)
+{
+    if (size > max_size) MEM_UNLIKELY {
+        return get_large(size);
+    }
+    PoolMemory *pool;
+    auto header = static_cast<Header *>(m_classes.get(Classes::class_of(size), pool));
+    header->pool = pool;
+    header->cache = this;
+    return reinterpret_cast<std::byte *>(header) + header_size;
+}
+
+inline void frame::Cache::free(void *pframe) noexcept
+{
+    if (pframe == nullptr) return;
+    auto header = reinterpret_cast<Header *>(static_cast<std::byte *>(pframe) - header_size);
+    if (header->pool == nullptr) MEM_UNLIKELY {
+        free_large(header);
+    } else if (header->cache == t_cache) MEM_LIKELY {
+        header->pool->free(header);
+    } else {
+        header->pool->remote_free(header);  // resumed and destroyed on another thread
+    }
+}
+}  // namespace mem
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+namespace mem
+{
+/**
+ * Growth policies: how many blocks the next pool of a growing allocator holds, like list::allocator's
+ * A policy is an object the allocator keeps, so a stateless one takes no space in it
+ *     std::size_t first(std::size_t block_sz_bytes)                          blocks of the first pool
+ *     std::size_t next(std::size_t block_sz_bytes, std::size_t last_blocks)  blocks of the pool after one of last_blocks was exhausted
+ * Both return at least one block
+ */
+namespace growth
+{
+constexpr std::size_t blocks_in(std::size_t bytes, std::size_t block_sz_bytes) { return bytes / block_sz_bytes > 0 ? bytes / block_sz_bytes : 1; }
+
+/** Start at FirstBytes and multiply by Factor, up to MaxBytes per pool, so neither tiny pools nor a huge overshoot */
+template <std::size_t Factor = 2, std::size_t FirstBytes = 4096, std::size_t MaxBytes = std::size_t(1) << 20>
+struct Geometric {
+    static_assert(Factor >= 1 && FirstBytes <= MaxBytes, "a geometric growth needs a factor and a first pool no larger than the cap");
+
+    std::size_t first(std::size_t block_sz_bytes) { return blocks_in(FirstBytes, block_sz_bytes); }
+    std::size_t next(std::size_t block_sz_bytes, std::size_t last_blocks)
+    {
+        std::size_t cap = blocks_in(MaxBytes, block_sz_bytes);
+        return last_blocks >= cap / Factor ? cap : last_blocks * Factor;
+    }
+};
+
+/** Every pool is PageBytes, like a page or a huge page, so that every pool costs the same to map and to give back */
+template <std::size_t PageBytes = 64 * 1024>
+struct Paged {
+    std::size_t first(std::size_t block_sz_bytes) { return blocks_in(PageBytes, block_sz_bytes); }
+    std::size_t next(std::size_t block_sz_bytes, std::size_t) { return blocks_in(PageBytes, block_sz_bytes); }
+};
+
+/**
+ * Size the next pool to last HorizonMs milliseconds of the recent demand, between MinBytes and MaxBytes
+ * The demand is the rate at which the last pools were used up, smoothed over the growths, so a burst grows the pools
+ * quickly and a container that grows slowly keeps getting small ones
+ */
+template <std::size_t HorizonMs = 10, std::size_t MinBytes = 4096, std::size_t MaxBytes = std::size_t(4) << 20>
+class Adaptive
+{
+   public:
+    std::size_t first(std::size_t block_sz_bytes)
+    {
+        m_last_growth = std::chrono::steady_clock::now();
+        return blocks_in(MinBytes, block_sz_bytes);
+    }
+
+    std::size_t next(std::size_t block_sz_bytes, std::size_t last_blocks)
+    {
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - m_last_growth).count();
+        m_last_growth = now;
+
+        double rate = last_blocks / (seconds > 1e-6 ? seconds : 1e-6);  // blocks per second it took to use up the last pool
+        m_rate = m_rate == 0 ? rate : (m_rate + rate) / 2;
+
+        double wanted = m_rate * HorizonMs / 1000;
+        std::size_t min_blocks = blocks_in(MinBytes, block_sz_bytes), max_blocks = blocks_in(MaxBytes, block_sz_bytes);
+        return wanted < min_blocks ? min_blocks : wanted > max_blocks ? max_blocks : std::size_t(wanted);
+    }
+
+   private:
+    std::chrono::steady_clock::time_point m_last_growth;
+    double m_rate = 0;  // smoothed blocks per second
+};
+}  // namespace growth
+}  // namespace mem
@@ -4,10 +4,19 @@
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
+#include "budget.hpp"
+#include "growth.hpp"
 #include "myAllocator_trait.hpp"
 #include "pool.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
+#ifdef MEM_TRACE
+#include "trace.hpp"
+#endif  // MEM_TRACE
 
 namespace vector
 {
@@ -51,20 +60,20 @@ class allocator
     pointer allocate(size_type n)
     {
         size_type size = sizeof(value_type) * n;
+        pointer ptr;
         if (_mpool == nullptr) {
             _mpool = new mem::MonoMemory(size * chunk_num);
-            pointer ptr = static_cast<pointer>(_mpool->get(size));
-            return ptr;
-        }
-
-        if (_mpool->free_count() > size) {
-            pointer ptr = static_cast<pointer>(_mpool->get(size));
-            return ptr;
-        } else {
+            ptr = static_cast<pointer>(_mpool->get(size));
+        } else if ((ptr = static_cast<pointer>(_mpool->get<mem::oom::Null>(size))) == nullptr) {
+            // not enough space left, grow a new chunk from upstream
             _current_pool = new mem::MonoMemory(size * chunk_num);
-            pointer ptr = static_cast<pointer>(_current_pool->get(size));
-            return ptr;
+            ptr = static_cast<pointer>(_current_pool->get(size));
         }
+#ifdef MEM_TRACE
+        mem::trace::record_allocate(ptr, size);
+#endif  // MEM_TRACE
+        mem::profile::record_allocate(ptr, size, std::size_t(1) << mem::stats::class_of(size), "vector::allocator");
+        return ptr;
     }
 
     // deallocate (left before c++17)
@@ -72,6 +81,10 @@ class allocator
     {
         // n must be consistent with the allocated space.
         assert(p != nullptr);
+#ifdef MEM_TRACE
+        mem::trace::record_deallocate(p, sizeof(value_type) * n);
+#endif  // MEM_TRACE
+        mem::profile::record_deallocate(p);
         if (_current_pool != nullptr) {
             _mpool->~MonoMemory();
             _mpool = _current_pool;
@@ -102,19 +115,50 @@ class allocator
     mem::MonoMemory* _current_pool = nullptr;
 };
 
-// template< typename T1, typename Tr1, typename T2, typename Tr2 >
-// inline bool operator==(const allocator<T1, Tr1>&, const allocator<T2, Tr2>&) { return true; }
-// template< typename T, typename Tr>
-// inline bool operator==(const allocator<T, Tr>&, const allocator<T, Tr>&) { return true; }
-// template< typename T1, typename Tr1, typename T2, typename Tr2 >
-// inline bool operator!=(const allocator<T1, Tr1>&, const allocator<T2, Tr2>&) { return false; }
-// template< typename T, typename Tr>
-// inline bool operator!=(const allocator<T, Tr>&, const allocator<T, Tr>&) { return false; }
+template <typename T1, typename Tr1, typename T2, typename Tr2>
+inline bool operator==(const allocator<T1, Tr1>&, const allocator<T2, Tr2>&) { return true; }
+template <typename T1, typename Tr1, typename T2, typename Tr2>
+inline bool operator!=(const allocator<T1, Tr1>&, const allocator<T2, Tr2>&) { return false; }
 }  // namespace vector
 
 namespace list
 {
-template <typename T, typename Tr = trait::Allocator_Traits<T> >
+namespace detail
+{
+// the pools of an allocator, shared by its copies and the allocators rebound from them, one family of pools per block size
+// they go back to the system and their bytes to the budget with the last allocator sharing them
+template <class Growth>
+struct Pools {
+    struct Family {
+        std::vector<mem::PoolMemory*> pools;                        // memory resource for management, the newest last
+        std::map<const void*, mem::PoolMemory*, std::less<>> starts;  // the pools by where they start, the pools stop growing once capped so there may be many
+        std::vector<mem::PoolMemory*> partial;                      // full pools that got blocks back, other than the current one
+        mem::PoolMemory* current = nullptr;                          // pool the blocks are gotten from
+        std::size_t first_blocks = 0;                                // blocks of the first pool, what a refused growth falls back to
+        [[no_unique_address]] Growth growth;                         // size of the next pool
+    };
+
+    explicit Pools(mem::Budget* budget) : budget(budget) {}
+    Pools(const Pools&) = delete;             // delete copy constructor
+    Pools& operator=(const Pools&) = delete;  // delete copy-assignment operator
+
+    ~Pools()
+    {
+        for (auto& [block_sz, family] : families) {
+            for (mem::PoolMemory* pool : family.pools) {
+                if (budget != nullptr) budget->release(pool->capacity() * block_sz);
+                delete pool;
+            }
+        }
+    }
+
+    mem::Budget* budget;                      // budget the pools are charged to
+    std::map<std::size_t, Family> families;  // by block size, a map so that the allocators can keep pointers to theirs
+};
+}  // namespace detail
+
+// Growth is how many blocks each new pool holds, see growth.hpp
+template <typename T, typename Tr = trait::Allocator_Traits<T>, class Growth = mem::growth::Geometric<> >
 class allocator
 {
    public:
@@ -126,25 +170,25 @@ class allocator
     using size_type = std::size_t;
     using difference_type = std::ptrdiff_t;
     using propagate_on_container_move_assignment = std::true_type;
-    using is_always_equal = std::true_type;
-
-    const size_type chunk_size = 1;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;  // a block can only go back to the allocators sharing the pools it came from
 
     template <typename U>
     struct rebind {
-        typedef allocator<U> other;
+        typedef allocator<U, typename Tr::template rebind<U>::other, Growth> other;  // the node allocator of a container keeps our policy
     };
 
-    // constructor
-    inline allocator() noexcept {};
-    inline allocator(const allocator&) noexcept {};
-    template <typename U>
-    inline allocator(const allocator<U>&) noexcept {};
+    // constructor, the copies and the rebound allocators of a container share the pools and their budget
+    inline allocator() : _mshared(std::make_shared<detail::Pools<Growth> >(nullptr)){};
+    inline explicit allocator(mem::Budget* budget) : _mshared(std::make_shared<detail::Pools<Growth> >(budget)){};
+    inline allocator(const allocator& other) noexcept = default;
     template <typename U, typename Trr>
-    inline allocator(const allocator<U, Trr>&) noexcept {};
+    inline allocator(const allocator<U, Trr, Growth>& other) noexcept : _mshared(other.shared()){};
 
-    // destructor
-    inline ~allocator(){};
+    inline allocator& operator=(const allocator& rhs) noexcept = default;
+
+    inline mem::Budget* budget() const noexcept { return _mshared->budget; }  // return the budget the pools are charged to, nullptr if none
+    inline const std::shared_ptr<detail::Pools<Growth> >& shared() const noexcept { return _mshared; }  // return the pools this allocator shares
 
     // address (left before c++17)
     inline pointer address(reference r) { return &r; }
@@ -153,38 +197,54 @@ class allocator
     // allocate
     pointer allocate(size_type n)
     {
-        if (sizeof(pointer) > sizeof(T)) return reinterpret_cast<pointer>(::operator new(n * sizeof(T)));
-        if (_mpools.empty() == true) {
-            // first allocator memory for user
-            mem::PoolMemory* pool = new mem::PoolMemory(sizeof(T), chunk_size);
-            _mpools.push_back(pool);
-            pointer ptr = static_cast<pointer>(pool->get());
-            return ptr;
+        pointer ptr;
+        if (sizeof(pointer) > sizeof(T)) {
+            ptr = reinterpret_cast<pointer>(::operator new(n * sizeof(T)));
         } else {
-            mem::PoolMemory* pool = _mpools.back();
-            if (pool->full() == false) {
-                pointer ptr = static_cast<pointer>(pool->get());
-                return ptr;
-            } else {
-                //we need to allocate a new one by expand.
-                pool = new mem::PoolMemory(sizeof(T), pool->capacity() * 2);
-                _mpools.push_back(pool);
-                //return a new free block.
-                pointer ptr = static_cast<pointer>(pool->get());
-                return ptr;
+            Family& family = this->family();
+            ptr = family.current == nullptr ? nullptr : static_cast<pointer>(family.current->template get<mem::oom::Null>());
+            // take the blocks freed into older pools before growing, so that capped pools are recycled
+            while (ptr == nullptr && family.partial.empty() == false) {
+                family.current = family.partial.back();
+                family.partial.pop_back();
+                ptr = static_cast<pointer>(family.current->template get<mem::oom::Null>());
+            }
+            if (ptr == nullptr) {
+                // we need to allocate a new one by expand, as large as the growth policy says.
+                if (family.pools.empty()) family.first_blocks = family.growth.first(sizeof(T));
+                size_type num_blocks = family.pools.empty() ? family.first_blocks : family.growth.next(sizeof(T), family.pools.back()->capacity());
+                ptr = static_cast<pointer>(grow(family, num_blocks));
             }
         }
+#ifdef MEM_TRACE
+        mem::trace::record_allocate(ptr, n * sizeof(T));
+#endif  // MEM_TRACE
+        mem::profile::record_allocate(ptr, n * sizeof(T), sizeof(T), "list::allocator");  // tagged with the block size of the pools
+        return ptr;
     }
     // deallocate
     void deallocate(pointer p, size_type n)
     {
         // set p free when it's deallocate.
         // assert(p != nullptr);
-        if (sizeof(pointer) > sizeof(T)) ::operator delete(p);
-        if (_mpools.empty() == false) {
-            mem::PoolMemory* pool = _mpools.back();
-            void* fblock = static_cast<void*>(p);
+#ifdef MEM_TRACE
+        mem::trace::record_deallocate(p, n * sizeof(T));
+#endif  // MEM_TRACE
+        mem::profile::record_deallocate(p);
+        if (sizeof(pointer) > sizeof(T)) {
+            ::operator delete(p);
+            return;
+        }
+        // give the block back to the pool it came from, the last pool starting at or before it
+        Family& family = this->family();
+        void* fblock = static_cast<void*>(p);
+        auto it = family.starts.upper_bound(fblock);
+        bool owned = it != family.starts.begin() && (--it)->second->owns(fblock);
+        assert(owned && "deallocate: the block doesn't come from the pools of this allocator");
+        if (owned) {
+            mem::PoolMemory* pool = it->second;
             pool->free(fblock);
+            if (pool != family.current && pool->free_count() == 1) family.partial.push_back(pool);  // the pool was full until now
         }
     }
     // max_size
@@ -206,15 +266,50 @@ class allocator
     }
 
    private:
-    std::vector<mem::PoolMemory*> _mpools;  // memory resource for management
+    using Family = typename detail::Pools<Growth>::Family;
+
+    // return the pools of our block size, found once, the copies and rebinds are made without allocating
+    Family& family()
+    {
+        if (_mfamily == nullptr) _mfamily = &_mshared->families[sizeof(T)];
+        return *_mfamily;
+    }
+
+    // add a pool of num_blocks blocks and return its first block, which is where its memory starts as nothing was carved yet
+    // with a budget that can't take it, a pool of the first size is tried instead, and std::bad_alloc thrown if not even that fits
+    void* grow(Family& family, size_type num_blocks)
+    {
+        mem::Budget* budget = _mshared->budget;
+        if (budget != nullptr) num_blocks = budget->charge_or_fallback(family.first_blocks, num_blocks, sizeof(T));
+        mem::PoolMemory* pool = nullptr;
+        try {
+            pool = new mem::PoolMemory(sizeof(T), num_blocks);
+            family.pools.push_back(pool);
+        } catch (...) {
+            delete pool;
+            if (budget != nullptr) budget->release(num_blocks * sizeof(T));
+            throw;
+        }
+        family.current = pool;
+        void* first = pool->get();
+        family.starts.emplace(first, pool);
+        return first;
+    }
+
+    std::shared_ptr<detail::Pools<Growth> > _mshared;  // the pools, shared by the copies and rebinds
+    Family* _mfamily = nullptr;                          // the family of our block size in them, nullptr until first used
 };
 
-// template< typename T1, typename Tr1, typename T2, typename Tr2 >
-// inline bool operator==(const allocator<T1, Tr1>&, const allocator<T2, Tr2>&) { return true; }
-// template< typename T, typename Tr>
-// inline bool operator==(const allocator<T, Tr>&, const allocator<T, Tr>&) { return true; }
-// template< typename T1, typename Tr1, typename T2, typename Tr2 >
-// inline bool operator!=(const allocator<T1, Tr1>&, const allocator<T2, Tr2>&) { return false; }
-// template< typename T, typename Tr>
-// inline bool operator!=(const allocator<T, Tr>&, const allocator<T, Tr>&) { return false; }
-}  // namespace list
\ No newline at end of file
+// equal when they share their pools, so that either can free what the other allocated
+template <typename T1, typename Tr1, typename G1, typename T2, typename Tr2, typename G2>
+inline bool operator==(const allocator<T1, Tr1, G1>& lhs, const allocator<T2, Tr2, G2>& rhs)
+{
+    if constexpr (std::is_same_v<G1, G2>) {
+        return lhs.shared() == rhs.shared();
+    } else {
+        return false;
+    }
+}
+template <typename T1, typename Tr1, typename G1, typename T2, typename Tr2, typename G2>
+inline bool operator!=(const allocator<T1, Tr1, G1>& lhs, const allocator<T2, Tr2, G2>& rhs) { return !(lhs == rhs); }
+}  // namespace list
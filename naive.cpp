@@ -6,64 +6,7 @@
 #include <random>
 #include <ctime>
 
-namespace oop {
-    template <typename T>
-    class Allocator
-    {
-    public:
-        using value_type = T;
-        using pointer = T*;
-        using reference = T&;
-        using const_pointer = const T*;
-        using const_reference = const T&;
-        using size_type = std::size_t;
-        using difference_type = std::ptrdiff_t;
-        using propagate_on_container_move_assignment = std::true_type;
-        using is_always_equal = std::true_type;
-
-
-        template <typename U> struct rebind {
-            typedef Allocator<U> other;
-        };
-
-        // constructor
-        Allocator() noexcept {}
-        Allocator(const Allocator&) noexcept {}
-        template <typename U>
-        Allocator(const Allocator<U>&) noexcept {}
-
-        // destructor
-        ~Allocator() {};
-
-        // address(deprecated in C++17)
-        pointer address(reference x) const noexcept { return &x; }
-        const_pointer address(const_reference x) const noexcept { return &x; }
-
-        // allocate
-        pointer allocate(size_type n) {
-            return reinterpret_cast<pointer>(::operator new(n * sizeof(T)));
-        }
-        // deallocate
-        void deallocate(pointer p, size_type n) {
-            ::operator delete(p);
-        }
-
-        // max_size
-        size_type max_size() const noexcept {
-            return std::numeric_limits<size_type>::max() / sizeof(value_type);
-        }
-    private:
-
-    };
-    template< typename T1, typename T2 >
-    inline bool operator==(const Allocator<T1>&, const Allocator<T2>&) { return true; }
-    template< typename T>
-    inline bool operator==(const Allocator<T>&, const Allocator<T>&) { return true; }
-    template< typename T1, typename T2 >
-    inline bool operator!=(const Allocator<T1>&, const Allocator<T2>&) { return false; }
-    template< typename T>
-    inline bool operator!=(const Allocator<T>&, const Allocator<T>&) { return false; }
-} // namespace oop
+#include "naive.hpp"
 
 //const int TestSize = 10;
 //const int PickSize = 1;
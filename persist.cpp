@@ -0,0 +1,179 @@
+#include "persist.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>     // to use open
+#include <sys/file.h>  // to use flock
+#include <sys/mman.h>  // to use mmap
+#include <sys/stat.h>  // to use fstat
+#include <unistd.h>    // to use ftruncate and sysconf
+#define MEM_HAS_MMAP
+#endif
+
+using mem::PersistentPool;
+
+namespace
+{
+[[noreturn]] void fail(const std::string &path, const std::string &what)
+{
+    throw std::runtime_error(path + ": " + what);
+}
+[[noreturn]] void fail_errno(const std::string &path, const char *call)
+{
+    fail(path, std::string(call) + " failed, " + std::strerror(errno));
+}
+}  // namespace
+
+#ifdef MEM_HAS_MMAP
+PersistentPool::PersistentPool(const std::string &path, std::size_t block_sz_bytes, std::size_t num_blocks)
+    : PersistentPool(path, block_sz_bytes, num_blocks, walk_t())
+{
+}
+
+PersistentPool::PersistentPool(const std::string &path, std::size_t block_sz_bytes, std::size_t num_blocks, const walk_t &recover)
+    : m_pheader(nullptr), m_pdata(nullptr), m_map_size(0), m_fd(-1), m_resumed(false), m_recovered(false), m_relocated(false)
+{
+    std::size_t page_sz = sysconf(_SC_PAGESIZE);
+    std::size_t data_offset = (sizeof(Header) + page_sz - 1) / page_sz * page_sz;
+    m_map_size = data_offset + block_sz_bytes * num_blocks;
+
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (m_fd < 0) fail_errno(path, "open");
+
+    // two pools on the same file would resume the same free list and hand out the same blocks
+    if (::flock(m_fd, LOCK_EX | LOCK_NB) != 0) {
+        int error = errno;
+        ::close(m_fd);
+        if (error == EWOULDBLOCK) fail(path, "is already open");
+        errno = error;
+        fail_errno(path, "flock");
+    }
+
+    struct stat st;
+    if (::fstat(m_fd, &st) != 0) {
+        ::close(m_fd);
+        fail_errno(path, "fstat");
+    }
+    m_resumed = st.st_size != 0;
+
+    // a header we can read before mapping anything, to check the geometry and to find the last address
+    Header header = {};
+    if (m_resumed) {
+        if (std::size_t(st.st_size) < sizeof(Header) || ::pread(m_fd, &header, sizeof(header), 0) != sizeof(header)) {
+            ::close(m_fd);
+            fail(path, "too short to be a pool");
+        }
+        std::string error;
+        if (std::memcmp(header.magic, "MPOL", 4) != 0 || header.version != version)
+            error = "not a version " + std::to_string(version) + " pool";
+        else if (header.block_sz_bytes != block_sz_bytes || header.num_blocks != num_blocks || header.data_offset != data_offset)
+            error = "holds a pool of a different geometry";
+        else if (std::size_t(st.st_size) != m_map_size)
+            error = "is truncated";
+        else if (header.clean != 1 && !recover)
+            error = "wasn't closed cleanly, its free list can't be trusted";
+#ifndef MEM_HARDENED
+        else if (header.clean == 1 && header.state.cookie != 0)
+            error = "holds the mangled free list links of a hardened build, which this build can't decode";
+#endif
+        if (!error.empty()) {
+            ::close(m_fd);
+            fail(path, error);
+        }
+    } else if (::ftruncate(m_fd, m_map_size) != 0) {
+        ::close(m_fd);
+        fail_errno(path, "ftruncate");
+    }
+
+    // ask for the last address, the kernel takes it as a hint and gives us another one if it's taken
+    void *hint = m_resumed ? reinterpret_cast<void *>(header.base_address - data_offset) : nullptr;
+    void *mapping = ::mmap(hint, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (mapping == MAP_FAILED) {
+        ::close(m_fd);
+        fail_errno(path, "mmap");
+    }
+    m_pheader = static_cast<Header *>(mapping);
+    m_pdata = static_cast<std::byte *>(mapping) + data_offset;
+
+    if (m_resumed) {
+        m_relocated = reinterpret_cast<std::uintptr_t>(m_pdata) != m_pheader->base_address;
+        m_recovered = m_pheader->clean != 1;
+        if (m_recovered) {
+            try {
+                this->recover(path, recover);
+            } catch (...) {
+                m_pool.reset();
+                ::munmap(mapping, m_map_size);
+                ::close(m_fd);
+                throw;
+            }
+        } else {
+            m_pool.emplace(block_sz_bytes, num_blocks, m_pdata, m_pheader->state);
+        }
+    } else {
+        std::memcpy(m_pheader->magic, "MPOL", 4);
+        m_pheader->version = version;
+        m_pheader->block_sz_bytes = block_sz_bytes;
+        m_pheader->num_blocks = num_blocks;
+        m_pheader->data_offset = data_offset;
+        m_pheader->root = 0;
+        m_pool.emplace(block_sz_bytes, num_blocks, m_pdata);
+    }
+    m_pheader->base_address = reinterpret_cast<std::uintptr_t>(m_pdata);
+
+    // until we're closed the state in the file is stale, a crash has to leave it marked as such
+    m_pheader->clean = 0;
+    ::msync(m_pheader, page_sz, MS_SYNC);
+}
+
+PersistentPool::~PersistentPool()
+{
+    sync();
+    m_pheader->clean = 1;
+    ::msync(m_pheader, sizeof(Header), MS_SYNC);
+    m_pool.reset();
+    ::munmap(m_pheader, m_map_size);
+    ::close(m_fd);
+}
+
+void PersistentPool::sync()
+{
+    m_pheader->state = m_pool->state();
+    ::msync(m_pheader, m_map_size, MS_SYNC);
+}
+
+void PersistentPool::recover(const std::string &path, const walk_t &walk)
+{
+    // the blocks still in use, in address order
+    std::vector<void *> used;
+    walk(*this, [&used](void *pblock) { used.push_back(pblock); });
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+
+    // a new pool on the blocks carves them in address order, keep the ones in use and free the others
+    m_pool.emplace(m_pheader->block_sz_bytes, m_pheader->num_blocks, m_pdata);
+    std::vector<void *> unused;
+    for (void *pblock : used) {
+        if (!m_pool->owns(pblock)) fail(path, "the recovery walk reached a block outside of the pool");
+        for (;;) {
+            void *pcarved = m_pool->get();
+            if (pcarved == pblock) break;
+            if (pcarved > pblock) fail(path, "the recovery walk reached a pointer into the middle of a block");
+            unused.push_back(pcarved);
+        }
+    }
+
+    // freed backwards, so that the free list hands them out again in address order
+    for (auto it = unused.rbegin(); it != unused.rend(); ++it) m_pool->free(*it);
+}
+#else
+PersistentPool::PersistentPool(const std::string &path, std::size_t, std::size_t) { fail(path, "memory-mapped pools need mmap"); }
+PersistentPool::PersistentPool(const std::string &path, std::size_t, std::size_t, const walk_t &) { fail(path, "memory-mapped pools need mmap"); }
+PersistentPool::~PersistentPool() {}
+void PersistentPool::sync() {}
+#endif  // MEM_HAS_MMAP
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+
+#include "pool.hpp"
+
+namespace mem
+{
+/**
+ * A PoolMemory whose memory is a memory-mapped file, so that a process can reopen it and resume with its structures intact
+ * The pool runs on the mapping through the external memory constructor, its state is saved in a header in front of the blocks
+ * The free list links are offsets, so the file stays valid wherever it's mapped, we ask for the address of the last mapping
+ * so that raw pointers between the blocks stay valid too whenever we get it (see relocated())
+ *
+ * File layout: a Header padded to a page, then num_blocks blocks of block_sz_bytes
+ * The state in the header is only written by sync() and on close, a file that was never closed cleanly is refused unless the
+ * caller can recover it: the blocks may have changed after the last sync(), so it's their walk from root() that tells which are in use
+ * The file is locked while it's open, a second PersistentPool on it, in this process or another one, is refused
+ * Only available where mmap and flock are, the constructor throws std::runtime_error elsewhere
+ */
+class PersistentPool
+{
+   public:
+    struct Header {
+        char magic[4];                 // "MPOL"
+        std::uint32_t version;         // bumped on every layout change
+        std::uint64_t block_sz_bytes;  // geometry of the pool, checked when the file is reopened
+        std::uint64_t num_blocks;
+        std::uint64_t data_offset;   // where the first block starts in the file
+        std::uint64_t base_address;  // where the blocks were mapped last time
+        std::uint64_t root;          // offset + 1 of the user's root block, 0 if none
+        std::uint64_t clean;         // 1 when the state below was saved on close, 0 while the file is open
+        PoolMemory::State state;     // state of the pool as of the last sync()
+    };
+
+    static constexpr std::uint32_t version = 1;
+
+    // call reached(pblock) for every block the user's structures still use, walking them from root()
+    using walk_t = std::function<void(PersistentPool &persistent, const std::function<void(void *pblock)> &reached)>;
+
+    // open the pool in the file at path, creating it with num_blocks blocks of block_sz_bytes if it doesn't exist yet
+    // throw std::runtime_error on a system error, on a different geometry, on a file that is already open or that wasn't closed cleanly,
+    // and outside of the hardened mode on a file whose free list links were mangled by a hardened build
+    PersistentPool(const std::string &path, std::size_t block_sz_bytes, std::size_t num_blocks);
+
+    // the same, but a file that wasn't closed cleanly is recovered: its free list is rebuilt from the blocks recover doesn't reach
+    // throw std::runtime_error if recover reaches something that isn't a block of the pool
+    PersistentPool(const std::string &path, std::size_t block_sz_bytes, std::size_t num_blocks, const walk_t &recover);
+
+    PersistentPool(const PersistentPool &pool) = delete;            // delete copy constructor
+    PersistentPool &operator=(const PersistentPool &rhs) = delete;  // delete copy-assignment operator
+    PersistentPool(PersistentPool &&pool) = delete;                 // delete move constructor
+    PersistentPool &operator=(PersistentPool &&rhs) = delete;       // delete move-assignment operator
+
+    ~PersistentPool();  // save the state, mark the file clean and unmap it
+
+    PoolMemory &pool() { return *m_pool; }    // get and free the blocks through it
+    bool resumed() { return m_resumed; }      // return whether the file already held a pool that we've resumed
+    bool recovered() { return m_recovered; }  // return whether that pool wasn't closed cleanly and its free list was rebuilt
+    bool relocated() { return m_relocated; }  // return whether the blocks moved since the last mapping, raw pointers between them are invalid then
+
+    // convert between the blocks' addresses and their offsets, which stay valid across mappings
+    std::uint64_t offset_of(const void *pblock) { return static_cast<const std::byte *>(pblock) - m_pdata; }
+    void *at(std::uint64_t offset) { return m_pdata + offset; }
+
+    // a slot in the header for the block the user's structure starts from, nullptr if none
+    void *root() { return m_pheader->root == 0 ? nullptr : at(m_pheader->root - 1); }
+    void set_root(void *pblock) { m_pheader->root = pblock == nullptr ? 0 : offset_of(pblock) + 1; }
+
+    // save the state of the pool in the header and flush the whole mapping to the file
+    // the blocks are durable from then on, but a crash still leaves the file to be recovered with a walk
+    void sync();
+
+   private:
+    void recover(const std::string &path, const walk_t &walk);  // rebuild the free list of m_pool from the blocks walk doesn't reach
+
+    Header *m_pheader;                 // start of the mapping
+    std::byte *m_pdata;                // first block, a page after the header
+    std::size_t m_map_size;            // size in bytes of the mapping and of the file
+    int m_fd;                          // the file, kept open while it's mapped
+    bool m_resumed;                    // whether we've resumed a pool that was already in the file
+    bool m_recovered;                  // whether it had to be recovered
+    bool m_relocated;                  // whether the blocks are somewhere else than last time
+    std::optional<PoolMemory> m_pool;  // the pool running on the blocks
+};
+}  // namespace mem
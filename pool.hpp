@@ -1,7 +1,96 @@
-#include <iostream>
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <new>
+#include <vector>
+
+#include "annotate.hpp"
+#include "stats.hpp"
+
+/** Whether the out of line members are compiled in pool.cpp, or defined inline in every translation unit that includes us */
+#ifdef MEM_HEADER_ONLY
+#define MEM_INLINE inline
+#else
+#define MEM_INLINE
+#endif
+
+/**
+ * Mark a function as rarely called and keep it out of line, so that it doesn't bloat the fast path it's called from
+ * Header only, the definition is inline and GCC rejects noinline on it, cold alone already keeps the optimizer from inlining
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && defined(MEM_HEADER_ONLY)
+#define MEM_COLD __attribute__((cold))
+#elif defined(__GNUC__) || defined(__clang__)
+#define MEM_COLD __attribute__((cold, noinline))
+#elif defined(_MSC_VER)
+#define MEM_COLD __declspec(noinline)
+#else
+#define MEM_COLD
+#endif
+
+/**
+ * Hardened mode, opt-in with MEM_HARDENED (MEM_HARDENED_CANARY adds the guard canaries)
+ * PoolMemory then checks every block it gets back against its own range, stride and occupancy bitmap,
+ * poisons the freed blocks, stores the free list links XORed with a per pool secret and aborts on the first violation
+ * Without it the checks are empty inline functions and the links are stored as they are, so the release build pays nothing
+ * Like MEM_HEADER_ONLY it changes the layout of PoolMemory, every translation unit of a program has to agree on it
+ */
+#if defined(MEM_HARDENED_CANARY) && !defined(MEM_HARDENED)
+#define MEM_HARDENED
+#endif
+
+/** Hint which branch of the fast path is the common one */
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(likely) >= 201803L
+#define MEM_LIKELY [[likely]]
+#define MEM_UNLIKELY [[unlikely]]
+#else
+#define MEM_LIKELY
+#define MEM_UNLIKELY
+#endif
+
+/**
+ * Prefetch the next free block on every pop of the free list, opt-in with MEM_PREFETCH
+ * After churn the free list is scattered and reading the link of the head is a cache miss on every get(), the prefetch starts
+ * that miss one get() ahead so that it overlaps with the work of the caller between two gets
+ */
+#if defined(MEM_PREFETCH) && (defined(__GNUC__) || defined(__clang__))
+#define MEM_PREFETCH_BLOCK(pblock) __builtin_prefetch(pblock, 1, 3)
+#else
+#define MEM_PREFETCH_BLOCK(pblock) ((void)0)
+#endif
+
 namespace mem
 {
+/**
+ * Out of memory policies: what get<OomPolicy>() does when the memory resource is exhausted
+ * Each policy has a static exhausted(size) whose result is returned by get()
+ * The plain get() uses Throw, which is what the memory resources have always done
+ * A user that can grow, like list::allocator, asks with Null and adds a new memory resource from upstream on a nullptr
+ */
+namespace oom
+{
+using handler_t = void *(*)(std::size_t size);  // return a replacement block of size bytes, or nullptr to give up
+
+// install a handler for the Handler policy and return the previous one, nullptr uninstalls
+handler_t set_handler(handler_t handler) noexcept;
+handler_t get_handler() noexcept;
+
+struct Throw {  // throw std::bad_alloc
+    [[noreturn]] MEM_COLD static void *exhausted(std::size_t size);
+};
+
+struct Null {  // return nullptr
+    static void *exhausted(std::size_t) { return nullptr; }
+};
+
+struct Handler {  // call the handler installed by set_handler, nullptr if there is none
+    MEM_COLD static void *exhausted(std::size_t size);
+};
+}  // namespace oom
+
 /** Pool Memory Resource Declaration */
 // ! This class can only be used when sizeof(void *) <= sizeof(T)
 // actually it's not even recommended to use memory pool if your block size is quite small, the pointers would take more space than the actual blocks!
@@ -9,8 +98,20 @@ namespace mem
 class PoolMemory
 {
    public:
+    /**
+     * What a pool needs to resume on the same memory, all in offsets so that the memory may be mapped somewhere else
+     * The free list links inside the blocks are offsets too, so the memory itself can be saved or mapped as it is
+     */
+    struct State {
+        std::uint64_t head = 0;             // offset + 1 of the first block of the free list, 0 if the free list is empty
+        std::uint64_t watermark = 0;        // number of blocks carved so far
+        std::uint64_t free_num_blocks = 0;  // number of free blocks
+        std::uint64_t cookie = 0;           // secret of the free list links in the hardened mode, unused otherwise
+    };
+
     PoolMemory(const std::size_t block_sz_bytes, const std::size_t num_blocks);
     PoolMemory(const std::size_t block_sz_bytes, const std::size_t num_blocks, std::byte *pmemory);
+    PoolMemory(const std::size_t block_sz_bytes, const std::size_t num_blocks, std::byte *pmemory, const State &state);  // resume a saved pool on pmemory
 
     PoolMemory(const PoolMemory &alloc) = delete;           // delete copy constructor
     PoolMemory &operator=(const PoolMemory &rhs) = delete;  // delete copy-assignment operator
@@ -27,20 +128,102 @@ class PoolMemory
     bool empty() { return m_free_num_blocks == m_total_num_blocks; }       // return whether the memory pool is empty
     bool full() { return m_free_num_blocks == 0; }                         // return whether the memory pool is full
     bool has_upper() { return !m_is_manual; }                              // return whether m_pmemory's raw mem comes from an upper stream
+    std::size_t peak() { return m_watermark; }                             // return the most blocks ever in use at once since construction or the last reset
+    bool owns(const void *pblock);                                         // return whether pblock points into the memory of this pool
+    State state();                                                         // return the state to resume this pool with later
+    void *block(std::size_t index);                                        // return the block index blocks after the first one
+
+    // return which of the peak() blocks carved so far are free, the ones trim() took off the free list included
+    // the blocks given back with remote_free() count as in use until they're reclaimed, only the owning thread may call it
+    std::vector<bool> free_map();
 
-    // return a nullptr if the memory pool is already full
-    // else this returns a pointer to an block whose size(still raw memory) is m_block_sz_bytes
+    // return a pointer to an block whose size(still raw memory) is m_block_sz_bytes
+    // if the memory pool is already full, throw std::bad_alloc, or do what OomPolicy says
     void *get(std::size_t size);
     void *get();
+    template <class OomPolicy>
+    void *get();
 
-    // make sure the pblock is one of the pointers that you get from this memory pool
+    // make sure the pblock is one of the pointers that you get from this memory pool, the hardened mode aborts if it isn't
     void free(void *pblock, std::size_t size);
     void free(void *pblock);
 
+    // give a block back from another thread than the one using the pool, with a single CAS and nothing else of the pool touched
+    // the blocks wait on a remote free list until the owning thread's get() runs out of free blocks and reclaims them all at once
+    void remote_free(void *pblock);
+
+    // move the blocks other threads have given back onto the free list, return how many there were
+    // only the owning thread may call it, get() does so on a miss
+    std::size_t reclaim();
+
+    // return every block to the memory pool at once, in O(1)
+    // all pointers gotten from this pool before the reset are invalidated
+    void reset();
+
+    // give the physical pages of the never touched tail of the pool back to the OS (no-op where madvise is unavailable)
+    // the address range stays valid, the pages are just zero-filled again on their next touch
+    // return the number of bytes released
+    std::size_t release_pages();
+
+    // give the whole pages that only free blocks cover back to the OS, stopping once max_bytes were released, return the bytes released
+    // the blocks of those pages leave the free list, get() takes them back once it runs out of the other free blocks, before it carves new ones
+    // the free list is rebuilt in address order on the way, only the owning thread may call it
+    // the memory has to be private, madvise doesn't drop the data of a shared or file mapping
+    std::size_t trim(std::size_t max_bytes = SIZE_MAX);
+
+    /**
+     * Slab layout: the pool object sits at the start of a slab of slab_bytes aligned to slab_bytes and its blocks fill the rest
+     * slab_bytes is a power of two, like 64 KiB or 2 MiB, so slab_of() finds the pool and its counters of any block with a mask,
+     * without a lookup table and without a separate allocation for the pool object
+     * A slab pool is made and destroyed only by these, with the same slab_bytes
+     * The first block of a slab is shifted by a color of 0 to slab_colors - 1 cache lines, so that the hot first blocks of many
+     * slabs don't all compete for the same cache sets, make_slab() without a color takes the next one in turn
+     */
+    static constexpr std::size_t slab_colors = 16;
+    MEM_COLD static PoolMemory *make_slab(std::size_t block_sz_bytes, std::size_t slab_bytes);
+    MEM_COLD static PoolMemory *make_slab(std::size_t block_sz_bytes, std::size_t slab_bytes, std::size_t color);
+    MEM_COLD static void destroy_slab(PoolMemory *pool, std::size_t slab_bytes);
+    static std::size_t slab_capacity(std::size_t block_sz_bytes, std::size_t slab_bytes);  // return the blocks a slab holds, whatever its color
+    static PoolMemory *slab_of(const void *pblock, std::size_t slab_bytes)
+    {
+        return reinterpret_cast<PoolMemory *>(reinterpret_cast<std::uintptr_t>(pblock) & ~std::uintptr_t(slab_bytes - 1));
+    }
+
    private:
-    void init_memory();  // this function will fill the memory with pointers to the next trunk for initialization
+    void init_memory();  // this function will reset the free list and the watermark for initialization
+    MEM_COLD void untrim();  // put the blocks of the last trimmed run back on the free list
 
-    /** Current size of a memory pool variable should be 48 bytes
+    // distance in bytes between two blocks, larger than the block size only when the hardened mode adds canaries
+#ifdef MEM_HARDENED
+    std::size_t stride() { return m_stride_bytes; }
+#else
+    std::size_t stride() { return m_block_sz_bytes; }
+#endif
+
+    // the free list link stored in the first bytes of a free block: the offset + 1 of the next block from m_pmemory, 0 ends the list
+    // it's mangled with the secret of the pool in the hardened mode
+#ifdef MEM_HARDENED
+    std::uintptr_t mangle(std::uintptr_t link) { return link ^ m_cookie; }
+#else
+    static std::uintptr_t mangle(std::uintptr_t link) { return link; }
+#endif
+    std::uintptr_t offset_link(void *pblock) { return pblock == nullptr ? 0 : static_cast<std::byte *>(pblock) - m_pmemory + 1; }
+    void *link_block(std::uintptr_t link) { return link == 0 ? nullptr : m_pmemory + (link - 1); }
+    void *load_link(void *pblock) { return link_block(mangle(*static_cast<std::uintptr_t *>(pblock))); }
+    void store_link(void *pblock, void *next) { *static_cast<std::uintptr_t *>(pblock) = mangle(offset_link(next)); }
+
+    // checks of a block leaving the pool and of one coming back, they abort on a violation
+#ifdef MEM_HARDENED
+    void harden_get(void *pblock, bool recycled);
+    void harden_free(void *pblock);
+    std::size_t harden_index(const char *function, void *pblock);  // index of the block pblock points to, abort if there is none
+    [[noreturn]] MEM_COLD void corrupted(const char *function, const char *what, const void *pblock);
+#else
+    void harden_get(void *, bool) {}
+    void harden_free(void *) {}
+#endif
+
+    /** Current size of a memory pool variable should be 72 bytes
      *  considering 8 byte for one pointer and size_t on my machine
      */
     std::byte *m_pmemory;            // pointer to the first address of the pool, used to relase all the memory
@@ -49,7 +232,15 @@ class PoolMemory
     std::size_t m_block_sz_bytes;    // size in bytes of each block
     std::size_t m_free_num_blocks;   // number of blocks
     std::size_t m_total_num_blocks;  // total number of blocks
-    bool m_is_manual;                // whether the m_pmemory is manually allocated by us
+    std::size_t m_watermark;         // number of blocks ever handed out since the last reset, blocks after it have never been touched
+    std::atomic<void *> m_remote_head;  // blocks freed by other threads, linked like the free list, waiting to be reclaimed
+    std::uintptr_t m_trimmed;           // offset + 1 of the first block of the last run trim() released, 0 if there is none
+    bool m_is_manual;                   // whether the m_pmemory is manually allocated by us
+#ifdef MEM_HARDENED
+    std::size_t m_stride_bytes;                   // size in bytes of each block and its canary
+    std::uintptr_t m_cookie;                      // secret the free list links are XORed with
+    std::unique_ptr<std::uint64_t[]> m_occupied;  // one bit per block, set while the block is handed out
+#endif
 };
 
 /** Monotonic Memory Resource Declaration */
@@ -72,20 +263,90 @@ class MonoMemory
     bool empty() { return m_index == 0; }                        // return whether the byte chunk is empty
     bool full() { return m_index == m_total_size; }              // return whether the byte chunk is full
     bool has_upper() { return !m_is_manual; }                    // return whether m_pmemory's raw mem comes from an upper stream
+    std::size_t peak() { return m_peak; }                        // return the most space ever in use at once since construction or the last reset
 
-    // return a nullptr if the byte chunk is already full
-    // else this returns a pointer to an block whose size(still raw memory) is m_block_sz_bytes
+    // return a pointer to size bytes of raw memory
+    // if the byte chunk doesn't have that much left, throw std::bad_alloc, or do what OomPolicy says
+    void *get(std::size_t size);
+    template <class OomPolicy>
     void *get(std::size_t size);
 
     // make sure the pblock is one of the pointers that you get from this byte chunk
     void free(void *pblock, std::size_t size);
     void free(std::size_t size);
 
+    // return the whole byte chunk at once, all pointers gotten before the reset are invalidated
+    void reset();
+
+    // give the physical pages after the current index back to the OS, return the number of bytes released
+    std::size_t release_pages();
+
    private:
     std::byte *m_pmemory;      // pointer to the byte array
     std::size_t m_index;       // current index of the byte array
+    std::size_t m_peak;        // highest index the byte array has reached
     std::size_t m_total_size;  // total number of blocks
     bool m_is_manual;          // whether the m_pmemory is manually allocated by us
 };
 
-}  // namespace mem
\ No newline at end of file
+/** Pool Memory Resource Fast Path, inlined into the callers */
+template <class OomPolicy>
+void *PoolMemory::get()
+{
+    if (m_phead == nullptr && m_remote_head.load(std::memory_order_relaxed) != nullptr) MEM_UNLIKELY {
+        reclaim();  // a miss, take back what the other threads have freed before touching new memory
+    }
+
+    if (m_phead != nullptr) MEM_LIKELY {
+        m_free_num_blocks--;  // decrement the number of free blocks
+
+        void *pblock = static_cast<void *>(m_phead);          // get current free list value
+        annotate::expose(pblock, m_block_sz_bytes);          // the block is poisoned while it's free
+        m_phead = static_cast<void **>(load_link(m_phead));  // update free list head
+        MEM_PREFETCH_BLOCK(m_phead);                         // the link the next get() reads
+
+        harden_get(pblock, true);
+        annotate::pool_alloc(this, pblock, m_block_sz_bytes);
+        stats::on_get_block(m_block_sz_bytes, true);
+        return pblock;
+    } else if (m_trimmed != 0) MEM_UNLIKELY {  // the blocks whose pages trim() released are free, reuse them before touching new pages
+        untrim();
+        return get<OomPolicy>();
+    } else if (m_watermark < m_total_num_blocks) {  // free list is empty, carve a never touched block after the watermark
+        m_free_num_blocks--;
+
+        void *pblock = static_cast<void *>(m_pmemory + m_watermark * stride());
+        m_watermark++;
+
+        harden_get(pblock, false);
+        annotate::pool_alloc(this, pblock, m_block_sz_bytes);
+        stats::on_get_block(m_block_sz_bytes, false);
+        return pblock;
+    } else MEM_UNLIKELY {  // out of memory blocks (for an block with size m_block_sz_bytes)
+        stats::on_fail();
+        return OomPolicy::exhausted(m_block_sz_bytes);
+    }
+}
+
+/** Monotonic Memory Resource Fast Path, inlined into the callers */
+template <class OomPolicy>
+void *MonoMemory::get(std::size_t size)
+{
+    if (m_index + size > m_total_size) MEM_UNLIKELY {
+        stats::on_fail();
+        return OomPolicy::exhausted(size);
+    } else MEM_LIKELY {
+        void *ptr = m_pmemory + m_index;
+        m_index += size;
+        if (m_index > m_peak) m_peak = m_index;
+        annotate::pool_alloc(this, ptr, size);
+        stats::on_get(size);
+        return ptr;
+    }
+}
+
+}  // namespace mem
+
+#ifdef MEM_HEADER_ONLY
+#include "pool_impl.hpp"
+#endif  // MEM_HEADER_ONLY
@@ -0,0 +1,578 @@
+#pragma once
+
+/**
+ * Definitions of the memory resources' out of line members
+ * Compiled once in pool.cpp, or included by pool.hpp as inline definitions when MEM_HEADER_ONLY is defined
+ */
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#ifdef MEM_HARDENED
+#include <cstdlib>
+#include <random>
+#endif
+
+#include "annotate.hpp"
+#include "pool.hpp"
+#include "stats.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>  // to use madvise
+#include <unistd.h>    // to use sysconf
+#endif
+
+namespace mem
+{
+/** Out Of Memory Policies Implementation */
+namespace detail
+{
+MEM_INLINE std::atomic<oom::handler_t> oom_handler(nullptr);
+}  // namespace detail
+
+MEM_INLINE oom::handler_t oom::set_handler(handler_t handler) noexcept { return detail::oom_handler.exchange(handler); }
+MEM_INLINE oom::handler_t oom::get_handler() noexcept { return detail::oom_handler.load(); }
+
+MEM_INLINE void *oom::Throw::exhausted(std::size_t size)
+{
+    std::fprintf(stderr, "ERROR get: out of memory blocks, unable to handle an allocation of %zu bytes\n", size);
+    throw std::bad_alloc();
+}
+
+MEM_INLINE void *oom::Handler::exhausted(std::size_t size)
+{
+    handler_t handler = get_handler();
+    return handler != nullptr ? handler(size) : nullptr;
+}
+
+namespace detail
+{
+/** Give the whole pages inside [begin, end) back to the OS, return the number of bytes released */
+MEM_INLINE std::size_t release_range(std::byte *begin, std::byte *end)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    static const std::uintptr_t page_sz = sysconf(_SC_PAGESIZE);
+    std::uintptr_t start_addr = (reinterpret_cast<std::uintptr_t>(begin) + page_sz - 1) & ~(page_sz - 1);  // round up to page boundary
+    std::uintptr_t end_addr = reinterpret_cast<std::uintptr_t>(end) & ~(page_sz - 1);                      // round down to page boundary
+    if (start_addr >= end_addr) return 0;                                                                  // not even a whole page
+    if (madvise(reinterpret_cast<void *>(start_addr), end_addr - start_addr, MADV_DONTNEED) != 0) return 0;
+    return end_addr - start_addr;
+#else
+    return 0;
+#endif
+}
+
+#ifdef MEM_HARDENED
+#ifdef MEM_HARDENED_CANARY
+// guard word after every block of the pools that own their memory, padded so that the blocks keep the alignment they'd have without it
+constexpr std::size_t canary_sz = alignof(std::max_align_t) > sizeof(std::uint64_t) ? alignof(std::max_align_t) : sizeof(std::uint64_t);
+#else
+constexpr std::size_t canary_sz = 0;
+#endif
+constexpr unsigned char poison_byte = 0xdd;  // what a freed block is filled with after its free list link
+
+/** Random for every process, so that a forged free list link can't be guessed from a leaked one */
+MEM_INLINE std::uintptr_t secret()
+{
+    static const std::uintptr_t value = (std::uintptr_t(std::random_device{}()) << 32) ^ std::random_device{}();
+    return value;
+}
+#endif  // MEM_HARDENED
+}  // namespace detail
+
+/** Pool Memory Resource Implementation */
+MEM_INLINE PoolMemory::PoolMemory(const std::size_t block_sz_bytes, const std::size_t num_blocks)
+    : m_pool_sz_bytes(num_blocks * block_sz_bytes),
+      m_block_sz_bytes(block_sz_bytes),
+      m_free_num_blocks(num_blocks),
+      m_total_num_blocks(num_blocks),
+      m_is_manual(true)
+{
+#ifdef MEM_HARDENED
+    m_stride_bytes = m_block_sz_bytes + detail::canary_sz;
+    m_pool_sz_bytes = num_blocks * m_stride_bytes;
+#endif
+    m_pmemory = new std::byte[m_pool_sz_bytes];  // using byte as memory pool base type
+    init_memory();
+    stats::on_slab(m_pool_sz_bytes);
+}
+
+MEM_INLINE PoolMemory::PoolMemory(const std::size_t block_sz_bytes, const std::size_t num_blocks, std::byte *pmemory)
+    : m_pmemory(pmemory),  // this memory may have come from a different memory resource
+      m_pool_sz_bytes(num_blocks * block_sz_bytes),
+      m_block_sz_bytes(block_sz_bytes),
+      m_free_num_blocks(num_blocks),
+      m_total_num_blocks(num_blocks),
+      m_is_manual(false)
+{
+#ifdef MEM_HARDENED
+    m_stride_bytes = m_block_sz_bytes;  // the caller sized the memory without room for canaries
+#endif
+    init_memory();
+    stats::on_slab(m_pool_sz_bytes);
+}
+MEM_INLINE PoolMemory::PoolMemory(const std::size_t block_sz_bytes, const std::size_t num_blocks, std::byte *pmemory, const State &state)
+    : PoolMemory(block_sz_bytes, num_blocks, pmemory)
+{
+    assert(state.watermark <= m_total_num_blocks && state.free_num_blocks >= m_total_num_blocks - state.watermark);
+    assert(state.free_num_blocks <= m_total_num_blocks && state.head <= m_pool_sz_bytes);
+
+    m_phead = static_cast<void **>(link_block(state.head));
+    m_watermark = state.watermark;
+    m_free_num_blocks = state.free_num_blocks;
+#ifdef MEM_HARDENED
+    m_cookie = state.cookie;  // the links in the memory are mangled with the old secret
+#endif
+
+#if defined(MEM_HARDENED) || defined(MEM_ASAN) || defined(MEM_VALGRIND)
+    // the carved blocks are in use, except the ones on the free list
+    for (std::size_t i = 0; i < m_watermark; i++) {
+        annotate::pool_alloc(this, m_pmemory + i * stride(), m_block_sz_bytes);
+#ifdef MEM_HARDENED
+        m_occupied[i / 64] |= std::uint64_t(1) << (i % 64);
+#endif
+    }
+    for (void *pblock = m_phead; pblock != nullptr;) {
+        annotate::expose(pblock, sizeof(std::uintptr_t));
+        void *next = load_link(pblock);
+#ifdef MEM_HARDENED
+        std::size_t index = (static_cast<std::byte *>(pblock) - m_pmemory) / stride();
+        m_occupied[index / 64] &= ~(std::uint64_t(1) << (index % 64));
+#endif
+        annotate::pool_free(this, pblock, m_block_sz_bytes);
+        pblock = next;
+    }
+#endif
+}
+
+MEM_INLINE PoolMemory::~PoolMemory()
+{
+    annotate::pool_destroy(this, m_pmemory, m_pool_sz_bytes);
+    if (m_is_manual) {
+        delete[] m_pmemory;
+    }
+}  // delete the pre-allocated memory pool chunk
+
+namespace detail
+{
+constexpr std::size_t slab_header_sz = (sizeof(PoolMemory) + 63) & ~std::size_t(63);  // the pool object, the blocks start on the next cache line
+constexpr std::size_t slab_color_sz = 64;                                            // one cache line per color
+}
+
+MEM_INLINE std::size_t PoolMemory::slab_capacity(std::size_t block_sz_bytes, std::size_t slab_bytes)
+{
+    std::size_t reserved = detail::slab_header_sz + (slab_colors - 1) * detail::slab_color_sz;  // room for the largest color
+    return slab_bytes > reserved ? (slab_bytes - reserved) / block_sz_bytes : 0;
+}
+
+MEM_INLINE PoolMemory *PoolMemory::make_slab(std::size_t block_sz_bytes, std::size_t slab_bytes)
+{
+    static std::atomic<std::size_t> next_color{0};
+    return make_slab(block_sz_bytes, slab_bytes, next_color.fetch_add(1, std::memory_order_relaxed));
+}
+
+MEM_INLINE PoolMemory *PoolMemory::make_slab(std::size_t block_sz_bytes, std::size_t slab_bytes, std::size_t color)
+{
+    assert((slab_bytes & (slab_bytes - 1)) == 0 && slab_capacity(block_sz_bytes, slab_bytes) > 0);
+    auto pslab = static_cast<std::byte *>(::operator new(slab_bytes, std::align_val_t(slab_bytes)));
+    std::byte *pblocks = pslab + detail::slab_header_sz + color % slab_colors * detail::slab_color_sz;
+    return new (pslab) PoolMemory(block_sz_bytes, slab_capacity(block_sz_bytes, slab_bytes), pblocks);
+}
+
+MEM_INLINE void PoolMemory::destroy_slab(PoolMemory *pool, std::size_t slab_bytes)
+{
+    if (pool == nullptr) return;
+    assert(slab_of(pool, slab_bytes) == pool);
+    pool->~PoolMemory();
+    ::operator delete(static_cast<void *>(pool), std::align_val_t(slab_bytes));
+}
+
+MEM_INLINE void PoolMemory::init_memory()
+{
+    /** We would want the size of the of the block to be bigger than a pointer */
+    assert(sizeof(void *) <= m_block_sz_bytes);
+
+    /**
+     * We don't thread the free list through the raw memory up front
+     * Blocks after the watermark have never been handed out, so get() carves them lazily in address order
+     * and only the blocks that are given back through free() go onto the free list
+     * This keeps construction and reset() O(1) and leaves the untouched tail's pages alone
+     */
+    m_phead = nullptr;
+    m_remote_head.store(nullptr, std::memory_order_relaxed);  // no other thread may free concurrently with a reset
+    m_trimmed = 0;                                            // the released pages are just zero-filled again on their next touch
+    m_watermark = 0;
+    m_free_num_blocks = m_total_num_blocks;
+    annotate::pool_create(this, m_pmemory, m_pool_sz_bytes);
+
+#ifdef MEM_HARDENED
+    std::size_t num_words = (m_total_num_blocks + 63) / 64;
+    if (!m_occupied) m_occupied.reset(new std::uint64_t[num_words]);
+    std::memset(m_occupied.get(), 0, num_words * sizeof(std::uint64_t));
+    m_cookie = (detail::secret() ^ reinterpret_cast<std::uintptr_t>(this)) * 0x9e3779b97f4a7c15;  // a different secret for every pool
+#endif
+}
+
+MEM_INLINE PoolMemory::State PoolMemory::state()
+{
+    reclaim();  // the remote free list isn't part of the state
+    while (m_trimmed != 0) untrim();  // and neither are the trimmed runs
+
+    State state;
+    state.head = offset_link(m_phead);
+    state.watermark = m_watermark;
+    state.free_num_blocks = m_free_num_blocks;
+#ifdef MEM_HARDENED
+    state.cookie = m_cookie;
+#endif
+    return state;
+}
+
+MEM_INLINE bool PoolMemory::owns(const void *pblock)
+{
+    std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(pblock), begin = reinterpret_cast<std::uintptr_t>(m_pmemory);
+    return addr >= begin && addr < begin + m_pool_sz_bytes;
+}
+
+MEM_INLINE void *PoolMemory::block(std::size_t index) { return m_pmemory + index * stride(); }
+
+MEM_INLINE std::vector<bool> PoolMemory::free_map()
+{
+    std::vector<bool> free(m_watermark, false);
+    for (void *pblock = m_phead; pblock != nullptr;) {
+        free[(static_cast<std::byte *>(pblock) - m_pmemory) / stride()] = true;
+        annotate::expose(pblock, sizeof(std::uintptr_t));
+        void *next = load_link(pblock);
+        annotate::hide(pblock, sizeof(std::uintptr_t));
+        pblock = next;
+    }
+
+    // the trimmed runs, from the headers in their first blocks
+    for (std::uintptr_t link = m_trimmed; link != 0;) {
+        std::byte *prun = static_cast<std::byte *>(link_block(link));
+        std::uintptr_t header[2];
+        annotate::expose(prun, sizeof(header));
+        std::memcpy(header, prun, sizeof(header));
+        annotate::hide(prun, sizeof(header));
+        std::size_t first = (prun - m_pmemory) / stride();
+        for (std::size_t i = 0; i < mangle(header[1]); i++) free[first + i] = true;
+        link = mangle(header[0]);
+    }
+    return free;
+}
+
+/** Just a thin wrapper */
+MEM_INLINE void *PoolMemory::get(std::size_t size)
+{
+    assert(size == m_block_sz_bytes);
+    return get();
+}
+
+MEM_INLINE void *PoolMemory::get() { return get<oom::Throw>(); }
+
+/** Just a thin wrapper */
+MEM_INLINE void PoolMemory::free(void *pblock, std::size_t size)
+{
+    assert(size == m_block_sz_bytes);
+    free(pblock);
+}
+
+MEM_INLINE void PoolMemory::free(void *pblock)
+{
+    if (pblock == nullptr) MEM_UNLIKELY {
+        // do nothing if we're freeing a nullptr
+        // although this situation is declared undefined in C++ Standard
+        return;
+    }
+
+    // if (m_pmemory == nullptr) {  // this should not happen
+    //     std::cerr << "ERROR " << __FUNCTION__ << ": No memory was allocated to this pool" << std::endl;
+    //     return;
+    // }
+
+    harden_free(pblock);  // before anything is touched, so that a bad pointer aborts with the pool intact
+
+    m_free_num_blocks++;  // increment the number of blocks
+    stats::on_free(m_block_sz_bytes);
+
+    store_link(pblock, m_phead);  // the current head becomes the next block, nullptr if the free list was empty
+    m_phead = static_cast<void **>(pblock);
+    annotate::pool_free(this, pblock, m_block_sz_bytes);
+}
+
+MEM_INLINE void PoolMemory::remote_free(void *pblock)
+{
+    if (pblock == nullptr) MEM_UNLIKELY {
+        return;
+    }
+#ifdef MEM_HARDENED
+    harden_index("remote_free", pblock);  // the rest of the checks need the owner's bitmap, reclaim() does them
+#endif
+    stats::on_free(m_block_sz_bytes);
+
+    // poisoned before it's published, the owner may hand it out again right after our CAS
+    annotate::pool_free(this, pblock, m_block_sz_bytes);
+    void *head = m_remote_head.load(std::memory_order_relaxed);
+    do {
+        annotate::expose(pblock, sizeof(std::uintptr_t));
+        store_link(pblock, head);
+        annotate::hide(pblock, sizeof(std::uintptr_t));
+    } while (!m_remote_head.compare_exchange_weak(head, pblock, std::memory_order_release, std::memory_order_relaxed));
+}
+
+MEM_INLINE std::size_t PoolMemory::reclaim()
+{
+    void *batch = m_remote_head.exchange(nullptr, std::memory_order_acquire);  // the whole list at once, so there's no ABA
+    if (batch == nullptr) return 0;
+
+    std::size_t count = 0;
+    void *tail = batch;
+    for (void *pblock = batch; pblock != nullptr; count++) {
+        annotate::expose(pblock, m_block_sz_bytes);
+        void *next = load_link(pblock);
+        harden_free(pblock);
+        annotate::hide(pblock, m_block_sz_bytes);
+        tail = pblock;
+        pblock = next;
+    }
+
+    // splice the batch in front of the free list
+    annotate::expose(tail, sizeof(std::uintptr_t));
+    store_link(tail, m_phead);
+    annotate::hide(tail, sizeof(std::uintptr_t));
+    m_phead = static_cast<void **>(batch);
+    m_free_num_blocks += count;
+    return count;
+}
+
+MEM_INLINE void PoolMemory::reset()
+{
+    reclaim();  // the blocks other threads gave back were already counted as freed
+    stats::on_reset(size() * m_block_sz_bytes);
+    annotate::pool_destroy(this, m_pmemory, m_pool_sz_bytes);
+    init_memory();  // forgetting the free list and the watermark is enough
+}
+
+MEM_INLINE std::size_t PoolMemory::release_pages()
+{
+    return detail::release_range(m_pmemory + m_watermark * stride(), m_pmemory + m_pool_sz_bytes);
+}
+
+/**
+ * Trimming
+ * A run of consecutive free blocks that covers at least one whole page leaves the free list, and its whole pages are released
+ * The first blocks of the run keep the run's header, the link to the previous trimmed run and its length in blocks,
+ * and the pages they're on are never released so that untrim() can find the blocks again
+ */
+MEM_INLINE std::size_t PoolMemory::trim(std::size_t max_bytes)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    static const std::size_t page_sz = sysconf(_SC_PAGESIZE);
+#else
+    const std::size_t page_sz = 4096;
+#endif
+    reclaim();
+    if (m_phead == nullptr || max_bytes < page_sz) return 0;
+
+    // which carved blocks are free
+    std::unique_ptr<std::uint64_t[]> free_bits(new std::uint64_t[(m_watermark + 63) / 64]());
+    for (void *pblock = m_phead; pblock != nullptr;) {
+        std::size_t index = (static_cast<std::byte *>(pblock) - m_pmemory) / stride();
+        free_bits[index / 64] |= std::uint64_t(1) << (index % 64);
+        annotate::expose(pblock, sizeof(std::uintptr_t));
+        void *next = load_link(pblock);
+        annotate::hide(pblock, sizeof(std::uintptr_t));
+        pblock = next;
+    }
+    auto is_free = [&](std::size_t index) { return (free_bits[index / 64] >> (index % 64)) & 1; };
+
+    constexpr std::size_t header_sz = 2 * sizeof(std::uintptr_t);
+    const std::size_t header_blocks = (header_sz + stride() - 1) / stride();
+    std::size_t released = 0;
+    for (std::size_t first = 0; first < m_watermark && max_bytes - released >= page_sz;) {
+        if (!is_free(first)) {
+            first++;
+            continue;
+        }
+        std::size_t end = first;
+        while (end < m_watermark && is_free(end)) end++;
+
+        // the whole pages after the header, as many as the budget allows
+        std::uintptr_t begin_addr = reinterpret_cast<std::uintptr_t>(m_pmemory + (first + header_blocks) * stride());
+        std::uintptr_t end_addr = reinterpret_cast<std::uintptr_t>(m_pmemory + end * stride());
+        begin_addr = (begin_addr + page_sz - 1) & ~(page_sz - 1);
+        end_addr &= ~(page_sz - 1);
+        if (end > first + header_blocks && begin_addr < end_addr) {
+            std::size_t budget = (max_bytes - released) / page_sz * page_sz;
+            if (end_addr - begin_addr > budget) end_addr = begin_addr + budget;
+            std::size_t run_end = (end_addr - reinterpret_cast<std::uintptr_t>(m_pmemory) + stride() - 1) / stride();  // blocks starting before end_addr
+
+            std::uintptr_t header[2] = {mangle(m_trimmed), mangle(run_end - first)};
+            std::byte *prun = m_pmemory + first * stride();
+            annotate::expose(prun, header_sz);
+            std::memcpy(prun, header, header_sz);
+            annotate::hide(prun, header_sz);
+            m_trimmed = offset_link(prun);
+            for (std::size_t i = first; i < run_end; i++) free_bits[i / 64] &= ~(std::uint64_t(1) << (i % 64));
+            released += detail::release_range(reinterpret_cast<std::byte *>(begin_addr), reinterpret_cast<std::byte *>(end_addr));
+            end = run_end;
+        }
+        first = end;
+    }
+
+    // the free blocks left, in address order
+    void *phead = nullptr;
+    for (std::size_t i = m_watermark; i-- > 0;) {
+        if (!is_free(i)) continue;
+        void *pblock = m_pmemory + i * stride();
+        annotate::expose(pblock, sizeof(std::uintptr_t));
+        store_link(pblock, phead);
+        annotate::hide(pblock, sizeof(std::uintptr_t));
+        phead = pblock;
+    }
+    m_phead = static_cast<void **>(phead);
+    return released;
+}
+
+MEM_INLINE void PoolMemory::untrim()
+{
+    std::byte *prun = static_cast<std::byte *>(link_block(m_trimmed));
+    std::uintptr_t header[2];
+    annotate::expose(prun, sizeof(header));
+    std::memcpy(header, prun, sizeof(header));
+    m_trimmed = mangle(header[0]);
+    std::size_t length = mangle(header[1]);
+
+    // the run goes onto the free list as it is, its blocks were counted free all along
+    for (std::size_t i = length; i-- > 0;) {
+        void *pblock = prun + i * stride();
+        annotate::expose(pblock, m_block_sz_bytes);
+#ifdef MEM_HARDENED
+        std::memset(static_cast<std::byte *>(pblock) + sizeof(void *), detail::poison_byte, m_block_sz_bytes - sizeof(void *));  // what get() checks for
+#endif
+        store_link(pblock, m_phead);
+        annotate::hide(pblock, m_block_sz_bytes);
+        m_phead = static_cast<void **>(pblock);
+    }
+}
+
+#ifdef MEM_HARDENED
+MEM_INLINE void PoolMemory::harden_get(void *pblock, bool recycled)
+{
+    std::size_t index = (static_cast<std::byte *>(pblock) - m_pmemory) / stride();
+
+    if (recycled) {
+        // the link we've just followed has to lead to another free block of ours, a forged or overwritten one won't
+        std::uintptr_t next = reinterpret_cast<std::uintptr_t>(m_phead), begin = reinterpret_cast<std::uintptr_t>(m_pmemory);
+        if (m_phead != nullptr) {
+            if (next < begin || next >= begin + m_watermark * stride() || (next - begin) % stride() != 0) corrupted("get", "corrupted free list link", pblock);
+            std::size_t next_index = (next - begin) / stride();
+            if (m_occupied[next_index / 64] & (std::uint64_t(1) << (next_index % 64))) corrupted("get", "free list link to a block in use", pblock);
+        }
+
+        // and the rest of the block must still hold the poison it got in free()
+        auto bytes = static_cast<unsigned char *>(pblock);
+        for (std::size_t i = sizeof(void *); i < m_block_sz_bytes; i++) {
+            if (bytes[i] != detail::poison_byte) corrupted("get", "use after free, the block was written after it was freed", pblock);
+        }
+    }
+
+    std::uint64_t &word = m_occupied[index / 64];
+    std::uint64_t bit = std::uint64_t(1) << (index % 64);
+    if (word & bit) corrupted("get", "block is handed out twice", pblock);
+    word |= bit;
+
+    if (stride() != m_block_sz_bytes) {
+        std::uint64_t canary = m_cookie ^ reinterpret_cast<std::uintptr_t>(pblock);
+        annotate::expose(static_cast<std::byte *>(pblock) + m_block_sz_bytes, sizeof(canary));
+        std::memcpy(static_cast<std::byte *>(pblock) + m_block_sz_bytes, &canary, sizeof(canary));
+        annotate::hide(static_cast<std::byte *>(pblock) + m_block_sz_bytes, sizeof(canary));
+    }
+}
+
+MEM_INLINE std::size_t PoolMemory::harden_index(const char *function, void *pblock)
+{
+    std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(pblock), begin = reinterpret_cast<std::uintptr_t>(m_pmemory);
+    if (addr < begin || addr >= begin + m_total_num_blocks * stride()) corrupted(function, "foreign free, the pointer doesn't belong to this pool", pblock);
+    if ((addr - begin) % stride() != 0) corrupted(function, "the pointer isn't the start of a block", pblock);
+    return (addr - begin) / stride();
+}
+
+MEM_INLINE void PoolMemory::harden_free(void *pblock)
+{
+    std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(pblock);
+    std::size_t index = harden_index("free", pblock);
+    if (index >= m_watermark) corrupted("free", "the block was never handed out", pblock);
+    std::uint64_t &word = m_occupied[index / 64];
+    std::uint64_t bit = std::uint64_t(1) << (index % 64);
+    if (!(word & bit)) corrupted("free", "double free", pblock);
+
+    if (stride() != m_block_sz_bytes) {
+        std::uint64_t canary;
+        annotate::expose(static_cast<std::byte *>(pblock) + m_block_sz_bytes, sizeof(canary));
+        std::memcpy(&canary, static_cast<std::byte *>(pblock) + m_block_sz_bytes, sizeof(canary));
+        annotate::hide(static_cast<std::byte *>(pblock) + m_block_sz_bytes, sizeof(canary));
+        if (canary != (m_cookie ^ addr)) corrupted("free", "buffer overflow, the canary after the block was overwritten", pblock);
+    }
+
+    word &= ~bit;
+    std::memset(static_cast<std::byte *>(pblock) + sizeof(void *), detail::poison_byte, m_block_sz_bytes - sizeof(void *));
+}
+
+MEM_INLINE void PoolMemory::corrupted(const char *function, const char *what, const void *pblock)
+{
+    std::fprintf(stderr, "ERROR %s: %s (block %p of pool %p)\n", function, what, pblock, static_cast<const void *>(m_pmemory));
+    std::abort();
+}
+#endif  // MEM_HARDENED
+
+/** Monotonic Memory Resource Implementation */
+MEM_INLINE MonoMemory::MonoMemory(const std::size_t size) : m_index(0), m_peak(0), m_total_size(size), m_is_manual(true)
+{
+    m_pmemory = new std::byte[size];
+    annotate::pool_create(this, m_pmemory, size);
+    stats::on_slab(size);
+}
+MEM_INLINE MonoMemory::MonoMemory(const std::size_t size, std::byte *pointer) : m_pmemory(pointer), m_index(0), m_peak(0), m_total_size(size), m_is_manual(false)
+{
+    annotate::pool_create(this, m_pmemory, size);
+    stats::on_slab(size);
+}
+MEM_INLINE MonoMemory::~MonoMemory()
+{
+    annotate::pool_destroy(this, m_pmemory, m_total_size);
+    if (m_is_manual) {
+        delete[] m_pmemory;
+    }
+}  // delete the pre-allocated byte chunk chunk
+MEM_INLINE void *MonoMemory::get(std::size_t size) { return get<oom::Throw>(size); }
+
+// make sure the pblock is one of the pointers that you get from this byte chunk
+MEM_INLINE void MonoMemory::free(void *pblock, std::size_t size)
+{
+    free(size);
+    assert(pblock == m_pmemory + m_index);
+}
+// make sure the pblock is one of the pointers that you get from this byte chunk
+MEM_INLINE void MonoMemory::free(std::size_t size)
+{
+    assert(m_index >= size);
+    m_index -= size;
+    annotate::pool_free(this, m_pmemory + m_index, size);
+    stats::on_free(size);
+}
+
+MEM_INLINE void MonoMemory::reset()
+{
+    stats::on_reset(m_index);
+    annotate::pool_destroy(this, m_pmemory, m_total_size);
+    annotate::pool_create(this, m_pmemory, m_total_size);
+    m_index = 0;
+    m_peak = 0;
+}
+
+MEM_INLINE std::size_t MonoMemory::release_pages() { return detail::release_range(m_pmemory + m_index, m_pmemory + m_total_size); }
+
+}  // namespace mem
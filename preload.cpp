@@ -0,0 +1,375 @@
+/**
+ * Process wide replacement of malloc and operator new on the pools, to try them on unmodified binaries
+ *
+ *     LD_PRELOAD=build/liballocpool_preload.so ./program
+ *
+ * Small requests go to size class PoolMemory slabs cached per thread, large ones straight to mmap
+ * Every slab is slab_size bytes aligned to slab_size with its control block (the PoolMemory, the owning cache and the
+ * size class) at its start, so free() finds the owner of any pointer by masking it, with no lookup and no header per
+ * block. A large mapping keeps its control block at the slab_size boundary right below the pointer for the same reason
+ * A block freed by another thread than the owner of its slab goes back with remote_free(), and the caches of the threads
+ * that exited are adopted by the next new threads so that their slabs are reused
+ *
+ * Nothing in here may call malloc: the slabs, the caches and the large blocks all come from mmap
+ */
+
+#if defined(MEM_HARDENED) || defined(MEM_STATS) || defined(MEM_TRACE)
+#error "the preload library can't use the hardened, counting or tracing builds, they allocate through malloc themselves"
+#endif
+
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include <pthread.h>   // to use pthread_key_create, pthread_once and pthread_atfork
+#include <sys/mman.h>  // to use mmap
+#include <unistd.h>    // to use sysconf
+
+#include "pool.hpp"
+
+#define MEM_EXPORT __attribute__((visibility("default")))
+
+namespace
+{
+constexpr std::size_t slab_size = std::size_t(1) << 20;  // virtual, the watermark of PoolMemory touches the pages as they're needed
+constexpr std::size_t min_alignment = 16;                // what malloc guarantees
+
+// four classes per doubling above 128 bytes, so that a request wastes at most a fifth of its block
+constexpr std::size_t class_sizes[] = {16,   32,   48,   64,   80,   96,    112,   128,   160,   192,   224,   256,   320,   384,
+                                       448,  512,  640,  768,  896,  1024,  1280,  1536,  1792,  2048,  2560,  3072,  3584,  4096,
+                                       5120, 6144, 7168, 8192, 10240, 12288, 14336, 16384, 20480, 24576, 28672, 32768};
+constexpr std::size_t num_classes = sizeof(class_sizes) / sizeof(class_sizes[0]);
+constexpr std::size_t max_small = class_sizes[num_classes - 1];  // larger requests are mapped on their own
+
+enum Kind : std::uint32_t { slab_kind = 0x51ab, large_kind = 0x1a59e };
+
+struct Cache;
+
+/** Control block at the start of every slab, the blocks follow it */
+struct alignas(64) Slab {
+    std::uint32_t kind;        // slab_kind, first like in Large
+    std::uint32_t size_class;  // index in class_sizes
+    Cache *owner;              // cache that gets from the slab, never changes
+    Slab *next;                // next slab of the same class of the owner
+    mem::PoolMemory pool;
+};
+constexpr std::size_t data_offset = (sizeof(Slab) + 127) / 128 * 128;  // the blocks start 128 aligned
+
+/** Control block of a large mapping, at the slab_size boundary below the pointer */
+struct Large {
+    std::uint32_t kind;  // large_kind
+    void *map;           // the whole mapping
+    std::size_t map_size;
+    std::size_t usable;  // bytes from the pointer to the end of the mapping
+};
+
+/** The slabs of a thread */
+struct Cache {
+    Slab *current[num_classes];  // slab the gets come from
+    Slab *slabs[num_classes];    // every slab of the class, linked through Slab::next
+    Slab *cursor[num_classes];   // where the next search for a slab with free blocks starts
+    Cache *next_orphan;          // next cache of an exited thread
+};
+
+thread_local Cache *t_cache __attribute__((tls_model("initial-exec"))) = nullptr;
+thread_local bool t_creating __attribute__((tls_model("initial-exec"))) = false;  // pthread_setspecific may call malloc
+
+pthread_once_t g_once = PTHREAD_ONCE_INIT;
+pthread_key_t g_key;                              // its destructor orphans the cache of an exiting thread
+std::atomic_flag g_orphans_lock = ATOMIC_FLAG_INIT;  // protects g_orphans, spinning is fine for a few instructions
+Cache *g_orphans = nullptr;                       // caches of exited threads, adopted by new ones
+
+void lock_orphans()
+{
+    while (g_orphans_lock.test_and_set(std::memory_order_acquire)) {
+    }
+}
+void unlock_orphans() { g_orphans_lock.clear(std::memory_order_release); }
+
+std::size_t page_size()
+{
+    static const std::size_t page_sz = sysconf(_SC_PAGESIZE);
+    return page_sz;
+}
+
+std::size_t class_of(std::size_t size)
+{
+    if (size <= 128) return size == 0 ? 0 : (size - 1) / 16;
+    std::size_t width = std::bit_width(size - 1);  // 2^(width-1) < size <= 2^width, four classes between them
+    return 8 + (width - 8) * 4 + ((size - 1 - (std::size_t(1) << (width - 1))) >> (width - 3));
+}
+
+/** Map size bytes aligned to align (a power of two at least a page), nullptr if the system is out of memory */
+std::byte *map_aligned(std::size_t size, std::size_t align)
+{
+    void *mapping = mmap(nullptr, size + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) return nullptr;
+
+    auto begin = static_cast<std::byte *>(mapping);
+    auto aligned = reinterpret_cast<std::byte *>((reinterpret_cast<std::uintptr_t>(begin) + align - 1) & ~(align - 1));
+    if (aligned != begin) munmap(begin, aligned - begin);
+    if (std::size_t tail = (begin + size + align) - (aligned + size)) munmap(aligned + size, tail);
+    return aligned;
+}
+
+void *control_of(void *ptr) { return reinterpret_cast<void *>((reinterpret_cast<std::uintptr_t>(ptr) - 1) & ~(slab_size - 1)); }
+
+/** Large Blocks */
+void *get_large(std::size_t size, std::size_t align)
+{
+    std::size_t offset = align < 64 ? 64 : align;  // room for the control block
+    std::size_t map_size = (offset + size + page_size() - 1) / page_size() * page_size();
+    if (map_size < size) return nullptr;
+    std::byte *map = map_aligned(map_size, align > slab_size ? align : slab_size);
+    if (map == nullptr) return nullptr;
+
+    std::byte *ptr = map + offset;
+    auto large = static_cast<Large *>(control_of(ptr));  // map itself, or the boundary below ptr when the alignment is larger than a slab
+    large->kind = large_kind;
+    large->map = map;
+    large->map_size = map_size;
+    large->usable = map + map_size - ptr;
+    return ptr;
+}
+
+/** Thread Caches */
+void orphan(void *arg)  // the destructor of g_key, the exiting thread's cache goes to the next new thread
+{
+    auto cache = static_cast<Cache *>(arg);
+    t_cache = nullptr;
+    lock_orphans();
+    cache->next_orphan = g_orphans;
+    g_orphans = cache;
+    unlock_orphans();
+}
+
+void init_once()
+{
+    pthread_key_create(&g_key, orphan);
+    pthread_atfork(lock_orphans, unlock_orphans, unlock_orphans);  // a child must not inherit the lock held
+}
+
+__attribute__((noinline)) Cache *make_cache()
+{
+    if (t_creating) return nullptr;
+    t_creating = true;
+    pthread_once(&g_once, init_once);
+
+    lock_orphans();
+    Cache *cache = g_orphans;
+    if (cache != nullptr) g_orphans = cache->next_orphan;
+    unlock_orphans();
+    if (cache == nullptr) {
+        void *mapping = mmap(nullptr, sizeof(Cache), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);  // zeroed
+        cache = mapping == MAP_FAILED ? nullptr : static_cast<Cache *>(mapping);
+    }
+    if (cache != nullptr) {
+        pthread_setspecific(g_key, cache);
+        t_cache = cache;
+    }
+    t_creating = false;
+    return cache;
+}
+
+Cache *cache()
+{
+    Cache *pcache = t_cache;
+    if (pcache == nullptr) MEM_UNLIKELY {
+        pcache = make_cache();
+    }
+    return pcache;
+}
+
+/** Find a slab of the class with a free block, or map a new one, and return the block */
+__attribute__((noinline)) void *refill(Cache *cache, std::size_t index)
+{
+    // the other slabs have blocks back when the thread freed some, or when it reclaims what the others freed
+    Slab *start = cache->cursor[index] != nullptr ? cache->cursor[index] : cache->slabs[index];
+    for (Slab *slab = start, *first = start; slab != nullptr;) {
+        if (slab != cache->current[index]) {
+            if (void *pblock = slab->pool.get<mem::oom::Null>()) {
+                cache->current[index] = slab;
+                cache->cursor[index] = slab->next;
+                return pblock;
+            }
+        }
+        slab = slab->next != nullptr ? slab->next : cache->slabs[index];  // go round the list once
+        if (slab == first) break;
+    }
+
+    std::byte *memory = map_aligned(slab_size, slab_size);
+    if (memory == nullptr) return nullptr;
+    auto slab = reinterpret_cast<Slab *>(memory);
+    slab->kind = slab_kind;
+    slab->size_class = index;
+    slab->owner = cache;
+    slab->next = cache->slabs[index];
+    new (&slab->pool) mem::PoolMemory(class_sizes[index], (slab_size - data_offset) / class_sizes[index], memory + data_offset);
+    cache->slabs[index] = slab;
+    cache->current[index] = slab;
+    return slab->pool.get<mem::oom::Null>();
+}
+
+/** Allocation Paths */
+void *allocate(std::size_t size)
+{
+    if (size > max_small) MEM_UNLIKELY {
+        return get_large(size, min_alignment);
+    }
+    std::size_t index = class_of(size);
+    Cache *pcache = cache();
+    if (pcache == nullptr) MEM_UNLIKELY {
+        return get_large(size, min_alignment);  // only while the cache of the thread is being made
+    }
+    Slab *slab = pcache->current[index];
+    void *pblock = slab == nullptr ? nullptr : slab->pool.get<mem::oom::Null>();
+    if (pblock == nullptr) MEM_UNLIKELY {
+        pblock = refill(pcache, index);
+    }
+    return pblock;
+}
+
+void *allocate_aligned(std::size_t align, std::size_t size)
+{
+    if (align <= min_alignment) return allocate(size);
+    // a power of two class is aligned to its size up to the alignment of the first block
+    std::size_t rounded = std::bit_ceil(size < align ? align : size);
+    if (align <= 128 && rounded <= max_small) return allocate(rounded);
+    return get_large(size, align < page_size() ? page_size() : align);
+}
+
+void deallocate(void *ptr)
+{
+    if (ptr == nullptr) return;
+    void *control = control_of(ptr);
+    if (*static_cast<std::uint32_t *>(control) == large_kind) MEM_UNLIKELY {
+        auto large = static_cast<Large *>(control);
+        munmap(large->map, large->map_size);
+        return;
+    }
+    auto slab = static_cast<Slab *>(control);
+    if (slab->owner == t_cache) MEM_LIKELY {
+        slab->pool.free(ptr);
+    } else {
+        slab->pool.remote_free(ptr);  // the owner reclaims it on a miss
+    }
+}
+
+std::size_t usable_size(void *ptr)
+{
+    if (ptr == nullptr) return 0;
+    void *control = control_of(ptr);
+    if (*static_cast<std::uint32_t *>(control) == large_kind) return static_cast<Large *>(control)->usable;
+    return class_sizes[static_cast<Slab *>(control)->size_class];
+}
+
+void *reallocate(void *ptr, std::size_t size)
+{
+    if (ptr == nullptr) return allocate(size);
+    if (size == 0) {  // like glibc
+        deallocate(ptr);
+        return nullptr;
+    }
+    std::size_t usable = usable_size(ptr);
+    if (size <= usable && size > usable / 2) return ptr;  // still fits without wasting most of the block
+
+    void *moved = allocate(size);
+    if (moved == nullptr) return nullptr;
+    std::memcpy(moved, ptr, size < usable ? size : usable);
+    deallocate(ptr);
+    return moved;
+}
+
+void *nothrow_or_errno(void *ptr)
+{
+    if (ptr == nullptr) errno = ENOMEM;
+    return ptr;
+}
+
+/** operator new calls the new handler until it gives up, then throws */
+void *allocate_or_throw(std::size_t size, std::size_t align)
+{
+    for (;;) {
+        void *ptr = align <= min_alignment ? allocate(size) : allocate_aligned(align, size);
+        if (ptr != nullptr) MEM_LIKELY {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) throw std::bad_alloc();
+        handler();
+    }
+}
+}  // namespace
+
+/** The C allocation functions */
+extern "C" {
+MEM_EXPORT void *malloc(std::size_t size) { return nothrow_or_errno(allocate(size)); }
+MEM_EXPORT void free(void *ptr) { deallocate(ptr); }
+MEM_EXPORT void *realloc(void *ptr, std::size_t size)
+{
+    void *moved = reallocate(ptr, size);
+    if (moved == nullptr && size != 0) errno = ENOMEM;
+    return moved;
+}
+MEM_EXPORT void *reallocarray(void *ptr, std::size_t count, std::size_t size)
+{
+    std::size_t total;
+    if (__builtin_mul_overflow(count, size, &total)) return nothrow_or_errno(nullptr);
+    return realloc(ptr, total);
+}
+MEM_EXPORT void *calloc(std::size_t count, std::size_t size)
+{
+    std::size_t total;
+    if (__builtin_mul_overflow(count, size, &total)) return nothrow_or_errno(nullptr);
+    void *ptr = allocate(total);
+    if (ptr != nullptr && total <= max_small) std::memset(ptr, 0, total);  // a large block is a fresh mapping, zero already
+    return nothrow_or_errno(ptr);
+}
+MEM_EXPORT int posix_memalign(void **pptr, std::size_t align, std::size_t size)
+{
+    if (align < sizeof(void *) || !std::has_single_bit(align)) return EINVAL;
+    void *ptr = allocate_aligned(align, size);
+    if (ptr == nullptr) return ENOMEM;
+    *pptr = ptr;
+    return 0;
+}
+MEM_EXPORT void *aligned_alloc(std::size_t align, std::size_t size)
+{
+    if (!std::has_single_bit(align)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return nothrow_or_errno(allocate_aligned(align, size));
+}
+MEM_EXPORT void *memalign(std::size_t align, std::size_t size) { return aligned_alloc(align, size); }
+MEM_EXPORT void *valloc(std::size_t size) { return nothrow_or_errno(allocate_aligned(page_size(), size)); }
+MEM_EXPORT void *pvalloc(std::size_t size) { return nothrow_or_errno(allocate_aligned(page_size(), (size + page_size() - 1) / page_size() * page_size())); }
+MEM_EXPORT std::size_t malloc_usable_size(void *ptr) { return usable_size(ptr); }
+}
+
+/** The global operator new and delete, so that C++ programs skip the malloc call of the library's own */
+MEM_EXPORT void *operator new(std::size_t size) { return allocate_or_throw(size, min_alignment); }
+MEM_EXPORT void *operator new[](std::size_t size) { return allocate_or_throw(size, min_alignment); }
+MEM_EXPORT void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+MEM_EXPORT void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+MEM_EXPORT void *operator new(std::size_t size, std::align_val_t align) { return allocate_or_throw(size, std::size_t(align)); }
+MEM_EXPORT void *operator new[](std::size_t size, std::align_val_t align) { return allocate_or_throw(size, std::size_t(align)); }
+MEM_EXPORT void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept { return allocate_aligned(std::size_t(align), size); }
+MEM_EXPORT void *operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t &) noexcept { return allocate_aligned(std::size_t(align), size); }
+
+MEM_EXPORT void operator delete(void *ptr) noexcept { deallocate(ptr); }
+MEM_EXPORT void operator delete[](void *ptr) noexcept { deallocate(ptr); }
+MEM_EXPORT void operator delete(void *ptr, std::size_t) noexcept { deallocate(ptr); }
+MEM_EXPORT void operator delete[](void *ptr, std::size_t) noexcept { deallocate(ptr); }
+MEM_EXPORT void operator delete(void *ptr, const std::nothrow_t &) noexcept { deallocate(ptr); }
+MEM_EXPORT void operator delete[](void *ptr, const std::nothrow_t &) noexcept { deallocate(ptr); }
+MEM_EXPORT void operator delete(void *ptr, std::align_val_t) noexcept { deallocate(ptr); }
+MEM_EXPORT void operator delete[](void *ptr, std::align_val_t) noexcept { deallocate(ptr); }
+MEM_EXPORT void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept { deallocate(ptr); }
+MEM_EXPORT void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept { deallocate(ptr); }
+MEM_EXPORT void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { deallocate(ptr); }
+MEM_EXPORT void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { deallocate(ptr); }
@@ -0,0 +1,275 @@
+#include "profile.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>  // to use backtrace
+#define MEM_HAS_BACKTRACE
+#endif
+
+using namespace mem::profile;
+
+namespace
+{
+constexpr std::size_t default_interval = 512 * 1024;
+constexpr std::int64_t disabled_recheck = default_interval;  // bytes a thread allocates between two looks at a stopped profiler
+
+/** The live samples of every thread */
+class Profiler
+{
+   public:
+    static Profiler &instance()
+    {
+        static Profiler *profiler = new Profiler;  // never destroyed, blocks may be freed after the statics are gone
+        return *profiler;
+    }
+
+    Profiler()
+    {
+        const char *interval = std::getenv("MEM_PROFILE_INTERVAL");
+        m_interval = interval != nullptr ? std::strtoull(interval, nullptr, 10) : default_interval;
+        if (std::getenv("MEM_PROFILE_FILE") != nullptr) std::atexit([] { dump(std::getenv("MEM_PROFILE_FILE")); });
+#ifdef MEM_HAS_BACKTRACE
+        void *warm[1];
+        backtrace(warm, 1);  // the first call loads the unwinder, which allocates
+#endif
+    }
+
+    std::size_t interval() { return m_interval.load(std::memory_order_relaxed); }
+    void set_interval(std::size_t mean_bytes) { m_interval.store(mean_bytes, std::memory_order_relaxed); }
+
+    void add(const void *pblock, Sample sample)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto [it, added] = m_live.insert_or_assign(pblock, std::move(sample));
+        if (added) detail::filter[detail::slot(pblock)].fetch_add(1, std::memory_order_relaxed);  // replaced if its free was missed
+    }
+
+    void remove(const void *pblock)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_live.erase(pblock) != 0) detail::filter[detail::slot(pblock)].fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    std::vector<Sample> live()
+    {
+        std::vector<Sample> samples;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        samples.reserve(m_live.size());
+        for (auto &entry : m_live) samples.push_back(entry.second);
+        return samples;
+    }
+
+   private:
+    std::atomic<std::size_t> m_interval;
+    std::mutex m_mutex;
+    std::unordered_map<const void *, Sample> m_live;
+};
+
+/** Bytes until the next sample, exponentially distributed with a mean of interval bytes, at least one */
+std::int64_t draw(std::size_t interval)
+{
+    thread_local std::uint64_t state = reinterpret_cast<std::uintptr_t>(&state) ^ std::chrono::steady_clock::now().time_since_epoch().count();
+    state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+    double uniform = static_cast<double>((state >> 11) + 1) * 0x1.0p-53;  // in (0, 1]
+    double bytes = -std::log(uniform) * static_cast<double>(interval);
+    return bytes < 1 ? 1 : bytes > 0x1.0p62 ? std::int64_t(1) << 62 : static_cast<std::int64_t>(bytes);
+}
+
+/** Protocol buffer encoding, just what profile.proto needs */
+class Proto
+{
+   public:
+    void varint(std::uint64_t value)
+    {
+        for (; value >= 0x80; value >>= 7) m_buffer.push_back(static_cast<char>(value | 0x80));
+        m_buffer.push_back(static_cast<char>(value));
+    }
+    void number(int field, std::uint64_t value)
+    {
+        varint(static_cast<std::uint64_t>(field) << 3);
+        varint(value);
+    }
+    void bytes(int field, const std::string &value)
+    {
+        varint(static_cast<std::uint64_t>(field) << 3 | 2);
+        varint(value.size());
+        m_buffer += value;
+    }
+    void message(int field, const Proto &value) { bytes(field, value.m_buffer); }
+    void packed(int field, const std::vector<std::uint64_t> &values)
+    {
+        Proto body;
+        for (std::uint64_t value : values) body.varint(value);
+        message(field, body);
+    }
+
+    const std::string &str() const { return m_buffer; }
+
+   private:
+    std::string m_buffer;
+};
+
+/** The strings of a profile, referred to by their index, the empty string first */
+class Strings
+{
+   public:
+    Strings() { (*this)(""); }
+
+    std::uint64_t operator()(const std::string &value)
+    {
+        auto [it, added] = m_index.emplace(value, m_index.size());
+        if (added) m_table.push_back(value);
+        return it->second;
+    }
+
+    void write(Proto &profile)
+    {
+        for (const std::string &value : m_table) profile.bytes(6, value);
+    }
+
+   private:
+    std::map<std::string, std::uint64_t> m_index;
+    std::vector<std::string> m_table;
+};
+
+struct Mapping {
+    std::uintptr_t start, limit, offset;
+    std::string path;
+};
+
+/** The executable mappings of the process with a file, so that pprof can find the binaries to symbolize the stacks with */
+std::vector<Mapping> mappings()
+{
+    std::vector<Mapping> result;
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    while (std::getline(maps, line)) {
+        unsigned long long start, limit, offset;
+        char perms[8];
+        int path_at = 0;
+        if (std::sscanf(line.c_str(), "%llx-%llx %7s %llx %*s %*s %n", &start, &limit, perms, &offset, &path_at) < 4) continue;
+        if (perms[2] != 'x' || path_at == 0 || line[path_at] != '/') continue;
+        result.push_back({static_cast<std::uintptr_t>(start), static_cast<std::uintptr_t>(limit), static_cast<std::uintptr_t>(offset), line.substr(path_at)});
+    }
+    return result;
+}
+}  // namespace
+
+void mem::profile::set_interval(std::size_t mean_bytes) { Profiler::instance().set_interval(mean_bytes); }
+
+std::size_t mem::profile::interval() { return Profiler::instance().interval(); }
+
+std::vector<Sample> mem::profile::live() { return Profiler::instance().live(); }
+
+void mem::profile::detail::sample(const void *pblock, std::size_t size, std::size_t block, const char *resource)
+{
+    thread_local bool started = false;
+    bool first = !started;
+    started = true;
+    Profiler &profiler = Profiler::instance();
+    std::size_t mean = profiler.interval();
+    bytes_left = mean == 0 ? disabled_recheck : draw(mean);
+    if (mean == 0) return;  // stopped, the count only makes the thread look again later
+    if (first && static_cast<std::int64_t>(size) < bytes_left) {
+        bytes_left -= size;  // the first count of a thread is drawn on its first allocation, which counts against it like the others
+        return;
+    }
+
+    Sample sample;
+#ifdef MEM_HAS_BACKTRACE
+    void *frames[max_depth + 1];
+    int depth = backtrace(frames, max_depth + 1);
+    sample.stack.assign(frames + (depth > 0 ? 1 : 0), frames + depth);  // not this function
+#endif
+    sample.size = size;
+    sample.block = block;
+    sample.resource = resource;
+    sample.weight = 1 / -std::expm1(-static_cast<double>(size) / static_cast<double>(mean));
+    profiler.add(pblock, std::move(sample));
+}
+
+void mem::profile::detail::forget(const void *pblock) { Profiler::instance().remove(pblock); }
+
+void mem::profile::write_pprof(std::ostream &os)
+{
+    std::vector<Sample> samples = live();
+    std::vector<Mapping> maps = mappings();
+    Strings strings;
+    Proto profile;
+
+    auto value_type = [&](int field, const char *type, const char *unit) {
+        Proto message;
+        message.number(1, strings(type));
+        message.number(2, strings(unit));
+        profile.message(field, message);
+    };
+    value_type(1, "inuse_objects", "count");
+    value_type(1, "inuse_space", "bytes");
+
+    std::map<std::uintptr_t, std::uint64_t> locations;  // by address, the ids start at one
+    for (const Sample &sample : samples) {
+        Proto message;
+        std::vector<std::uint64_t> ids;
+        for (void *frame : sample.stack) {
+            std::uintptr_t address = reinterpret_cast<std::uintptr_t>(frame) - 1;  // in the call, not after it
+            ids.push_back(locations.emplace(address, locations.size() + 1).first->second);
+        }
+        message.packed(1, ids);
+        message.packed(2, {static_cast<std::uint64_t>(std::llround(sample.weight)), static_cast<std::uint64_t>(std::llround(sample.weight * sample.size))});
+        Proto resource, block;
+        resource.number(1, strings("resource"));
+        resource.number(2, strings(sample.resource));
+        message.message(3, resource);
+        block.number(1, strings("block"));
+        block.number(3, sample.block);
+        block.number(4, strings("bytes"));
+        message.message(3, block);
+        profile.message(2, message);
+    }
+
+    for (std::size_t i = 0; i < maps.size(); i++) {
+        Proto message;
+        message.number(1, i + 1);
+        message.number(2, maps[i].start);
+        message.number(3, maps[i].limit);
+        message.number(4, maps[i].offset);
+        message.number(5, strings(maps[i].path));
+        profile.message(3, message);
+    }
+    for (auto [address, id] : locations) {
+        Proto message;
+        message.number(1, id);
+        for (std::size_t i = 0; i < maps.size(); i++) {
+            if (address >= maps[i].start && address < maps[i].limit) {
+                message.number(2, i + 1);
+                break;
+            }
+        }
+        message.number(3, address);
+        profile.message(4, message);
+    }
+
+    profile.number(9, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    value_type(11, "space", "bytes");
+    profile.number(12, interval());
+    profile.number(14, strings("inuse_space"));
+    strings.write(profile);  // last, every string has been added by now
+
+    os.write(profile.str().data(), static_cast<std::streamsize>(profile.str().size()));
+}
+
+bool mem::profile::dump(const std::string &path)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+    write_pprof(file);
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "pool.hpp"
+
+namespace mem
+{
+namespace profile
+{
+/**
+ * Sampling heap profiler of the allocators in myAllocator.hpp, compiled in only when MEM_PROFILE is defined
+ * Every thread counts down the bytes it allocates and takes a sample, the call stack of the allocation, when it runs
+ * out, then draws the next count from an exponential distribution of mean interval() bytes. So an allocation of size
+ * bytes is sampled with probability 1 - exp(-size / interval()) whatever the allocations before it were, and each sample
+ * stands for the 1 / probability allocations it was drawn from. Allocations that aren't sampled cost a thread local
+ * subtraction, and a deallocation costs a load from a small counting filter of the sampled addresses
+ *
+ * Samples are tagged with the allocator and the block size of its pool, or the size class for vector::allocator, and
+ * live ones can be written out in the pprof format (profile.proto, uncompressed) for pprof -top program mem.pprof, the
+ * standalone github.com/google/pprof, which symbolizes with the binaries' symbols; go tool pprof only does for Go binaries
+ * The interval is the MEM_PROFILE_INTERVAL environment variable (512 KiB by default), and if MEM_PROFILE_FILE is set the
+ * live samples are written there at exit, which makes it a leak profile
+ * The stacks come from backtrace() of glibc or macOS, elsewhere the samples are taken all the same but their stacks are empty
+ */
+constexpr std::size_t max_depth = 64;  // frames kept of each stack
+
+struct Sample {
+    std::vector<void *> stack;  // return addresses, innermost first, from the allocator up
+    std::size_t size;           // bytes requested
+    std::size_t block;          // block size of the pool it was gotten from or its size class
+    const char *resource;       // the allocator, a string literal
+    double weight;              // allocations this sample stands for
+};
+
+// mean bytes between two samples, 0 to stop sampling; every thread draws its next count with it after its next sample
+void set_interval(std::size_t mean_bytes);
+std::size_t interval();
+
+// copy of the samples still allocated, in no particular order
+std::vector<Sample> live();
+
+// write the live samples as a pprof profile with inuse_objects and inuse_space values, estimated from the samples
+void write_pprof(std::ostream &os);
+bool dump(const std::string &path);  // to a file, false if it can't be written
+
+namespace detail
+{
+constexpr std::size_t filter_bits = 12;
+// counting filter of the sampled addresses, so that a deallocation only takes the lock if its address may be one of them
+inline std::atomic<std::uint32_t> filter[std::size_t(1) << filter_bits];
+inline thread_local std::int64_t bytes_left = 0;  // until the next sample of the calling thread, 0 before its first allocation
+
+inline std::size_t slot(const void *pblock) { return (reinterpret_cast<std::uintptr_t>(pblock) >> 4) * 0x9e3779b97f4a7c15 >> (64 - filter_bits); }
+
+void sample(const void *pblock, std::size_t size, std::size_t block, const char *resource);  // and draw the next count
+void forget(const void *pblock);
+}  // namespace detail
+
+/** Hooks called by the allocators */
+#ifdef MEM_PROFILE
+inline void record_allocate(const void *pblock, std::size_t size, std::size_t block, const char *resource)
+{
+    if (static_cast<std::int64_t>(size) < detail::bytes_left) MEM_LIKELY {
+        detail::bytes_left -= size;
+        return;
+    }
+    detail::sample(pblock, size, block, resource);
+}
+inline void record_deallocate(const void *pblock)
+{
+    if (detail::filter[detail::slot(pblock)].load(std::memory_order_relaxed) != 0) MEM_UNLIKELY {
+        detail::forget(pblock);
+    }
+}
+#else
+inline void record_allocate(const void *, std::size_t, std::size_t, const char *) {}
+inline void record_deallocate(const void *) {}
+#endif  // MEM_PROFILE
+}  // namespace profile
+}  // namespace mem
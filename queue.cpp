@@ -0,0 +1,92 @@
+#include "queue.hpp"
+
+#include <bit>
+
+using mem::BlockQueue;
+using mem::ConcurrentPool;
+
+BlockQueue::BlockQueue(std::size_t capacity)
+    : m_cells(new Cell[std::bit_ceil(capacity < 2 ? std::size_t(2) : capacity)]),
+      m_mask(std::bit_ceil(capacity < 2 ? std::size_t(2) : capacity) - 1),
+      m_enqueue_pos(0),
+      m_dequeue_pos(0)
+{
+    for (std::size_t i = 0; i <= m_mask; i++) m_cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+std::size_t BlockQueue::size()
+{
+    // the dequeue position first, so that a push and pop in between can't make it pass the enqueue one we read next
+    std::size_t dequeued = m_dequeue_pos.load(std::memory_order_acquire);
+    std::size_t enqueued = m_enqueue_pos.load(std::memory_order_acquire);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+ConcurrentPool::ConcurrentPool(const std::size_t block_sz_bytes, const std::size_t num_blocks)
+    : m_pmemory(new std::byte[num_blocks * block_sz_bytes]),
+      m_pool_sz_bytes(num_blocks * block_sz_bytes),
+      m_block_sz_bytes(block_sz_bytes),
+      m_total_num_blocks(num_blocks),
+      m_is_manual(true),
+      m_free(num_blocks),
+      m_watermark(0)
+{
+    annotate::pool_create(this, m_pmemory, m_pool_sz_bytes);
+    stats::on_slab(m_pool_sz_bytes);
+}
+
+ConcurrentPool::ConcurrentPool(const std::size_t block_sz_bytes, const std::size_t num_blocks, std::byte *pmemory)
+    : m_pmemory(pmemory),  // this memory may have come from a different memory resource
+      m_pool_sz_bytes(num_blocks * block_sz_bytes),
+      m_block_sz_bytes(block_sz_bytes),
+      m_total_num_blocks(num_blocks),
+      m_is_manual(false),
+      m_free(num_blocks),
+      m_watermark(0)
+{
+    annotate::pool_create(this, m_pmemory, m_pool_sz_bytes);
+    stats::on_slab(m_pool_sz_bytes);
+}
+
+ConcurrentPool::~ConcurrentPool()
+{
+    annotate::pool_destroy(this, m_pmemory, m_pool_sz_bytes);
+    if (m_is_manual) {
+        delete[] m_pmemory;
+    }
+}
+
+std::size_t ConcurrentPool::peak()
+{
+    std::size_t watermark = m_watermark.load(std::memory_order_relaxed);
+    return watermark < m_total_num_blocks ? watermark : m_total_num_blocks;
+}
+
+std::size_t ConcurrentPool::free_count()
+{
+    std::size_t free = m_total_num_blocks - peak() + m_free.size();
+    return free < m_total_num_blocks ? free : m_total_num_blocks;
+}
+
+bool ConcurrentPool::owns(const void *pblock)
+{
+    auto addr = static_cast<const std::byte *>(pblock);
+    return addr >= m_pmemory && addr < m_pmemory + m_pool_sz_bytes;
+}
+
+void *ConcurrentPool::carve(bool &recycled)
+{
+    recycled = false;
+    // look before adding, so that the watermark stops a few blocks past the capacity, one per thread at most, once exhausted
+    if (m_watermark.load(std::memory_order_relaxed) < m_total_num_blocks) {
+        std::size_t index = m_watermark.fetch_add(1, std::memory_order_relaxed);
+        if (index < m_total_num_blocks) return m_pmemory + index * m_block_sz_bytes;
+    }
+    // the pop of get() also fails on a cell a free() claimed but hasn't filled yet, wait for it while the ring isn't empty
+    recycled = true;
+    for (;;) {
+        if (void *pblock = m_free.pop()) return pblock;
+        if (m_free.empty()) return nullptr;
+        std::this_thread::yield();
+    }
+}
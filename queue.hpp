@@ -0,0 +1,203 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "annotate.hpp"
+#include "pool.hpp"
+#include "stats.hpp"
+
+namespace mem
+{
+/**
+ * Bounded lock-free MPMC queue of block pointers, the ring of Dmitry Vyukov
+ * Every cell has a sequence number telling whose turn it is: the producer of position pos may fill the cell when its
+ * sequence is pos, the consumer of pos may empty it when it's pos + 1, and emptying it sets it to pos + capacity for the
+ * producer of the next lap. Producers claim a position with one CAS on their counter and consumers on theirs, so a
+ * producer only ever contends with producers and a consumer with consumers, and the blocks themselves are never touched
+ * push() and pop() don't wait: they fail on a full or an empty ring and the caller decides whether to retry, yield or do
+ * something else. A thread preempted between its CAS and its store of the sequence holds back the cell it claimed,
+ * the threads that reach that cell on the next lap see the ring full or empty until it runs again
+ */
+class BlockQueue
+{
+   public:
+    explicit BlockQueue(std::size_t capacity);  // capacity is rounded up to a power of two, two at least
+
+    BlockQueue(const BlockQueue &queue) = delete;            // delete copy constructor
+    BlockQueue &operator=(const BlockQueue &rhs) = delete;  // delete copy-assignment operator
+    BlockQueue(BlockQueue &&queue) = delete;                 // delete move constructor
+    BlockQueue &operator=(BlockQueue &&rhs) = delete;       // delete move-assignment operator
+
+    bool push(void *pblock);  // append pblock, which mustn't be nullptr, return false if the ring is full
+    void *pop();              // take the oldest block, return nullptr if the ring is empty
+
+    std::size_t capacity() { return m_mask + 1; }  // return the number of blocks the ring holds at most
+    std::size_t size();                            // return the number of blocks in the ring, a snapshot while other threads use it
+    bool empty() { return size() == 0; }
+
+   private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        void *pblock;  // written before the sequence is released, read after it's acquired
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    std::size_t m_mask;                                  // capacity - 1, a position's cell is pos & m_mask
+    alignas(64) std::atomic<std::size_t> m_enqueue_pos;  // next position a producer claims, a cache line of its own
+    alignas(64) std::atomic<std::size_t> m_dequeue_pos;  // next position a consumer claims
+};
+
+/**
+ * Pool Memory Resource that any thread may get from and free to, without a lock
+ * Its free list is a BlockQueue holding every free block, which has no ABA problem unlike a linked stack would have and
+ * leaves the free blocks untouched, so they stay poisoned for the sanitizers. Like PoolMemory the blocks are carved lazily
+ * after a watermark, an atomic one here, so that a large pool costs nothing until its blocks are used
+ * The ring hands the blocks out first freed first, a recycled block is colder than one of the LIFO free list of a PoolMemory,
+ * keep to PoolMemory and remote_free() when a block mostly goes back to the thread that got it
+ * With a BlockQueue of messages it makes a pipeline without locks nor heap: get(), fill, push(), then pop(), read, free()
+ * The hardened mode doesn't check it, free() only asserts that the block belongs to the pool
+ */
+class ConcurrentPool
+{
+   public:
+    ConcurrentPool(const std::size_t block_sz_bytes, const std::size_t num_blocks);
+    ConcurrentPool(const std::size_t block_sz_bytes, const std::size_t num_blocks, std::byte *pmemory);
+
+    ConcurrentPool(const ConcurrentPool &pool) = delete;            // delete copy constructor
+    ConcurrentPool &operator=(const ConcurrentPool &rhs) = delete;  // delete copy-assignment operator
+    ConcurrentPool(ConcurrentPool &&pool) = delete;                 // delete move constructor
+    ConcurrentPool &operator=(ConcurrentPool &&rhs) = delete;       // delete move-assignment operator
+
+    ~ConcurrentPool();
+
+    std::size_t block_size() { return m_block_sz_bytes; }         // return block size in byte
+    std::size_t pool_size() { return m_pool_sz_bytes; }           // return memory pool size in byte
+    std::size_t capacity() { return m_total_num_blocks; }         // return total number of blocks that this pool can hold
+    std::size_t free_count();                                     // return number of free blocks, a snapshot while other threads use the pool
+    std::size_t size() { return capacity() - free_count(); }      // return the number of blocks in use, a snapshot too
+    std::size_t peak();                                           // return the most blocks ever in use at once since construction
+    bool owns(const void *pblock);                                // return whether pblock points into the memory of this pool
+
+    // return a pointer to a block of m_block_sz_bytes, from any thread
+    // if the memory pool is exhausted, throw std::bad_alloc, or do what OomPolicy says
+    void *get(std::size_t size);
+    void *get();
+    template <class OomPolicy>
+    void *get();
+
+    // give back a block gotten from this pool, from any thread
+    void free(void *pblock, std::size_t size);
+    void free(void *pblock);
+
+   private:
+    // a never touched block after the watermark, or a block freed in the meantime, nullptr only if nothing is free
+    // recycled is set to whether it's one of the freed blocks
+    void *carve(bool &recycled);
+
+    std::byte *m_pmemory;            // pointer to the first address of the pool
+    std::size_t m_pool_sz_bytes;     // the size in bytes of the pool
+    std::size_t m_block_sz_bytes;    // size in bytes of each block
+    std::size_t m_total_num_blocks;  // total number of blocks
+    bool m_is_manual;                // whether the m_pmemory is manually allocated by us
+    BlockQueue m_free;               // the free blocks, it holds them all so a free() never finds it full for long
+    alignas(64) std::atomic<std::size_t> m_watermark;  // blocks carved so far, a few past the capacity once exhausted
+};
+
+/** Block Queue Fast Path, inlined into the callers */
+inline bool BlockQueue::push(void *pblock)
+{
+    assert(pblock != nullptr);
+    std::size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell &cell = m_cells[pos & m_mask];
+        std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        std::intptr_t lap = static_cast<std::intptr_t>(sequence - pos);
+        if (lap == 0) {  // the cell is free for pos, claim it
+            if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.pblock = pblock;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (lap < 0) MEM_UNLIKELY {  // the cell still holds the block of the previous lap
+            return false;
+        } else {  // another producer took pos
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+inline void *BlockQueue::pop()
+{
+    std::size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell &cell = m_cells[pos & m_mask];
+        std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        std::intptr_t lap = static_cast<std::intptr_t>(sequence - (pos + 1));
+        if (lap == 0) {  // the cell holds the block of pos, claim it
+            if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                void *pblock = cell.pblock;
+                cell.sequence.store(pos + m_mask + 1, std::memory_order_release);  // free for the producer of the next lap
+                return pblock;
+            }
+        } else if (lap < 0) MEM_UNLIKELY {  // nothing was pushed at pos yet
+            return nullptr;
+        } else {  // another consumer took pos
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+/** Concurrent Pool Memory Resource Fast Path, inlined into the callers */
+template <class OomPolicy>
+void *ConcurrentPool::get()
+{
+    void *pblock = m_free.pop();
+    bool recycled = pblock != nullptr;
+    if (pblock == nullptr) MEM_UNLIKELY {
+        pblock = carve(recycled);
+    }
+    if (pblock == nullptr) MEM_UNLIKELY {  // out of memory blocks
+        stats::on_fail();
+        return OomPolicy::exhausted(m_block_sz_bytes);
+    }
+    annotate::pool_alloc(this, pblock, m_block_sz_bytes);
+    stats::on_get_block(m_block_sz_bytes, recycled);
+    return pblock;
+}
+
+inline void *ConcurrentPool::get() { return get<oom::Throw>(); }
+
+/** Just a thin wrapper */
+inline void *ConcurrentPool::get([[maybe_unused]] std::size_t size)
+{
+    assert(size == m_block_sz_bytes);
+    return get();
+}
+
+inline void ConcurrentPool::free(void *pblock)
+{
+    if (pblock == nullptr) MEM_UNLIKELY {
+        return;
+    }
+    assert(owns(pblock) && (static_cast<std::byte *>(pblock) - m_pmemory) % m_block_sz_bytes == 0);
+    stats::on_free(m_block_sz_bytes);
+
+    // poisoned before it's published, another thread may get it right after the push
+    annotate::pool_free(this, pblock, m_block_sz_bytes);
+    while (!m_free.push(pblock)) MEM_UNLIKELY {
+        std::this_thread::yield();  // the ring has room for every block, it's only full while a get() finishes with our cell
+    }
+}
+
+/** Just a thin wrapper */
+inline void ConcurrentPool::free(void *pblock, [[maybe_unused]] std::size_t size)
+{
+    assert(size == m_block_sz_bytes);
+    free(pblock);
+}
+}  // namespace mem
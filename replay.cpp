@@ -0,0 +1,311 @@
+/**
+ * Replay a recorded allocation trace against every memory resource
+ * Record one by building the program with MEM_TRACE defined and trace.cpp in the compilation list, then
+ *
+ * Usage: replay TRACE_FILE [--frag]
+ *
+ * For each resource we report the throughput of the replay, the peak resident memory it added
+ * and the fragmentation at its peak footprint: the share of the memory it held that wasn't holding live requests
+ * With --frag, the trace is replayed once more on the size classes up to the point with the most live bytes, and the
+ * fragmentation analyzer reports on their slabs there, see frag.hpp
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "frag.hpp"
+#include "pool.hpp"
+#include "trace.hpp"
+
+#if defined(__linux__)
+#include <unistd.h>  // to use sysconf
+#endif
+#if defined(__GLIBC__)
+#include <malloc.h>  // to use malloc_trim
+#endif
+
+using mem::trace::Event;
+using mem::trace::Op;
+using hiclock = std::chrono::high_resolution_clock;
+using duration = std::chrono::duration<double>;
+
+/** Current resident set size in bytes, 0 where we don't know how to get it */
+std::size_t resident_bytes()
+{
+#if defined(__linux__)
+    std::size_t pages = 0, resident = 0;
+    if (std::FILE *statm = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(statm, "%zu %zu", &pages, &resident) != 2) resident = 0;
+        std::fclose(statm);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+/** Every request goes straight to ::operator new, we can't tell how much the heap holds for it */
+class NewDelete
+{
+   public:
+    static const char *name() { return "std::allocator"; }
+    void *allocate(std::size_t size) { return ::operator new(size); }
+    void deallocate(void *pblock, std::size_t) { ::operator delete(pblock); }
+    std::size_t reserved() { return 0; }
+};
+
+/**
+ * Power of two size classes from 8 to 4096 bytes, each one a list of PoolMemory slabs doubling in size like list::allocator
+ * Blocks go back to the slab they came from and are gotten from the newest slab that has one, larger requests go to ::operator new
+ */
+class SizeClassPool
+{
+   public:
+    static const char *name() { return "PoolMemory size classes"; }
+
+    ~SizeClassPool()
+    {
+        for (auto &slabs : m_classes)
+            for (auto pool : slabs) delete pool;
+    }
+
+    void *allocate(std::size_t size)
+    {
+        std::size_t index = class_of(size);
+        if (index >= num_classes) return ::operator new(size);
+
+        auto &slabs = m_classes[index];
+        for (auto it = slabs.rbegin(); it != slabs.rend(); ++it) {  // the newest first, the older ones got blocks back
+            if (void *pblock = (*it)->get<mem::oom::Null>()) return pblock;
+        }
+        std::size_t num_blocks = slabs.empty() ? 64 : slabs.back()->capacity() * 2;
+        slabs.push_back(new mem::PoolMemory(block_size(index), num_blocks));
+        m_reserved += slabs.back()->pool_size();
+        return slabs.back()->get();
+    }
+
+    void deallocate(void *pblock, std::size_t size)
+    {
+        std::size_t index = class_of(size);
+        if (index >= num_classes) return ::operator delete(pblock);
+        for (auto it = m_classes[index].rbegin(); it != m_classes[index].rend(); ++it) {
+            if ((*it)->owns(pblock)) return (*it)->free(pblock);
+        }
+    }
+
+    std::size_t reserved() { return m_reserved; }
+
+    // add every slab to the analyzer, and the requests of the sizes given to the blocks that serve them
+    void analyze(mem::frag::Analyzer &analyzer, const std::vector<std::uint32_t> &sizes)
+    {
+        for (std::size_t index = 0; index < num_classes; index++)
+            for (auto pool : m_classes[index]) analyzer.add(*pool, "class " + std::to_string(block_size(index)));
+        for (std::uint32_t size : sizes) {
+            if (class_of(size) < num_classes) analyzer.request(size, block_size(class_of(size)));
+        }
+    }
+
+   private:
+    static constexpr std::size_t num_classes = 10;  // 8 << 9 == 4096
+    static std::size_t block_size(std::size_t index) { return std::size_t(8) << index; }
+    static std::size_t class_of(std::size_t size)
+    {
+        std::size_t index = 0;
+        while (index < num_classes && block_size(index) < size) index++;
+        return index;
+    }
+
+    std::vector<mem::PoolMemory *> m_classes[num_classes];
+    std::size_t m_reserved = 0;
+};
+
+/** A chain of 1 MiB MonoMemory chunks, only a deallocation of the latest allocation gives anything back */
+class MonoChain
+{
+   public:
+    static const char *name() { return "MonoMemory chunks"; }
+
+    ~MonoChain()
+    {
+        for (auto chunk : m_chunks) delete chunk;
+    }
+
+    void *allocate(std::size_t size)
+    {
+        if (m_chunks.empty() || m_chunks.back()->free_count() < size) {
+            m_chunks.push_back(new mem::MonoMemory(std::max(chunk_size, size)));
+            m_reserved += m_chunks.back()->capacity();
+        }
+        m_last = m_chunks.back()->get(size);
+        return m_last;
+    }
+
+    void deallocate(void *pblock, std::size_t size)
+    {
+        if (pblock != m_last) return;  // monotonic, the memory is lost until the whole chain goes
+        m_chunks.back()->free(pblock, size);
+        m_last = nullptr;
+    }
+
+    std::size_t reserved() { return m_reserved; }
+
+   private:
+    static constexpr std::size_t chunk_size = 1 << 20;
+    std::vector<mem::MonoMemory *> m_chunks;
+    void *m_last = nullptr;
+    std::size_t m_reserved = 0;
+};
+
+struct Report {
+    double seconds = 0;
+    std::size_t peak_rss = 0;       // resident bytes added at the worst point of the replay
+    std::size_t peak_reserved = 0;  // bytes the resource held at its peak
+    std::size_t live_at_peak = 0;   // bytes of live requests at that point
+};
+
+/** Replay the whole trace on a fresh Resource, measure only when asked to keep the timed pass clean */
+template <class Resource>
+void replay(const std::vector<Event> &events, std::size_t num_ids, Report &report, bool measure)
+{
+    Resource resource;
+    std::vector<void *> ptrs(num_ids, nullptr);
+    std::vector<std::uint32_t> sizes(num_ids, 0);
+    std::size_t live = 0;
+    std::size_t baseline = measure ? resident_bytes() : 0;
+
+    auto begin = hiclock::now();
+    for (std::size_t i = 0; i < events.size(); i++) {
+        const Event &event = events[i];
+        if (event.op == Op::allocate) {
+            ptrs[event.id] = resource.allocate(event.size);
+            sizes[event.id] = event.size;
+            live += event.size;
+        } else if (ptrs[event.id] != nullptr) {  // skip the deallocations whose allocation wasn't recorded
+            resource.deallocate(ptrs[event.id], event.size);
+            ptrs[event.id] = nullptr;
+            live -= event.size;
+        }
+
+        if (measure) {
+            if (resource.reserved() > report.peak_reserved) {
+                report.peak_reserved = resource.reserved();
+                report.live_at_peak = live;
+            }
+            if (i % 4096 == 0) report.peak_rss = std::max(report.peak_rss, resident_bytes() - std::min(baseline, resident_bytes()));
+        }
+    }
+    auto end = hiclock::now();
+    if (!measure) report.seconds = std::chrono::duration_cast<duration>(end - begin).count();
+
+    for (std::size_t id = 0; id < num_ids; id++) {  // whatever the program leaked goes back now
+        if (ptrs[id] != nullptr) resource.deallocate(ptrs[id], sizes[id]);
+    }
+}
+
+template <class Resource>
+void run(const std::vector<Event> &events, std::size_t num_ids)
+{
+    Report report;
+#if defined(__GLIBC__)
+    malloc_trim(0);  // hand back what the previous resource left in the heap, so that its pages don't hide our growth
+#endif
+    replay<Resource>(events, num_ids, report, true);   // the measured pass goes first, while the pages are still cold
+    replay<Resource>(events, num_ids, report, false);  // then the timed one
+
+    std::cout << std::left << std::setw(28) << Resource::name() << std::right << std::fixed
+              << std::setw(14) << std::setprecision(0) << events.size() / report.seconds
+              << std::setw(14) << std::setprecision(2) << report.peak_rss / 1048576.0
+              << std::setw(14) << report.peak_reserved / 1048576.0;
+    if (report.peak_reserved == 0)
+        std::cout << std::setw(14) << "-";
+    else
+        std::cout << std::setw(13) << 100.0 * (1.0 - double(report.live_at_peak) / report.peak_reserved) << "%";
+    std::cout << std::defaultfloat << std::endl;
+}
+
+/** Replay the trace on the size classes up to where the most bytes are live and analyze the fragmentation of their slabs there */
+void analyze(const std::vector<Event> &events, std::size_t num_ids)
+{
+    std::vector<std::uint32_t> sizes(num_ids, 0);
+    std::vector<bool> allocated(num_ids, false);
+    std::size_t live = 0, peak = 0, peak_at = 0;
+    for (std::size_t i = 0; i < events.size(); i++) {
+        const Event &event = events[i];
+        if (event.op == Op::allocate) {
+            allocated[event.id] = true;
+            live += event.size;
+        } else if (allocated[event.id]) {
+            allocated[event.id] = false;
+            live -= event.size;
+        }
+        if (live > peak) peak = live, peak_at = i + 1;
+    }
+
+    SizeClassPool resource;
+    std::vector<void *> ptrs(num_ids, nullptr);
+    for (std::size_t i = 0; i < peak_at; i++) {
+        const Event &event = events[i];
+        if (event.op == Op::allocate) {
+            ptrs[event.id] = resource.allocate(event.size);
+            sizes[event.id] = event.size;
+        } else if (ptrs[event.id] != nullptr) {
+            resource.deallocate(ptrs[event.id], event.size);
+            ptrs[event.id] = nullptr;
+        }
+    }
+
+    std::vector<std::uint32_t> live_sizes;
+    for (std::size_t id = 0; id < num_ids; id++) {
+        if (ptrs[id] != nullptr) live_sizes.push_back(sizes[id]);
+    }
+    mem::frag::Analyzer analyzer;
+    resource.analyze(analyzer, live_sizes);
+    std::cout << std::endl << SizeClassPool::name() << " at the peak of " << peak << " live bytes, after event " << peak_at << std::endl;
+    mem::frag::dump_text(std::cout, analyzer.report());
+
+    for (std::size_t id = 0; id < num_ids; id++) {
+        if (ptrs[id] != nullptr) resource.deallocate(ptrs[id], sizes[id]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool frag = argc == 3 && std::string(argv[2]) == "--frag";
+    if (argc != 2 && !frag) {
+        std::cerr << "Usage: " << argv[0] << " TRACE_FILE [--frag]" << std::endl;
+        return 1;
+    }
+
+    std::vector<Event> events;
+    try {
+        events = mem::trace::load(argv[1]);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::size_t num_ids = 0, threads = 0;
+    for (auto &event : events) {
+        num_ids = std::max<std::size_t>(num_ids, event.id + 1);
+        threads = std::max<std::size_t>(threads, event.thread + 1);
+    }
+    std::cout << "Replaying " << events.size() << " events of " << threads << " threads, merged in time order" << std::endl;
+
+    std::cout << std::left << std::setw(28) << "resource" << std::right
+              << std::setw(14) << "events/s"
+              << std::setw(14) << "peak RSS MiB"
+              << std::setw(14) << "held MiB"
+              << std::setw(14) << "fragmented" << std::endl;
+    run<NewDelete>(events, num_ids);
+    run<SizeClassPool>(events, num_ids);
+    run<MonoChain>(events, num_ids);
+    if (frag) analyze(events, num_ids);
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "scavenger.hpp"
+
+#include <algorithm>
+
+#if defined(__linux__)
+#include <sys/resource.h>  // to use setpriority
+#include <sys/syscall.h>   // to use SYS_gettid
+#include <unistd.h>        // to use syscall
+#endif
+
+using mem::Scavenger;
+
+Scavenger::Scavenger(Limits limits) : m_limits(limits)
+{
+    if (m_limits.interval.count() > 0) m_thread = std::thread(&Scavenger::run, this);
+}
+
+Scavenger::~Scavenger()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    if (m_thread.joinable()) m_thread.join();
+}
+
+std::size_t Scavenger::add(Source source)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sources.push_back({m_next_id, std::move(source)});
+    return m_next_id++;
+}
+
+std::size_t Scavenger::add(PoolMemory &pool, std::mutex &mutex)
+{
+    return add([&pool, &mutex](std::size_t max_bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pool.trim(max_bytes);
+    });
+}
+
+void Scavenger::remove(std::size_t id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);  // waits for a pass that may be trimming it
+    auto it = std::find_if(m_sources.begin(), m_sources.end(), [id](const Entry &entry) { return entry.id == id; });
+    if (it != m_sources.end()) m_sources.erase(it);
+}
+
+std::size_t Scavenger::run_once(std::size_t max_bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return pass(max_bytes);
+}
+
+std::size_t Scavenger::released()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_released;
+}
+
+std::size_t Scavenger::pass(std::size_t max_bytes)
+{
+    std::size_t released = 0;
+    for (std::size_t i = 0; i < m_sources.size() && released < max_bytes; i++) {
+        std::size_t index = (m_next_source + i) % m_sources.size();
+        released += m_sources[index].source(max_bytes - released);
+        if (released >= max_bytes) m_next_source = index + 1;  // the budget ran out here, the next pass starts after it
+    }
+    m_released += released;
+    return released;
+}
+
+void Scavenger::run()
+{
+#if defined(__linux__)
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);  // the nice value of just this thread, it's fine if we may not
+#endif
+
+    // a token bucket: the budget fills at bytes_per_second up to one second of it, and a pass spends what it released
+    const double rate = static_cast<double>(m_limits.bytes_per_second);
+    double budget = 0;
+    auto last = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_wake.wait_for(lock, m_limits.interval, [this] { return m_stop; })) {
+        auto now = std::chrono::steady_clock::now();
+        budget = std::min(rate, budget + rate * std::chrono::duration<double>(now - last).count());
+        last = now;
+        budget -= static_cast<double>(pass(static_cast<std::size_t>(budget)));
+    }
+}
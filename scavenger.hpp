@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "pool.hpp"
+
+namespace mem
+{
+/**
+ * Background Scavenger, gives the pages of idle pools back to the OS after a burst without destroying the pools
+ * A low priority thread wakes up every interval and trims the sources registered with it, a source being anything that
+ * can release up to a number of bytes and say how many it did, typically PoolMemory::trim() under the lock of its owner
+ * The thread releases no more than bytes_per_second on average, with bursts of up to one second of it, so that a
+ * service going idle for a moment doesn't page its whole heap out and fault it back in right after
+ * run_once() trims on demand, without the rate limit, and works without the thread too
+ */
+class Scavenger
+{
+   public:
+    using Source = std::function<std::size_t(std::size_t max_bytes)>;  // release up to max_bytes, return the bytes released
+
+    struct Limits {
+        std::chrono::milliseconds interval{100};  // between two passes of the thread
+        std::size_t bytes_per_second = 64 << 20;  // at most this much is released per second on average
+    };
+
+    // start the thread, or don't with an interval of zero
+    explicit Scavenger(Limits limits);
+    Scavenger() : Scavenger(Limits{}) {}
+
+    Scavenger(const Scavenger &scavenger) = delete;         // delete copy constructor
+    Scavenger &operator=(const Scavenger &rhs) = delete;    // delete copy-assignment operator
+    Scavenger(Scavenger &&scavenger) = delete;              // delete move constructor
+    Scavenger &operator=(Scavenger &&rhs) = delete;         // delete move-assignment operator
+
+    ~Scavenger();  // stop and join the thread
+
+    // register a source and return its id, the pool one trims the pool while it holds mutex, which every user of the pool has to hold too
+    std::size_t add(Source source);
+    std::size_t add(PoolMemory &pool, std::mutex &mutex);
+
+    // unregister a source, once it returns the source isn't being trimmed and never will be again
+    // it waits for a pass in progress, so it may not be called with the mutex of a pool source held
+    void remove(std::size_t id);
+
+    // trim the sources right away, up to max_bytes in total, and return the bytes released
+    std::size_t run_once(std::size_t max_bytes = SIZE_MAX);
+
+    std::size_t released();  // return the bytes released since construction, by the thread and by run_once()
+
+   private:
+    struct Entry {
+        std::size_t id;
+        Source source;
+    };
+
+    std::size_t pass(std::size_t max_bytes);  // trim every source in turn, with m_mutex held
+    void run();                               // the thread
+
+    Limits m_limits;
+    std::mutex m_mutex;  // guards everything below and is held during a pass
+    std::condition_variable m_wake;
+    std::vector<Entry> m_sources;
+    std::size_t m_next_id = 0;
+    std::size_t m_next_source = 0;  // where the next pass starts, so that a small budget doesn't always go to the first sources
+    std::size_t m_released = 0;
+    bool m_stop = false;
+    std::thread m_thread;  // last, so that it starts once the rest is constructed
+};
+}  // namespace mem
@@ -0,0 +1,183 @@
+#include "shared.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>     // to use O_* flags
+#include <sys/mman.h>  // to use shm_open, memfd_create and mmap
+#include <sys/stat.h>  // to use fstat
+#include <unistd.h>    // to use ftruncate and sysconf
+#define MEM_HAS_SHM
+#endif
+
+using mem::SharedPool;
+
+namespace
+{
+[[noreturn]] void fail(const std::string &name, const std::string &what) { throw std::runtime_error("shared pool " + name + ": " + what); }
+[[noreturn]] void fail_errno(const std::string &name, const char *call) { fail(name, std::string(call) + " failed, " + std::strerror(errno)); }
+
+std::size_t header_size()
+{
+#ifdef MEM_HAS_SHM
+    std::size_t page_sz = sysconf(_SC_PAGESIZE);
+#else
+    std::size_t page_sz = 4096;
+#endif
+    return (sizeof(SharedPool::Header) + page_sz - 1) / page_sz * page_sz;
+}
+}  // namespace
+
+std::size_t SharedPool::segment_size(std::size_t block_sz_bytes, std::size_t num_blocks) { return header_size() + block_sz_bytes * num_blocks; }
+
+#ifdef MEM_HAS_SHM
+SharedPool::SharedPool(const std::string &name, std::size_t block_sz_bytes, std::size_t num_blocks)
+    : m_pheader(nullptr), m_pdata(nullptr), m_map_size(0), m_fd(-1), m_is_mapped(true)
+{
+    m_fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (m_fd < 0) fail_errno(name, "shm_open");
+    if (::ftruncate(m_fd, segment_size(block_sz_bytes, num_blocks)) != 0) {
+        ::close(m_fd);
+        ::shm_unlink(name.c_str());
+        fail_errno(name, "ftruncate");
+    }
+    try {
+        map(segment_size(block_sz_bytes, num_blocks));
+    } catch (...) {
+        ::shm_unlink(name.c_str());  // the name is ours, a later create with it would fail with EEXIST
+        throw;
+    }
+    format(block_sz_bytes, num_blocks);
+}
+
+SharedPool::SharedPool(const std::string &name) : m_pheader(nullptr), m_pdata(nullptr), m_map_size(0), m_fd(-1), m_is_mapped(true)
+{
+    m_fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    if (m_fd < 0) fail_errno(name, "shm_open");
+    struct stat st;
+    if (::fstat(m_fd, &st) != 0 || std::size_t(st.st_size) < header_size()) {
+        ::close(m_fd);
+        fail(name, "isn't a shared pool yet");
+    }
+    map(st.st_size);
+    try {
+        attach();
+    } catch (...) {
+        ::munmap(m_pheader, m_map_size);
+        ::close(m_fd);
+        throw;
+    }
+}
+
+SharedPool::SharedPool(std::size_t block_sz_bytes, std::size_t num_blocks)
+    : m_pheader(nullptr), m_pdata(nullptr), m_map_size(0), m_fd(-1), m_is_mapped(true)
+{
+    std::size_t size = segment_size(block_sz_bytes, num_blocks);
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    m_fd = ::memfd_create("allocpool", MFD_CLOEXEC);  // an fd we can hand to unrelated processes too
+    if (m_fd < 0) fail_errno("(anonymous)", "memfd_create");
+    if (::ftruncate(m_fd, size) != 0) {
+        ::close(m_fd);
+        fail_errno("(anonymous)", "ftruncate");
+    }
+    map(size);
+#else
+    void *mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);  // shared with forked children only
+    if (mapping == MAP_FAILED) fail_errno("(anonymous)", "mmap");
+    m_pheader = static_cast<Header *>(mapping);
+    m_map_size = size;
+#endif
+    format(block_sz_bytes, num_blocks);
+}
+
+SharedPool::~SharedPool()
+{
+    if (m_is_mapped) ::munmap(m_pheader, m_map_size);
+    if (m_fd >= 0) ::close(m_fd);
+}
+
+void SharedPool::unlink(const std::string &name) { ::shm_unlink(name.c_str()); }
+
+void SharedPool::map(std::size_t size)
+{
+    void *mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (mapping == MAP_FAILED) {
+        ::close(m_fd);
+        fail_errno("segment", "mmap");
+    }
+    m_pheader = static_cast<Header *>(mapping);
+    m_map_size = size;
+}
+#else
+SharedPool::SharedPool(const std::string &name, std::size_t, std::size_t) { fail(name, "shared memory isn't available"); }
+SharedPool::SharedPool(const std::string &name) { fail(name, "shared memory isn't available"); }
+SharedPool::SharedPool(std::size_t, std::size_t) { fail("(anonymous)", "shared memory isn't available"); }
+SharedPool::~SharedPool() {}
+void SharedPool::unlink(const std::string &) {}
+void SharedPool::map(std::size_t) {}
+#endif  // MEM_HAS_SHM
+
+SharedPool::SharedPool(std::size_t block_sz_bytes, std::size_t num_blocks, std::byte *psegment)
+    : m_pheader(reinterpret_cast<Header *>(psegment)), m_pdata(nullptr), m_map_size(0), m_fd(-1), m_is_mapped(false)
+{
+    format(block_sz_bytes, num_blocks);
+}
+
+SharedPool::SharedPool(std::byte *psegment) : m_pheader(reinterpret_cast<Header *>(psegment)), m_pdata(nullptr), m_map_size(0), m_fd(-1), m_is_mapped(false)
+{
+    attach();
+}
+
+void SharedPool::format(std::size_t block_sz_bytes, std::size_t num_blocks)
+{
+    /** The links are 32-bit block indices, read atomically from the blocks */
+    assert(block_sz_bytes >= sizeof(std::uint32_t) && block_sz_bytes % alignof(std::uint32_t) == 0);
+    assert(num_blocks < 0xffffffff);
+
+    Header *header = new (m_pheader) Header;  // the atomics start their lifetime here
+    std::memcpy(header->magic, "MSHM", 4);
+    header->version = version;
+    header->block_sz_bytes = block_sz_bytes;
+    header->num_blocks = num_blocks;
+    header->data_offset = header_size();
+    header->head.store(0, std::memory_order_relaxed);
+    header->watermark.store(0, std::memory_order_relaxed);
+    header->ready.store(1, std::memory_order_release);  // whoever sees it sees the whole header
+
+    m_block_sz_bytes = block_sz_bytes;
+    m_total_num_blocks = num_blocks;
+    m_pdata = reinterpret_cast<std::byte *>(m_pheader) + header_size();
+}
+
+void SharedPool::attach()
+{
+    if (m_pheader->ready.load(std::memory_order_acquire) != 1) fail("segment", "isn't formatted yet");
+    if (std::memcmp(m_pheader->magic, "MSHM", 4) != 0 || m_pheader->version != version) fail("segment", "isn't a version " + std::to_string(version) + " shared pool");
+    if (m_map_size != 0 && m_map_size < m_pheader->data_offset + m_pheader->block_sz_bytes * m_pheader->num_blocks) fail("segment", "is truncated");
+
+    m_block_sz_bytes = m_pheader->block_sz_bytes;
+    m_total_num_blocks = m_pheader->num_blocks;
+    m_pdata = reinterpret_cast<std::byte *>(m_pheader) + m_pheader->data_offset;
+}
+
+std::size_t SharedPool::peak()
+{
+    std::uint64_t watermark = m_pheader->watermark.load(std::memory_order_relaxed);
+    return watermark < m_total_num_blocks ? watermark : m_total_num_blocks;
+}
+
+void SharedPool::free(void *pblock)
+{
+    if (pblock == nullptr) return;
+
+    std::uint64_t index = (static_cast<std::byte *>(pblock) - m_pdata) / m_block_sz_bytes;
+    std::uint64_t head = m_pheader->head.load(std::memory_order_relaxed);
+    do {
+        link_of(index).store(head & 0xffffffff, std::memory_order_relaxed);
+    } while (!m_pheader->head.compare_exchange_weak(head, pack((head >> 32) + 1, index + 1), std::memory_order_release, std::memory_order_relaxed));
+    stats::on_free(m_block_sz_bytes);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "pool.hpp"
+
+namespace mem
+{
+/**
+ * Shared Memory Pool Resource Declaration
+ * A pool of fixed size blocks that lives in a shared memory segment, so that processes can get and free each other's blocks
+ * Everything inside the segment is position independent: blocks are named by their offset and the free list links are
+ * block indices, so every process may map the segment at a different address (pass blocks around with offset_of() and at())
+ * The free list is a lock-free stack whose head carries a tag bumped on every change against ABA, carving works like PoolMemory
+ *
+ * Segment layout: a Header padded to a page, then num_blocks blocks of block_sz_bytes
+ * The segment is a named POSIX shared memory object, an anonymous one inherited by fork, or memory the caller provides
+ */
+class SharedPool
+{
+   public:
+    struct Header {
+        char magic[4];                 // "MSHM"
+        std::uint32_t version;         // bumped on every layout change
+        std::uint64_t block_sz_bytes;  // geometry of the pool
+        std::uint64_t num_blocks;
+        std::uint64_t data_offset;                         // where the first block starts in the segment
+        std::atomic<std::uint32_t> ready;                  // set once the creator has formatted the segment
+        alignas(64) std::atomic<std::uint64_t> head;       // tag << 32 | (index + 1) of the first free block, index + 1 is 0 if empty
+        alignas(64) std::atomic<std::uint64_t> watermark;  // number of blocks carved so far, may overshoot num_blocks
+    };
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "the shared free list needs lock-free 64-bit atomics");
+
+    static constexpr std::uint32_t version = 1;
+
+    // return the size in bytes of a segment that holds num_blocks blocks of block_sz_bytes
+    static std::size_t segment_size(std::size_t block_sz_bytes, std::size_t num_blocks);
+
+    // create the named shared memory object name (like "/my_pool"), throw std::runtime_error if it exists or on a system error
+    SharedPool(const std::string &name, std::size_t block_sz_bytes, std::size_t num_blocks);
+    // open the named shared memory object created by another process
+    explicit SharedPool(const std::string &name);
+    // create an anonymous segment, shared with the children forked after this and with whoever gets fd()
+    SharedPool(std::size_t block_sz_bytes, std::size_t num_blocks);
+    // format a new pool in segment_size(block_sz_bytes, num_blocks) bytes at psegment, or attach to the pool formatted there
+    SharedPool(std::size_t block_sz_bytes, std::size_t num_blocks, std::byte *psegment);
+    explicit SharedPool(std::byte *psegment);
+
+    SharedPool(const SharedPool &pool) = delete;            // delete copy constructor
+    SharedPool &operator=(const SharedPool &rhs) = delete;  // delete copy-assignment operator
+    SharedPool(SharedPool &&pool) = delete;                 // delete move constructor
+    SharedPool &operator=(SharedPool &&rhs) = delete;       // delete move-assignment operator
+
+    ~SharedPool();  // unmap the segment, the blocks stay for the other processes (see unlink())
+
+    std::size_t block_size() { return m_block_sz_bytes; }  // return block size in byte
+    std::size_t capacity() { return m_total_num_blocks; }  // return total number of blocks that this pool can hold
+    std::size_t peak();                                    // return the number of blocks carved so far, by every process
+    bool has_upper() { return m_fd < 0 && !m_is_mapped; }  // return whether the segment is memory the caller provided
+    int fd() { return m_fd; }                              // return the file descriptor of the segment, -1 if there is none
+
+    // convert between the addresses in this process and the offsets every process agrees on
+    std::uint64_t offset_of(const void *pblock) { return static_cast<const std::byte *>(pblock) - m_pdata; }
+    void *at(std::uint64_t offset) { return m_pdata + offset; }
+
+    // return a block, from any process' frees or never touched, throw std::bad_alloc or do what OomPolicy says if there is none
+    void *get() { return get<oom::Throw>(); }
+    template <class OomPolicy>
+    void *get();
+
+    // give back a block gotten by any process from this pool
+    void free(void *pblock);
+
+    // remove the name of a named segment, the memory goes away when the last process unmaps it
+    static void unlink(const std::string &name);
+
+   private:
+    void format(std::size_t block_sz_bytes, std::size_t num_blocks);  // write a new header into m_pheader
+    void attach();                                                    // check the header at m_pheader and take the geometry from it
+    void map(std::size_t size);                                       // map m_fd, close it and throw if that fails
+
+    static std::uint64_t pack(std::uint64_t tag, std::uint64_t link) { return tag << 32 | link; }
+    std::atomic_ref<std::uint32_t> link_of(std::uint64_t index)  // the next link stored in the first bytes of a free block
+    {
+        return std::atomic_ref<std::uint32_t>(*reinterpret_cast<std::uint32_t *>(m_pdata + index * m_block_sz_bytes));
+    }
+
+    Header *m_pheader;               // start of the segment
+    std::byte *m_pdata;              // first block
+    std::size_t m_block_sz_bytes;    // size in bytes of each block
+    std::size_t m_total_num_blocks;  // total number of blocks
+    std::size_t m_map_size;          // size in bytes of our mapping, 0 if we didn't map it
+    int m_fd;                        // the shared memory object, -1 for memory the caller provided
+    bool m_is_mapped;                // whether we've mapped the segment ourselves
+};
+
+/** Shared Memory Pool Resource Fast Path, inlined into the callers */
+template <class OomPolicy>
+void *SharedPool::get()
+{
+    std::uint64_t head = m_pheader->head.load(std::memory_order_acquire);
+    while ((head & 0xffffffff) != 0) MEM_LIKELY {
+        std::uint64_t index = (head & 0xffffffff) - 1;
+        // another process may pop this block and write into it before our CAS, the tag makes the CAS fail then
+        std::uint32_t next = link_of(index).load(std::memory_order_relaxed);
+        if (m_pheader->head.compare_exchange_weak(head, pack((head >> 32) + 1, next), std::memory_order_acquire, std::memory_order_acquire)) {
+            stats::on_get_block(m_block_sz_bytes, true);
+            return m_pdata + index * m_block_sz_bytes;
+        }
+    }
+
+    // the free list is empty, carve a never touched block after the watermark
+    std::uint64_t index = m_pheader->watermark.fetch_add(1, std::memory_order_relaxed);
+    if (index < m_total_num_blocks) MEM_LIKELY {
+        stats::on_get_block(m_block_sz_bytes, false);
+        return m_pdata + index * m_block_sz_bytes;
+    }
+    stats::on_fail();
+    return OomPolicy::exhausted(m_block_sz_bytes);
+}
+}  // namespace mem
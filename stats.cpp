@@ -0,0 +1,185 @@
+#include "stats.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace mem::stats;
+
+namespace
+{
+/** Every thread's counters, and the sum of the threads that have already exited */
+class Registry
+{
+   public:
+    static Registry &instance()
+    {
+        static Registry *registry = new Registry;  // never destroyed, threads may exit after the statics are gone
+        return *registry;
+    }
+
+    Counters *add()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threads.push_back(std::make_unique<Counters>());
+        return m_threads.back().get();
+    }
+
+    void remove(Counters *counters)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        accumulate(m_retired, *counters);
+        for (auto it = m_threads.begin(); it != m_threads.end(); ++it) {
+            if (it->get() == counters) {
+                m_threads.erase(it);
+                break;
+            }
+        }
+    }
+
+    Snapshot snapshot()
+    {
+        Snapshot result;
+        result.enabled = true;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_begin).count();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        add_to(result, m_retired);
+        for (auto &counters : m_threads) add_to(result, *counters);
+        return result;
+    }
+
+   private:
+    static void accumulate(Counters &into, const Counters &from)  // into is only touched under the lock
+    {
+        auto add = [](std::atomic<std::uint64_t> &lhs, const std::atomic<std::uint64_t> &rhs) { bump(lhs, rhs.load(std::memory_order_relaxed)); };
+        add(into.gets, from.gets);
+        add(into.frees, from.frees);
+        add(into.failed, from.failed);
+        add(into.bytes_got, from.bytes_got);
+        add(into.bytes_freed, from.bytes_freed);
+        add(into.slabs, from.slabs);
+        add(into.slab_bytes, from.slab_bytes);
+        add(into.resets, from.resets);
+        for (std::size_t i = 0; i < num_classes; i++) {
+            add(into.class_gets[i], from.class_gets[i]);
+            add(into.class_recycled[i], from.class_recycled[i]);
+        }
+    }
+
+    static void add_to(Snapshot &snapshot, const Counters &counters)
+    {
+        auto value = [](const std::atomic<std::uint64_t> &counter) { return counter.load(std::memory_order_relaxed); };
+        snapshot.gets += value(counters.gets);
+        snapshot.frees += value(counters.frees);
+        snapshot.failed += value(counters.failed);
+        snapshot.bytes_got += value(counters.bytes_got);
+        snapshot.bytes_freed += value(counters.bytes_freed);
+        snapshot.slabs += value(counters.slabs);
+        snapshot.slab_bytes += value(counters.slab_bytes);
+        snapshot.resets += value(counters.resets);
+        for (std::size_t i = 0; i < num_classes; i++) {
+            snapshot.classes[i].gets += value(counters.class_gets[i]);
+            snapshot.classes[i].recycled += value(counters.class_recycled[i]);
+        }
+    }
+
+    std::chrono::steady_clock::time_point m_begin = std::chrono::steady_clock::now();
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<Counters>> m_threads;
+    Counters m_retired;
+};
+
+/** Registers the thread's counters on first use and folds them into the retired ones when the thread exits */
+struct ThreadCounters {
+    ThreadCounters() : counters(Registry::instance().add()) {}
+    ~ThreadCounters() { Registry::instance().remove(counters); }
+    Counters *counters;
+};
+}  // namespace
+
+Counters &mem::stats::local()
+{
+    thread_local ThreadCounters thread_counters;
+    return *thread_counters.counters;
+}
+
+Snapshot mem::stats::snapshot()
+{
+#ifdef MEM_STATS
+    return Registry::instance().snapshot();
+#else
+    return Snapshot();
+#endif
+}
+
+Snapshot mem::stats::operator-(const Snapshot &later, const Snapshot &earlier)
+{
+    Snapshot result = later;
+    result.seconds -= earlier.seconds;
+    result.gets -= earlier.gets;
+    result.frees -= earlier.frees;
+    result.failed -= earlier.failed;
+    result.bytes_got -= earlier.bytes_got;
+    result.bytes_freed -= earlier.bytes_freed;
+    result.slabs -= earlier.slabs;
+    result.slab_bytes -= earlier.slab_bytes;
+    result.resets -= earlier.resets;
+    for (std::size_t i = 0; i < num_classes; i++) {
+        result.classes[i].gets -= earlier.classes[i].gets;
+        result.classes[i].recycled -= earlier.classes[i].recycled;
+    }
+    return result;
+}
+
+void mem::stats::dump_text(std::ostream &os, const Snapshot &snapshot)
+{
+    if (!snapshot.enabled) {
+        os << "Memory statistics are disabled, build with MEM_STATS defined" << std::endl;
+        return;
+    }
+
+    double seconds = snapshot.seconds > 0 ? snapshot.seconds : 1;
+    os << "Memory statistics over " << snapshot.seconds << " seconds" << std::endl;
+    os << "  gets:   " << snapshot.gets << " (" << snapshot.gets / seconds << "/s), " << snapshot.bytes_got << " bytes" << std::endl;
+    os << "  frees:  " << snapshot.frees << " (" << snapshot.frees / seconds << "/s), " << snapshot.bytes_freed << " bytes" << std::endl;
+    os << "  failed: " << snapshot.failed << std::endl;
+    os << "  in use: " << snapshot.in_use_bytes() << " bytes" << std::endl;
+    os << "  slabs:  " << snapshot.slabs << " of " << snapshot.slab_bytes << " bytes in total, " << snapshot.resets << " resets" << std::endl;
+    os << "  size class        gets    recycled  hit rate" << std::endl;
+    for (std::size_t i = 0; i < num_classes; i++) {
+        auto &size_class = snapshot.classes[i];
+        if (size_class.gets == 0) continue;
+        os << "  <= " << std::setw(10) << std::left << (std::size_t(1) << i) << std::right
+           << std::setw(10) << size_class.gets
+           << std::setw(12) << size_class.recycled
+           << std::setw(9) << std::fixed << std::setprecision(1) << 100.0 * size_class.recycled / size_class.gets << "%"
+           << std::defaultfloat << std::endl;
+    }
+}
+
+void mem::stats::dump_json(std::ostream &os, const Snapshot &snapshot)
+{
+    os << "{\"enabled\": " << (snapshot.enabled ? "true" : "false")
+       << ", \"seconds\": " << snapshot.seconds
+       << ", \"gets\": " << snapshot.gets
+       << ", \"frees\": " << snapshot.frees
+       << ", \"failed\": " << snapshot.failed
+       << ", \"bytes_got\": " << snapshot.bytes_got
+       << ", \"bytes_freed\": " << snapshot.bytes_freed
+       << ", \"in_use_bytes\": " << snapshot.in_use_bytes()
+       << ", \"slabs\": " << snapshot.slabs
+       << ", \"slab_bytes\": " << snapshot.slab_bytes
+       << ", \"resets\": " << snapshot.resets
+       << ", \"size_classes\": [";
+    bool first = true;
+    for (std::size_t i = 0; i < num_classes; i++) {
+        auto &size_class = snapshot.classes[i];
+        if (size_class.gets == 0) continue;
+        os << (first ? "" : ", ") << "{\"max_size\": " << (std::size_t(1) << i) << ", \"gets\": " << size_class.gets << ", \"recycled\": " << size_class.recycled << "}";
+        first = false;
+    }
+    os << "]}";
+}
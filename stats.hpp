@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace mem
+{
+namespace stats
+{
+/**
+ * Optional statistics of every memory resource, compiled in only when MEM_STATS is defined
+ * Each thread bumps its own relaxed counters without any read-modify-write, snapshot() adds them up on demand
+ * Without MEM_STATS the hooks are empty inline functions and snapshot() returns zeros
+ */
+constexpr std::size_t num_classes = 32;  // size class i holds the blocks of (2^(i-1), 2^i] bytes
+
+/** Return the size class of a block of size bytes */
+constexpr std::size_t class_of(std::size_t size)
+{
+    std::size_t index = size == 0 ? 0 : std::bit_width(size - 1);
+    return index < num_classes ? index : num_classes - 1;
+}
+
+struct Snapshot {
+    bool enabled = false;       // whether we're built with MEM_STATS, everything else is zero if not
+    double seconds = 0;         // since the first counter was touched
+    std::uint64_t gets = 0;     // successful get() on any resource
+    std::uint64_t frees = 0;    // free() on any resource
+    std::uint64_t failed = 0;   // get() that found the resource exhausted
+    std::uint64_t bytes_got = 0;
+    std::uint64_t bytes_freed = 0;
+    std::uint64_t slabs = 0;       // memory resources constructed, each is a slab growth event of its user
+    std::uint64_t slab_bytes = 0;  // bytes of memory those resources manage
+    std::uint64_t resets = 0;      // reset() of any resource
+    struct SizeClass {
+        std::uint64_t gets = 0;      // PoolMemory::get() of blocks in this class
+        std::uint64_t recycled = 0;  // of which were served from the free list instead of never touched memory
+    } classes[num_classes];
+
+    std::uint64_t in_use_bytes() const { return bytes_got - bytes_freed; }
+};
+
+/** Difference of two snapshots, for the rates over a time window */
+Snapshot operator-(const Snapshot &later, const Snapshot &earlier);
+
+// add up the counters of all threads, the living ones and the ones that have exited
+Snapshot snapshot();
+
+// print a snapshot as human readable text or as a JSON object
+void dump_text(std::ostream &os, const Snapshot &snapshot);
+void dump_json(std::ostream &os, const Snapshot &snapshot);
+
+/** Counters of a single thread, written only by that thread */
+struct Counters {
+    std::atomic<std::uint64_t> gets{0}, frees{0}, failed{0}, bytes_got{0}, bytes_freed{0}, slabs{0}, slab_bytes{0}, resets{0};
+    std::atomic<std::uint64_t> class_gets[num_classes] = {}, class_recycled[num_classes] = {};
+};
+
+Counters &local();  // the calling thread's counters, registered on first use
+
+/** Single writer, so a relaxed load and store is enough and avoids the locked instruction of fetch_add */
+inline void bump(std::atomic<std::uint64_t> &counter, std::uint64_t n = 1) { counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+/** Hooks called by the memory resources */
+#ifdef MEM_STATS
+inline void on_get(std::size_t bytes)
+{
+    Counters &counters = local();
+    bump(counters.gets);
+    bump(counters.bytes_got, bytes);
+}
+inline void on_get_block(std::size_t bytes, bool recycled)
+{
+    Counters &counters = local();
+    bump(counters.gets);
+    bump(counters.bytes_got, bytes);
+    std::size_t index = class_of(bytes);
+    bump(counters.class_gets[index]);
+    if (recycled) bump(counters.class_recycled[index]);
+}
+inline void on_free(std::size_t bytes)
+{
+    Counters &counters = local();
+    bump(counters.frees);
+    bump(counters.bytes_freed, bytes);
+}
+inline void on_fail() { bump(local().failed); }
+inline void on_slab(std::size_t bytes)
+{
+    Counters &counters = local();
+    bump(counters.slabs);
+    bump(counters.slab_bytes, bytes);
+}
+inline void on_reset(std::size_t bytes_in_use)
+{
+    Counters &counters = local();
+    bump(counters.resets);
+    bump(counters.bytes_freed, bytes_in_use);  // the blocks are all given back at once, not counted as frees
+}
+#else
+inline void on_get(std::size_t) {}
+inline void on_get_block(std::size_t, bool) {}
+inline void on_free(std::size_t) {}
+inline void on_fail() {}
+inline void on_slab(std::size_t) {}
+inline void on_reset(std::size_t) {}
+#endif  // MEM_STATS
+}  // namespace stats
+}  // namespace mem
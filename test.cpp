@@ -6,15 +6,18 @@
 #include <algorithm>  // to shuffle vector
 #include <bitset>     // to create arbitrarily sized type
 #include <chrono>     // to use high resolution clock
+#include <iostream>   // to print the results
 #include <random>     // to use random generator and random devices
 #include <ratio>      // to use with chrono
 #include <vector>
 
 #include "pool.hpp"
+#include "stats.hpp"
 /* clang-format off */
 // #define VERBOSE  // whether we're to silent everybody
 #define TEST_POOL  // are we test pool memory resource?
 #define TEST_MONO  // are we test monotonic memory resource?
+#define TEST_SLAB  // are we test pools laid out as aligned slabs?
 /* clang-format on */
 
 using hiclock = std::chrono::high_resolution_clock;
@@ -163,7 +166,7 @@ int main()
 
     std::uniform_int_distribution<std::size_t>
         dist(num_blocks - bias, num_blocks + bias);       // distribution to generate actual size
-    std::uniform_int_distribution<bool> tf(false, true);  // true false binary random generator
+    std::bernoulli_distribution tf;                      // true false binary random generator
     duration span = duration();                           // globally used time duration
 
     time_point begin;  // used in chrono timing
@@ -182,7 +185,7 @@ int main()
             end = hiclock::now();
         } else {
             std::cout << "[INFO] We're doing the allocation ahead of time" << std::endl;
-            ptr = new std::byte[actual_size];  // the deletion is at the end of the iteration
+            ptr = new std::byte[sizeof(type) * actual_size];  // the deletion is at the end of the iteration
             begin = hiclock::now();
             pmono = new mem::MonoMemory(sizeof(type) * actual_size, ptr);
             end = hiclock::now();
@@ -327,6 +330,7 @@ int main()
         } catch (const std::exception &e) {
             std::cerr << e.what() << '\n';
         }
+        std::cout << "Getting from a full pool with the Null policy gives: " << pool.get<mem::oom::Null>() << std::endl;  // should be a nullptr
 
         /** Returning all the memory exhausted before */
         span = duration();
@@ -341,7 +345,26 @@ int main()
             << " seconds per operations"
             << std::endl;
 
+        /** Get everything again from the free list the random frees shuffled, each block is a cache miss away from the last (see MEM_PREFETCH) */
+        span = duration();
+        for (auto i = 0; i < actual_size; i++) {
+            push_random(ptrs, pool, gen, span);
+        }
+        std::cout
+            << "It takes "
+            << span.count()
+            << " seconds to get this much times from the shuffled free list, which averages to "
+            << span.count() / actual_size
+            << " seconds per operations"
+            << std::endl;
+
+        duration untimed = duration();  // give everything back again, so that the phase below starts from an empty pool like before
+        for (auto i = 0; i < actual_size; i++) {
+            pop_random(ptrs, pool, gen, untimed);
+        }
+
         /** Test for some random allocation and deallocation requests, mixing up the order */
+        span = duration();
         for (auto i = 0; i < actual_size; i++) {
             if (tf(gen)) {
                 if (pool.full()) {
@@ -357,29 +380,97 @@ int main()
                 }
             }
         }
+        std::cout
+            << "It takes "
+            << span.count()
+            << " seconds to get and free in a random order this much times, which averages to "
+            << span.count() / actual_size
+            << " seconds per operations"
+            << std::endl;
 
         std::cout << "The pool's current size: " << pool.size() << std::endl;
         std::cout << "The ptrs's current size: " << ptrs.size() << std::endl;
 
-        /** Empty the whole memory pool if it's not currently empty */
-        if (!ptrs.empty()) {
-            std::size_t size = ptrs.size();  // we should memorize this since the size is changed every time we call pop or push
-            for (auto i = 0; i < size; i++) {
-#ifdef VERBOSE
-                std::cout << "Popping since not empty yet, index is: " << i << " size is: " << ptrs.size() << std::endl;
-#endif  // VERBOSE
+        std::cout << "Peak usage of this memory pool: " << pool.peak() << " blocks" << std::endl;
 
-                pop_random(ptrs, pool, gen, span);
-            }
-        }
+        /** Empty the whole memory pool at once instead of giving back the blocks one by one */
+        begin = hiclock::now();
+        pool.reset();
+        end = hiclock::now();
+        ptrs.clear();  // all the pointers are invalidated by the reset
+
+        std::cout
+            << "It takes "
+            << duration_cast<duration>(end - begin).count()
+            << " seconds to reset the memory pool"
+            << std::endl;
 
         std::cout << "Is the memory pool eventually empty? " << (pool.empty() ? "Yes" : "No") << std::endl;
+        std::cout << "Released " << pool.release_pages() << " bytes back to the OS" << std::endl;
 
         delete ppool;
         delete[] ptr;  // we might be deleting a nullptr
     }
 #endif  // TEST_POOL
 
+#ifdef TEST_SLAB
+    {
+        /** Spread blocks over several slabs and give them back through the pool their address masks to */
+        constexpr std::size_t slab_bytes = 64 * 1024;
+        std::vector<mem::PoolMemory *> slabs;
+        ptrs.clear();
+        for (int i = 0; i < 4; i++) {
+            mem::PoolMemory *pslab = mem::PoolMemory::make_slab(sizeof(std::bitset<256>), slab_bytes);
+            slabs.push_back(pslab);
+            while (!pslab->full()) ptrs.push_back(pslab->get());
+        }
+        std::cout << "Each slab of " << slab_bytes << " bytes holds " << slabs[0]->capacity() << " blocks" << std::endl;
+
+        std::shuffle(ptrs.begin(), ptrs.end(), gen);
+        std::size_t misrouted = 0;
+        span = duration();
+        begin = hiclock::now();
+        for (void *pblock : ptrs) {
+            mem::PoolMemory *pslab = mem::PoolMemory::slab_of(pblock, slab_bytes);
+            if (std::find(slabs.begin(), slabs.end(), pslab) == slabs.end() || !pslab->owns(pblock)) {
+                misrouted++;
+                continue;
+            }
+            pslab->free(pblock);
+        }
+        end = hiclock::now();
+        std::cout
+            << "It takes "
+            << duration_cast<duration>(end - begin).count() / ptrs.size()
+            << " seconds per free routed by the slab address"
+            << std::endl;
+
+        bool all_back = misrouted == 0;
+        for (mem::PoolMemory *pslab : slabs) {
+            all_back = all_back && pslab->empty();
+            mem::PoolMemory::destroy_slab(pslab, slab_bytes);
+        }
+        std::cout << "Did every block go back to its own slab? " << (all_back ? "Yes" : "No") << std::endl;
+        if (!all_back) return 1;
+    }
+#endif  // TEST_SLAB
+
+#ifdef MEM_STATS
+    /** A reset gives back the blocks in use once, not those other threads already freed */
+    {
+        std::uint64_t in_use = mem::stats::snapshot().in_use_bytes();
+        mem::PoolMemory pool(sizeof(type), 16);
+        std::vector<void *> blocks;
+        for (int i = 0; i < 4; i++) blocks.push_back(pool.get());
+        pool.remote_free(blocks[0]);
+        pool.remote_free(blocks[1]);
+        pool.reset();
+        bool counted_once = mem::stats::snapshot().in_use_bytes() == in_use;
+        std::cout << "Does a reset after remote frees count each block once? " << (counted_once ? "Yes" : "No") << std::endl;
+        if (!counted_once) return 1;
+    }
+#endif  // MEM_STATS
+
     /** Print more auxiliary information */
     std::cout << "Size of a type is: " << sizeof(type) << std::endl;
     std::cout << "Size of a bitset<128> is: " << sizeof(std::bitset<128>) << std::endl;
@@ -388,5 +479,8 @@ int main()
     std::cout << "Size of a bool is: " << sizeof(bool) << std::endl;
     std::cout << "Size of a PoolMemory is: " << sizeof(mem::PoolMemory) << std::endl;
     std::cout << "Size of a MonoMemory is: " << sizeof(mem::MonoMemory) << std::endl;
+#ifdef MEM_STATS
+    mem::stats::dump_text(std::cout, mem::stats::snapshot());
+#endif  // MEM_STATS
     std::cout << "Test is completed, bye." << std::endl;
 }
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "budget.hpp"
+#include "frame.hpp"
+#include "myAllocator.hpp"
+#include "test_check.hpp"
+#include "worker.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Test of Budget: the limits of a tree of budgets, the high watermark and shed callbacks, a WorkerHeap and a task group,
+ * a list of list::allocator and the frame cache of a thread running into their budgets, and threads charging the children
+ * of one root at once, which must never take it over
+ *
+ * Usage: test_budget
+ */
+
+void test_tree()
+{
+    mem::Budget root(1000);
+    mem::Budget left(600, &root), right(600, &root);
+
+    check(left.try_charge(500) && right.try_charge(400), "charges within every limit were refused");
+    check(!left.try_charge(200), "a charge over its own limit went through");
+    check(!right.try_charge(150), "a charge over the limit of the parent went through");
+    check(left.used() == 500 && right.used() == 400 && root.used() == 900, "a refused charge was left on a level");
+    check(right.refused() == 0 && root.refused() == 1, "the refusal was counted on the wrong level");
+
+    right.release(400);
+    check(right.try_charge(150) && root.used() == 650, "a charge didn't fit after a release");
+    check(root.peak() == 900, "the root's peak is " + std::to_string(root.peak()));
+    left.release(500);
+    right.release(150);
+    check(root.used() == 0, "the root still has " + std::to_string(root.used()) + " bytes after every release");
+}
+
+void test_callbacks()
+{
+    mem::Budget root(1000);
+    mem::Budget cache(SIZE_MAX, &root), work(SIZE_MAX, &root);
+
+    int highs = 0;
+    root.on_high(800, [&](mem::Budget &) { highs++; });
+    // the root sheds the cache when the work needs the room
+    std::size_t shed = 0;
+    root.on_limit([&](mem::Budget &, std::size_t bytes) {
+        std::size_t amount = std::min(cache.used(), bytes);
+        cache.release(amount);
+        shed += amount;
+    });
+
+    cache.charge(700);
+    check(highs == 0, "the high watermark fired below it");
+    work.charge(200);
+    check(highs == 1, "the high watermark didn't fire when it was crossed");
+    work.charge(50);
+    check(highs == 1, "the high watermark fired again without going below it first");
+
+    check(work.try_charge(300), "the charge failed although the cache could be shed");
+    check(shed == 300 && root.used() == 950, "the shed released " + std::to_string(shed) + " bytes");
+    check(highs == 2, "the high watermark didn't fire again after the shed took the root below it");
+    check(!work.try_charge(600), "a charge larger than what can be shed went through");
+
+    work.release(550);
+    cache.release(cache.used());
+    work.charge(800);
+    check(highs == 3, "the high watermark didn't fire on its last crossing");
+    work.release(800);
+}
+
+void test_worker_heap()
+{
+    constexpr std::size_t limit = 256 * 1024;
+    mem::Budget process(2 * limit);
+    mem::Budget budget(limit, &process);
+    {
+        mem::WorkerHeap heap(1, 64, &budget);
+        std::vector<void *> blocks;
+        bool refused = false;
+        try {
+            while (blocks.size() < 100000) blocks.push_back(heap.get(0, 64));
+        } catch (const std::bad_alloc &) {
+            refused = true;
+        }
+        std::cout << "[INFO] the heap got " << blocks.size() << " blocks in " << heap.pools(0) << " pools out of its budget of "
+                  << limit << " bytes" << std::endl;
+        check(refused, "the heap grew past its budget");
+        check(budget.used() <= limit, "the budget is over its limit with " + std::to_string(budget.used()) + " bytes");
+        check(heap.pools(0) > 5, "the class didn't fall back to small pools near the limit");
+
+        // the blocks already gotten go round without charging anything
+        std::size_t used = budget.used();
+        for (int round = 0; round < 3; round++) {
+            for (void *pblock : blocks) heap.free(0, pblock);
+            for (void *&pblock : blocks) pblock = heap.get(0, 64);
+        }
+        check(budget.used() == used, "recycling blocks changed the budget");
+        for (void *pblock : blocks) heap.free(0, pblock);
+
+        // a large block is charged and released on its own
+        std::size_t before = budget.used();
+        bool large_refused = false;
+        try {
+            heap.get(0, limit);
+        } catch (const std::bad_alloc &) {
+            large_refused = true;
+        }
+        check(large_refused && budget.used() == before, "a large block over the budget was handed out");
+
+        // the group is capped by a budget of its own, a sibling of the heap's
+        mem::Budget group_budget(4 * 4096, &process);
+        mem::WorkerHeap::Group group(heap, 4096, &group_budget);
+        std::size_t got = 0;
+        try {
+            while (got < 1000) group.get(0, 1024), got++;
+        } catch (const std::bad_alloc &) {
+        }
+        check(got == 16, "the group got " + std::to_string(got) + " KiB out of a budget of 16 KiB");
+        group.reset();
+        check(group_budget.used() == 4096, "the group's reset didn't release all but its first chunk");
+    }
+    check(process.used() == 0, "the heap and its group left " + std::to_string(process.used()) + " bytes charged");
+}
+
+void test_list()
+{
+    constexpr std::size_t limit = 64 * 1024;
+    mem::Budget process(2 * limit);
+    mem::Budget budget(limit, &process);
+    {
+        std::list<std::uint64_t, list::allocator<std::uint64_t>> values{list::allocator<std::uint64_t>(&budget)};
+        bool refused = false;
+        try {
+            while (values.size() < 100000) values.push_back(values.size());
+        } catch (const std::bad_alloc &) {
+            refused = true;
+        }
+        std::cout << "[INFO] the list got " << values.size() << " nodes out of its budget of " << limit << " bytes" << std::endl;
+        check(refused, "the list grew past its budget");
+        check(budget.used() <= limit && budget.used() > limit / 2, "the list charged " + std::to_string(budget.used()) + " bytes to its budget");
+
+        // the nodes already gotten go round without charging anything
+        std::size_t used = budget.used(), size = values.size();
+        for (int round = 0; round < 3; round++) {
+            values.clear();
+            while (values.size() < size) values.push_back(values.size());
+        }
+        check(budget.used() == used, "recycling nodes changed the budget");
+    }
+    check(process.used() == 0, "the list left " + std::to_string(process.used()) + " bytes charged");
+}
+
+void test_frames()
+{
+    constexpr std::size_t limit = 64 * 1024;
+    mem::Budget budget(limit);
+    mem::frame::set_budget(&budget);
+    std::size_t got = 0;
+    bool refused = false;
+    std::thread thread([&] {
+        std::vector<void *> frames;
+        try {
+            while (frames.size() < 100000) frames.push_back(mem::frame::allocate(200));
+        } catch (const std::bad_alloc &) {
+            refused = true;
+        }
+        got = frames.size();
+        for (void *pframe : frames) mem::frame::deallocate(pframe);
+    });
+    thread.join();
+    mem::frame::set_budget(nullptr);
+
+    std::cout << "[INFO] the frame cache got " << got << " frames out of its budget of " << limit << " bytes" << std::endl;
+    check(refused && got > 0, "the frame cache grew past its budget");
+    check(budget.peak() <= limit, "the budget of the frames went over its limit");
+    check(budget.used() == 0, "the exited thread's cache left " + std::to_string(budget.used()) + " bytes charged");
+
+    // the frames too large for the classes come from operator new, they're charged one by one
+    got = 0;
+    refused = false;
+    mem::frame::set_budget(&budget);
+    std::thread large([&] {
+        std::vector<void *> frames;
+        try {
+            while (frames.size() < 1000) frames.push_back(mem::frame::allocate(mem::frame::max_size * 2));
+        } catch (const std::bad_alloc &) {
+            refused = true;
+        }
+        got = frames.size();
+        for (void *pframe : frames) mem::frame::deallocate(pframe);
+        check(budget.used() == 0, "the large frames left " + std::to_string(budget.used()) + " bytes charged");
+    });
+    large.join();
+    mem::frame::set_budget(nullptr);
+
+    std::cout << "[INFO] the frame cache got " << got << " large frames out of its budget of " << limit << " bytes" << std::endl;
+    check(refused && got == limit / (mem::frame::max_size * 2), "the large frames grew past their budget");
+    check(budget.peak() <= limit, "the budget of the large frames went over its limit");
+}
+
+void test_threads()
+{
+    constexpr std::size_t limit = 1 << 20;
+    mem::Budget root(limit);
+    std::vector<std::unique_ptr<mem::Budget>> children;
+    for (int i = 0; i < 4; i++) children.push_back(std::make_unique<mem::Budget>(limit / 2, &root));
+
+    std::atomic<std::uint64_t> granted{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            mem::Budget &budget = *children[t];
+            std::vector<std::size_t> held;
+            std::uint32_t state = 12345 + t;
+            for (int i = 0; i < 20000; i++) {
+                state ^= state << 13, state ^= state >> 17, state ^= state << 5;
+                std::size_t bytes = 4096 * (1 + state % 16);
+                if (state % 3 != 0 && budget.try_charge(bytes)) {
+                    held.push_back(bytes);
+                    granted.fetch_add(1, std::memory_order_relaxed);
+                } else if (!held.empty()) {
+                    budget.release(held.back());
+                    held.pop_back();
+                }
+            }
+            for (std::size_t bytes : held) budget.release(bytes);
+        });
+    }
+    for (auto &thread : threads) thread.join();
+
+    std::cout << "[INFO] " << granted << " charges were granted, " << root.refused() << " refused by the root, its peak was "
+              << root.peak() << " bytes" << std::endl;
+    check(root.peak() <= limit, "the root went over its limit");
+    check(root.used() == 0, "the root has " + std::to_string(root.used()) + " bytes left after every thread released its own");
+    for (auto &child : children) check(child->used() == 0 && child->peak() <= limit / 2, "a child is unbalanced or went over its limit");
+}
+
+int main()
+{
+    test_tree();
+    test_callbacks();
+    test_worker_heap();
+    test_list();
+    test_frames();
+    test_threads();
+
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " budget" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
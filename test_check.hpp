@@ -0,0 +1,15 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+/** The checks of the test programs: a failed one is printed and counted, main() returns non zero if any failed */
+inline int failures = 0;
+
+inline void check(bool condition, const std::string &what)
+{
+    if (!condition) {
+        std::cout << "[FAILED] " << what << std::endl;
+        failures++;
+    }
+}
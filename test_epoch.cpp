@@ -0,0 +1,169 @@
+#include "epoch.hpp"
+#include "test_check.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Test of EpochDomain: threads push and pop the nodes of a lock-free stack, each node gotten from the pool of the
+ * pushing thread and retired by the popping one, while they also walk the stack. A node freed too early gets the free
+ * list link written over its key, which the walkers and the poppers catch
+ *
+ * Usage: test_epoch [ITERATIONS_PER_THREAD]
+ */
+
+constexpr int num_threads = 4;
+constexpr std::size_t num_blocks = 4096;
+
+struct Node {
+    std::uint64_t key;  // first, the free list link of a freed node lands here
+    std::uint64_t check;
+    Node *next;
+    mem::PoolMemory *pool;  // pool of the pushing thread, the node goes back there
+};
+
+std::uint64_t checksum(std::uint64_t key) { return key * 0x9e3779b97f4a7c15 + 1; }
+
+/** A Treiber stack whose popped nodes are retired into the epoch domain */
+struct Stack {
+    std::atomic<Node *> head{nullptr};
+    std::atomic<std::uint64_t> errors{0};
+
+    void push(Node *node)
+    {
+        node->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    bool pop(mem::EpochDomain::Handle &handle)
+    {
+        auto guard = handle.guard();
+        Node *node = head.load(std::memory_order_acquire);
+        while (node != nullptr && !head.compare_exchange_weak(node, node->next, std::memory_order_acquire, std::memory_order_acquire)) {
+        }
+        if (node == nullptr) return false;
+        if (node->check != checksum(node->key)) errors.fetch_add(1, std::memory_order_relaxed);
+        handle.retire(*node->pool, node);  // the other threads may still be reading it
+        return true;
+    }
+
+    void walk(mem::EpochDomain::Handle &handle, int max_nodes)
+    {
+        auto guard = handle.guard();
+        Node *node = head.load(std::memory_order_acquire);
+        for (int i = 0; i < max_nodes && node != nullptr; i++, node = node->next)
+            if (node->check != checksum(node->key)) errors.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+/** A node is only retired, and later freed, once nobody is pinned in the epoch it was retired in */
+void test_grace_period()
+{
+    mem::EpochDomain domain;
+    mem::PoolMemory pool(sizeof(Node), 16);
+    auto reader = domain.join();
+    auto writer = domain.join();
+
+    void *pblock = pool.get();
+    reader.pin();
+    writer.retire(pool, pblock);
+    for (int i = 0; i < 10; i++) writer.flush();
+    check(pool.reclaim() == 0 && writer.pending() == 1, "a block was freed while a reader was pinned");
+
+    reader.unpin();
+    for (int i = 0; i < 3; i++) writer.flush();
+    check(pool.reclaim() == 1 && writer.pending() == 0, "a block wasn't freed after its grace period");
+    check(pool.free_count() == pool.capacity(), "the pool after the grace period");
+}
+
+/** The blocks of threads that left are freed by epoch, whatever the order the threads left in */
+void test_orphans()
+{
+    mem::EpochDomain domain;
+    mem::PoolMemory pool(sizeof(Node), 16);
+    auto flusher = domain.join();
+    {
+        auto old = domain.join();
+        old.retire(pool, pool.get());
+        for (int i = 0; i < 3; i++) flusher.flush();
+        {
+            auto young = domain.join();
+            young.retire(pool, pool.get());
+        }  // leaves first with the younger block
+    }
+
+    flusher.flush();
+    check(pool.reclaim() == 1, "the older orphan waited behind the younger one");
+    for (int i = 0; i < 2; i++) flusher.flush();
+    check(pool.reclaim() == 1 && pool.free_count() == pool.capacity(), "the younger orphan wasn't freed after its grace period");
+}
+
+void test_concurrent(std::uint64_t num_iterations)
+{
+    std::vector<std::unique_ptr<mem::PoolMemory>> pools;
+    for (int i = 0; i < num_threads; i++) pools.push_back(std::make_unique<mem::PoolMemory>(sizeof(Node), num_blocks));
+
+    Stack stack;
+    {
+        mem::EpochDomain domain;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&, t] {
+                auto handle = domain.join();
+                mem::PoolMemory &pool = *pools[t];
+                for (std::uint64_t i = 0; i < num_iterations; i++) {
+                    for (int j = 0; j < 2; j++) {
+                        void *pblock;
+                        while ((pblock = pool.get<mem::oom::Null>()) == nullptr) {  // ours are waiting on the retire lists
+                            handle.flush();
+                            std::this_thread::yield();
+                        }
+                        auto node = static_cast<Node *>(pblock);
+                        node->key = std::uint64_t(t) << 48 | (i * 2 + j);
+                        node->check = checksum(node->key);
+                        node->pool = &pool;
+                        stack.push(node);
+                    }
+                    stack.pop(handle);
+                    stack.pop(handle);
+                    if (i % 8 == 0) stack.walk(handle, 16);
+                }
+            });
+        }
+        for (auto &thread : threads) thread.join();
+        std::cout << "[INFO] " << num_threads << " threads ran " << num_iterations << " iterations each, the epoch reached " << domain.epoch()
+                  << std::endl;
+
+        // what's left on the stack goes back directly, nobody reads it anymore
+        for (Node *node = stack.head.load(); node != nullptr;) {
+            Node *next = node->next;
+            node->pool->free(node);
+            node = next;
+        }
+    }  // the domain frees what the threads left retired
+
+    check(stack.errors == 0, std::to_string(stack.errors.load()) + " nodes were read after they were freed");
+    for (auto &pool : pools) {
+        pool->reclaim();
+        check(pool->free_count() == pool->capacity(), "a pool lost " + std::to_string(pool->capacity() - pool->free_count()) + " blocks");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::uint64_t num_iterations = argc > 1 ? std::atoll(argv[1]) : 200000;
+
+    test_grace_period();
+    test_orphans();
+    test_concurrent(num_iterations);
+
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " epoch reclamation" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+#include "frag.hpp"
+#include "test_check.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Test of the fragmentation analyzer: a pool with pages full, empty, nearly empty and half used must show up in the
+ * right occupancy buckets before and after a trim, sparse slabs must strand their free bytes while empty ones don't,
+ * and the size classes of a WorkerHeap must report the internal fragmentation of the requests they served
+ *
+ * Usage: test_frag
+ */
+
+constexpr std::size_t page_sz = 4096;
+constexpr std::size_t block_sz = 64;
+constexpr std::size_t per_page = page_sz / block_sz;
+
+void test_pages()
+{
+    constexpr std::size_t num_pages = 64;
+    auto pmemory = static_cast<std::byte *>(std::aligned_alloc(page_sz, num_pages * page_sz));
+    {
+        mem::PoolMemory pool(block_sz, num_pages * per_page, pmemory);
+        std::vector<void *> blocks;
+        while (void *pblock = pool.get<mem::oom::Null>()) blocks.push_back(pblock);
+
+        // pages 0-15 stay full, 16-31 are emptied, 32-47 keep one block and 48-63 keep every other one
+        for (std::size_t i = 16 * per_page; i < blocks.size(); i++) {
+            std::size_t page = i / per_page, in_page = i % per_page;
+            if (page < 32 || (page < 48 && in_page != 0) || (page >= 48 && in_page % 2 == 1)) pool.free(blocks[i]);
+        }
+
+        mem::frag::Analyzer analyzer;
+        analyzer.add(pool);
+        mem::frag::Report report = analyzer.report();
+        if (report.page_size != page_sz) {
+            std::cout << "[INFO] pages of " << report.page_size << " bytes, skipping the page counts" << std::endl;
+            return;
+        }
+        const mem::frag::Occupancy &pages = report.pages;
+        check(pages.full == 16 && pages.empty == 16 && pages.partial[0] == 16 && pages.partial[4] == 16 && pages.untouched == 0,
+              "the pages are in the wrong buckets");
+        check(report.slabs.size() == 1 && report.slabs[0].map.substr(0, 17) == std::string(16, '#') + "." && report.slabs[0].map.back() == '4',
+              "the map of the slab is " + report.slabs[0].map);
+        std::size_t used = 16 * per_page + 16 + 16 * per_page / 2;
+        check(report.used_bytes == used * block_sz && report.free_bytes == (blocks.size() - used) * block_sz, "the bytes in use and free are off");
+
+        // trimming releases the empty pages but their blocks are still free
+        pool.trim();
+        mem::frag::Analyzer trimmed;
+        trimmed.add(pool);
+        check(trimmed.report().slabs[0].map == report.slabs[0].map, "the trimmed blocks aren't counted free");
+
+        // a block another thread gave back is free once the analyzer reclaimed it
+        std::thread([&] { pool.remote_free(blocks[0]); }).join();
+        mem::frag::Analyzer reclaimed;
+        reclaimed.add(pool);
+        check(reclaimed.report().slabs[0].used == used - 1, "a remote free wasn't counted");
+    }
+    {
+        mem::PoolMemory pool(block_sz, num_pages * per_page, pmemory);
+        for (std::size_t i = 0; i < 16 * per_page; i++) pool.get();
+        mem::frag::Analyzer analyzer;
+        analyzer.add(pool);
+        mem::frag::Report report = analyzer.report();
+        check(report.pages.full == 16 && report.pages.untouched == 48, "the never touched tail isn't told apart");
+        check(report.free_bytes == 0, "the never touched blocks count as free memory");
+    }
+    std::free(pmemory);
+}
+
+void test_slabs()
+{
+    constexpr std::size_t capacity = 1024;
+    mem::PoolMemory full(block_sz, capacity), sparse(block_sz, capacity), empty(block_sz, capacity);
+    std::vector<void *> blocks;
+    for (std::size_t i = 0; i < capacity; i++) full.get(), blocks.push_back(sparse.get()), empty.get();
+    for (std::size_t i = 0; i < capacity; i++) {
+        if (i % 10 != 0) sparse.free(blocks[i]);
+        empty.free(empty.block(i));  // every block of the empty slab was touched
+    }
+
+    mem::frag::Analyzer analyzer(0.25);
+    analyzer.add(full, "full");
+    analyzer.add(sparse, "sparse");
+    analyzer.add(empty, "\"empty\"\\\n");  // a JSON writer has to escape it
+    mem::frag::Report report = analyzer.report();
+
+    std::size_t sparse_used = (capacity + 9) / 10;
+    std::size_t sparse_free = (capacity - sparse_used) * block_sz;
+    check(report.stranded_bytes == sparse_free, "stranded " + std::to_string(report.stranded_bytes) + " bytes instead of the sparse slab's " + std::to_string(sparse_free));
+    check(report.free_bytes == sparse_free + capacity * block_sz, "the free bytes of the empty slab are missing");
+    check(report.classes.size() == 1 && report.classes[0].packed_slabs == 2, "the blocks in use don't pack into two slabs");
+    double external = report.external();
+    check(external > 0.4 && external < 0.5, "the external fragmentation is " + std::to_string(external));
+
+    std::ostringstream text, json;
+    mem::frag::dump_text(text, report);
+    mem::frag::dump_json(json, report);
+    check(text.str().find("%), sparse\n") != std::string::npos, "the text report doesn't flag the sparse slab");
+    check(json.str().rfind("{\"page_size\": ", 0) == 0 && json.str().back() == '}', "the JSON report isn't an object");
+    check(json.str().find("\"label\": \"\\\"empty\\\"\\\\\\u000a\"") != std::string::npos, "the JSON report doesn't escape the labels");
+}
+
+void test_worker_heap()
+{
+    mem::WorkerHeap heap(1, 256);
+    mem::frag::Analyzer analyzer;
+    std::vector<void *> blocks;
+    for (std::size_t size : {24, 100}) {
+        for (int i = 0; i < 1000; i++) blocks.push_back(heap.get(0, size));
+        analyzer.request(size, mem::WorkerHeap::block_size(size), 1000);
+    }
+    for (std::size_t i = 0; i < blocks.size(); i += 2) heap.free(0, blocks[i]);
+
+    analyzer.add(heap, 0);
+    mem::frag::Report report = analyzer.report();
+    std::cout << "[INFO] the heap" << std::endl;
+    mem::frag::dump_text(std::cout, report, false);
+
+    check(report.classes.size() == 2, "the heap has " + std::to_string(report.classes.size()) + " classes instead of two");
+    if (report.classes.size() != 2) return;
+    const mem::frag::Class &small = report.classes[0], &large = report.classes[1];
+    check(small.block_size == mem::WorkerHeap::block_size(24) && large.block_size == mem::WorkerHeap::block_size(100), "the classes have the wrong block sizes");
+    check(small.used == 500 && large.used == 500, "the classes don't have half their blocks in use");
+    check(small.slabs == heap.pools(0) / 2 && small.slabs >= 2, "the small class has " + std::to_string(small.slabs) + " slabs");
+    // 24 bytes of 48 with the header, 100 of 144
+    check(std::abs(small.internal() - 0.5) < 1e-9 && std::abs(large.internal() - (1 - 100.0 / 144)) < 1e-9, "the internal fragmentation is off");
+
+    for (std::size_t i = 1; i < blocks.size(); i += 2) heap.free(0, blocks[i]);
+}
+
+int main()
+{
+    test_pages();
+    test_slabs();
+    test_worker_heap();
+
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " frag" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
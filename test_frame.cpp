@@ -0,0 +1,127 @@
+#include "frame.hpp"
+#include "test_check.hpp"
+
+#include <coroutine>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Test of the pooled coroutine frames: start coroutines of several frame sizes, finish some of them on the thread that
+ * started them and the others on another thread, and check that every frame goes back to the cache it came from
+ */
+
+/** A lazy coroutine returning a number, its frame comes from the pools */
+class Task
+{
+   public:
+    struct promise_type : mem::PooledFrame {
+        std::uint64_t value = 0;
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(std::uint64_t v) { value = v; }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+    Task(Task &&task) noexcept : m_handle(std::exchange(task.m_handle, nullptr)) {}
+    Task(const Task &task) = delete;
+    ~Task()
+    {
+        if (m_handle) m_handle.destroy();
+    }
+
+    std::uint64_t run()
+    {
+        while (!m_handle.done()) m_handle.resume();
+        return m_handle.promise().value;
+    }
+
+   private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+Task small(std::uint64_t n)
+{
+    co_await std::suspend_always{};
+    co_return n * 3;
+}
+
+template <std::size_t Size>
+Task sized(std::uint64_t n)
+{
+    volatile unsigned char buffer[Size];  // lives across the suspension, so it's in the frame
+    buffer[0] = static_cast<unsigned char>(n);
+    co_await std::suspend_always{};
+    co_return n + buffer[0];
+}
+
+std::uint64_t expected(std::size_t kind, std::uint64_t n) { return kind == 0 ? n * 3 : n + static_cast<unsigned char>(n); }
+
+int main()
+{
+    constexpr std::size_t num_tasks = 3000;
+
+    std::vector<Task> tasks;
+    for (std::uint64_t n = 0; n < num_tasks; n++) {
+        switch (n % 3) {
+            case 0: tasks.push_back(small(n)); break;
+            case 1: tasks.push_back(sized<300>(n)); break;
+            default: tasks.push_back(sized<3000>(n)); break;
+        }
+    }
+    check(mem::frame::in_use() == num_tasks, "started " + std::to_string(num_tasks) + " coroutines, " + std::to_string(mem::frame::in_use()) + " frames are in use");
+
+    // a huge frame goes around the pools
+    {
+        Task huge = sized<10000>(7);
+        check(huge.run() == expected(1, 7), "the coroutine with a huge frame");
+        check(mem::frame::in_use() == num_tasks, "a huge frame came from the pools");
+    }
+
+    // half of them finish here, the others on another thread, whose frees are remote
+    std::vector<Task> moved;
+    for (std::size_t i = num_tasks / 2; i < num_tasks; i++) moved.push_back(std::move(tasks[i]));
+    while (tasks.size() > num_tasks / 2) tasks.pop_back();  // moved from
+
+    std::uint64_t errors = 0;
+    for (std::uint64_t n = 0; n < tasks.size(); n++) errors += tasks[n].run() != expected(n % 3 == 0 ? 0 : 1, n);
+    tasks.clear();
+    check(mem::frame::in_use() == num_tasks - num_tasks / 2, "the frames of the coroutines finished here aren't back");
+
+    std::thread other([&moved, &errors] {
+        for (std::uint64_t i = 0; i < moved.size(); i++) {
+            std::uint64_t n = num_tasks / 2 + i;
+            errors += moved[i].run() != expected(n % 3 == 0 ? 0 : 1, n);
+        }
+        moved.clear();
+        check(mem::frame::t_cache == nullptr, "destroying frames gave the other thread a cache");
+    });
+    other.join();
+    check(errors == 0, std::to_string(errors) + " coroutines returned a wrong value");
+    check(mem::frame::in_use() == 0, "the frames destroyed by the other thread aren't back");
+
+    // the pools are reused rather than grown again
+    for (std::uint64_t n = 0; n < num_tasks; n++) tasks.push_back(small(n));
+    check(mem::frame::in_use() == num_tasks, "the second round of coroutines");
+    tasks.clear();
+
+    // operator new of a promise has to return memory aligned like the default operator new, the canaries included
+    std::vector<void *> frames;
+    for (std::size_t size = 1; size <= mem::frame::max_size * 2; size = size * 3 / 2 + 1) {
+        for (int i = 0; i < 3; i++) {
+            void *pframe = mem::frame::allocate(size);
+            check(reinterpret_cast<std::uintptr_t>(pframe) % __STDCPP_DEFAULT_NEW_ALIGNMENT__ == 0, "a frame of " + std::to_string(size) + " bytes is misaligned");
+            frames.push_back(pframe);
+        }
+    }
+    for (void *pframe : frames) mem::frame::deallocate(pframe);
+    check(mem::frame::in_use() == 0, "the frames of the alignment check aren't back");
+
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " coroutine frames" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
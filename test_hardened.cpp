@@ -0,0 +1,101 @@
+#include "pool.hpp"
+#include "test_check.hpp"
+
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#include <sys/wait.h>  // to use waitpid
+#include <unistd.h>    // to use fork and pipe
+
+/**
+ * Test of the hardened mode of PoolMemory, only built with ALLOCPOOL_HARDENED: every misuse is made in a child of its own,
+ * which has to abort with the message of its check, so that a check turned into a no-op fails here
+ *
+ * Usage: test_hardened
+ */
+
+constexpr std::size_t block_sz = 32;
+constexpr std::size_t num_blocks = 64;
+
+/** Run misuse in a child on a pool of its own, check that it aborts and that its stderr names what went wrong */
+void expect_abort(const std::string &name, const std::string &message, const std::function<void(mem::PoolMemory &pool)> &misuse)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        check(false, name + ": pipe failed");
+        return;
+    }
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDERR_FILENO);
+        mem::PoolMemory pool(block_sz, num_blocks);
+        misuse(pool);
+        _exit(0);  // not caught
+    }
+    close(fds[1]);
+    std::string output;
+    char buffer[256];
+    for (ssize_t n; (n = read(fds[0], buffer, sizeof(buffer))) > 0;) output.append(buffer, n);
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    bool aborted = WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+    check(aborted, name + " isn't caught");
+    check(!aborted || output.find(message) != std::string::npos, name + " is caught with the wrong message: " + output);
+    if (aborted) std::cout << "[INFO] " << name << ": " << output.substr(0, output.find('\n')) << std::endl;
+}
+
+int main()
+{
+    expect_abort("a foreign free", "foreign free", [](mem::PoolMemory &pool) {
+        static std::uint64_t foreign[block_sz / sizeof(std::uint64_t)];
+        pool.get();
+        pool.free(foreign);
+    });
+    expect_abort("a free of the middle of a block", "isn't the start of a block", [](mem::PoolMemory &pool) {
+        auto pblock = static_cast<std::byte *>(pool.get());
+        pool.free(pblock + 8);
+    });
+    expect_abort("a free of a block never handed out", "never handed out", [](mem::PoolMemory &pool) {
+        pool.get();
+        pool.free(pool.block(num_blocks - 1));
+    });
+    expect_abort("a double free", "double free", [](mem::PoolMemory &pool) {
+        void *pblock = pool.get();
+        pool.free(pblock);
+        pool.free(pblock);
+    });
+    expect_abort("a write after free", "use after free", [](mem::PoolMemory &pool) {
+        auto pblock = static_cast<unsigned char *>(pool.get());
+        pool.free(pblock);
+        pblock[block_sz - 1] = 0;
+        pool.get();
+    });
+    expect_abort("a forged free list link", "corrupted free list link", [](mem::PoolMemory &pool) {
+        void *first = pool.get();
+        void *second = pool.get();
+        pool.free(first);
+        pool.free(second);  // the head, its link leads to first
+        std::uintptr_t forged = 0x1234;
+        std::memcpy(second, &forged, sizeof(forged));
+        pool.get();
+    });
+#ifdef MEM_HARDENED_CANARY
+    expect_abort("an overflow into the canary", "buffer overflow", [](mem::PoolMemory &pool) {
+        auto pblock = static_cast<unsigned char *>(pool.get());
+        pblock[block_sz] = 0;  // the first byte after the block
+        pool.free(pblock);
+    });
+#endif
+
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " hardened pool" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
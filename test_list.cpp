@@ -1,4 +1,6 @@
 #include "myAllocator.hpp"
+#include "test_check.hpp"
+#include <cstdlib>
 #include <iostream>
 #include <memory>
 #include <list>
@@ -6,11 +8,16 @@
 #include <chrono>
 #include <ratio>
 
-const int TestSize = 20000;     // total size for test list.
+int TestSize = 20000;           // total size for test list, can be overridden by the first argument.
 const int PickSize = 1000;      // the number to be test from back of list.
 
+#ifdef MEM_TEST_STD_ALLOCATOR
+template <class T>
+using MyAllocator = std::allocator<T>;  // the baseline, to compare the whole process allocators of preload.cpp with
+#else
 template <class T>
 using MyAllocator = list::allocator<T>;  // replace the std::allocator with my allocator
+#endif
 using Point2D = std::pair<int, int>;
 using type_name = char;
 using T_Vec = std::list<type_name, MyAllocator<type_name>>;
@@ -22,7 +29,8 @@ using std::chrono::duration_cast;
 
 time_point a_begin, a_end;
 
-int main() {
+int main(int argc, char **argv) {
+    if (argc > 1) TestSize = std::atoi(argv[1]);
 
     std::cout << "------------ Test case for MyAllocator of list ------------" << std::endl;
     std::random_device rd;
@@ -88,6 +96,18 @@ int main() {
         << " picked lists"
         << std::endl;
 
+    // hand nodes between lists with allocators of their own, they have to go back to the pools they came from.
+    {
+        T_Vec first(PickSize, 'a'), second(PickSize / 2, 'b');
+        first.swap(second);
+        second.splice(second.end(), T_Vec(second));
+        first = std::move(second);
+        second.assign(PickSize, 'c');
+        bool correct = first.size() == 2 * PickSize && first.front() == 'a' && second.size() == PickSize;
+        check(correct, "incorrect swap, splice and move between lists");
+        if (correct) std::cout << "correct swap, splice and move between lists" << std::endl;
+    }
+
     // test if we can make correct assignment.
     {
         double val = 2.333;
@@ -104,5 +124,5 @@ int main() {
         << duration_cast<duration>(a_end - a_begin).count()
         << " seconds in total"
         << std::endl;
-    return 0;
+    return failures == 0 ? 0 : 1;
 }
\ No newline at end of file
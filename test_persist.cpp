@@ -0,0 +1,197 @@
+#include "persist.hpp"
+#include "test_check.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <sys/wait.h>  // to use waitpid
+#include <unistd.h>    // to use fork
+
+/**
+ * Test of the file-backed PersistentPool: build a linked list in a pool, close it, reopen it and walk the list again
+ * Then crash a child that changes the list and recover the pool from a walk of the list
+ * Usage: test_persist [FILE], the file is removed at the end
+ */
+
+struct Node {
+    std::uint64_t next;  // offset + 1 of the next node, offsets stay valid wherever the pool is mapped
+    std::uint64_t value;
+};
+
+constexpr std::size_t num_blocks = 100000;
+constexpr std::size_t num_nodes = 60000;
+
+/** Walk the list from the root, return the number of nodes and check their values count down */
+std::size_t walk(mem::PersistentPool &persistent)
+{
+    std::size_t count = 0;
+    for (auto node = static_cast<Node *>(persistent.root()); node != nullptr; count++) {
+        check(node->value % 3 != 0 || node->value == 0, "a freed node is still on the list");
+        node = node->next == 0 ? nullptr : static_cast<Node *>(persistent.at(node->next - 1));
+    }
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    std::string path = argc > 1 ? argv[1] : "test_persist.pool";
+    std::remove(path.c_str());
+
+    {
+        std::cout << "[INFO] Building a list of " << num_nodes << " nodes in a new pool" << std::endl;
+        mem::PersistentPool persistent(path, sizeof(Node), num_blocks);
+        check(!persistent.resumed(), "a new file is resumed");
+
+        Node *head = nullptr;
+        for (std::size_t i = 0; i < num_nodes; i++) {
+            auto node = static_cast<Node *>(persistent.pool().get());
+            node->value = i;
+            node->next = head == nullptr ? 0 : persistent.offset_of(head) + 1;
+            head = node;
+        }
+
+        // unlink and free every node whose value is a multiple of 3, except the last one
+        for (Node *node = head; node->next != 0;) {
+            auto next = static_cast<Node *>(persistent.at(node->next - 1));
+            if (next->value % 3 == 0 && next->value != 0) {
+                node->next = next->next;
+                persistent.pool().free(next);
+            } else {
+                node = next;
+            }
+        }
+        persistent.set_root(head);
+        check(walk(persistent) == num_nodes - (num_nodes - 1) / 3, "the list before closing");
+    }
+
+    std::size_t in_use = 0;
+    {
+        std::cout << "[INFO] Reopening the pool" << std::endl;
+        mem::PersistentPool persistent(path, sizeof(Node), num_blocks);
+        check(persistent.resumed(), "an existing file isn't resumed");
+        std::cout << "[INFO] The blocks were " << (persistent.relocated() ? "relocated" : "mapped at the same address") << std::endl;
+
+        in_use = persistent.pool().size();
+        check(in_use == num_nodes - (num_nodes - 1) / 3, "the pool's size after reopening");
+        check(walk(persistent) == in_use, "the list after reopening");
+
+        // the freed nodes have to come back from the free list before any never touched block
+        std::size_t peak = persistent.pool().peak();
+        for (std::size_t i = 0; i < (num_nodes - 1) / 3; i++) persistent.pool().get();
+        check(persistent.pool().peak() == peak, "the free list wasn't resumed");
+        check(persistent.pool().size() == num_nodes, "the pool's size after reusing the free list");
+    }
+
+    {
+        bool thrown = false;
+        try {
+            mem::PersistentPool persistent(path, sizeof(Node) * 2, num_blocks);
+        } catch (const std::runtime_error &e) {
+            std::cout << "[INFO] Expected: " << e.what() << std::endl;
+            thrown = true;
+        }
+        check(thrown, "a different geometry is accepted");
+    }
+
+    {
+        mem::PersistentPool persistent(path, sizeof(Node), num_blocks);
+        bool thrown = false;
+        try {
+            mem::PersistentPool again(path, sizeof(Node), num_blocks);
+        } catch (const std::runtime_error &e) {
+            std::cout << "[INFO] Expected: " << e.what() << std::endl;
+            thrown = true;
+        }
+        check(thrown, "a file that is already open is accepted");
+    }
+
+    {
+        std::cout << "[INFO] Crashing a child after changing the list past its last sync()" << std::endl;
+        pid_t pid = fork();
+        if (pid == 0) {
+            auto persistent = new mem::PersistentPool(path, sizeof(Node), num_blocks);  // never destroyed, like a crash leaves it
+            persistent->sync();
+            // unlink and free every node whose value is a multiple of 5, the free list in the file is stale from then on
+            auto head = static_cast<Node *>(persistent->root());
+            for (Node *node = head; node->next != 0;) {
+                auto next = static_cast<Node *>(persistent->at(node->next - 1));
+                if (next->value % 5 == 0 && next->value != 0) {
+                    node->next = next->next;
+                    persistent->pool().free(next);
+                } else {
+                    node = next;
+                }
+            }
+            _exit(failures);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "the crashing child");
+
+        bool thrown = false;
+        try {
+            mem::PersistentPool persistent(path, sizeof(Node), num_blocks);
+        } catch (const std::runtime_error &e) {
+            std::cout << "[INFO] Expected: " << e.what() << std::endl;
+            thrown = true;
+        }
+        check(thrown, "a file that wasn't closed is accepted without a recovery walk");
+    }
+
+    {
+        std::cout << "[INFO] Recovering the pool from its list" << std::endl;
+        auto recover = [](mem::PersistentPool &persistent, const std::function<void(void *)> &reached) {
+            for (auto node = static_cast<Node *>(persistent.root()); node != nullptr;) {
+                reached(node);
+                node = node->next == 0 ? nullptr : static_cast<Node *>(persistent.at(node->next - 1));
+            }
+        };
+        mem::PersistentPool persistent(path, sizeof(Node), num_blocks, recover);
+        check(persistent.recovered(), "a file that wasn't closed isn't recovered");
+
+        std::size_t survivors = walk(persistent);
+        check(survivors < in_use, "the changes after the last sync() are lost");
+        check(persistent.pool().size() == survivors, "the pool's size after recovering");
+
+        // none of the free blocks may be a node of the list
+        while (!persistent.pool().full()) *static_cast<Node *>(persistent.pool().get()) = Node{0, 3};
+        check(walk(persistent) == survivors, "the list after using every recovered free block");
+    }
+
+    {
+        mem::PersistentPool persistent(path, sizeof(Node), num_blocks);
+        check(persistent.resumed() && !persistent.recovered(), "a recovered file isn't closed cleanly");
+        check(persistent.pool().full(), "the pool's size after reopening a recovered file");
+    }
+
+#ifndef MEM_HARDENED
+    {
+        // a hardened build saves a nonzero cookie with the links it mangled, we can't follow them
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        std::uint64_t cookie = 0x5eed;
+        file.seekp(offsetof(mem::PersistentPool::Header, state) + offsetof(mem::PoolMemory::State, cookie));
+        file.write(reinterpret_cast<const char *>(&cookie), sizeof(cookie));
+        file.close();
+
+        bool thrown = false;
+        try {
+            mem::PersistentPool persistent(path, sizeof(Node), num_blocks);
+        } catch (const std::runtime_error &e) {
+            std::cout << "[INFO] Expected: " << e.what() << std::endl;
+            thrown = true;
+        }
+        check(thrown, "the free list of a hardened build is accepted");
+    }
+#endif
+
+    std::remove(path.c_str());
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " persistent pool" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
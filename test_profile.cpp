@@ -0,0 +1,168 @@
+#include "myAllocator.hpp"
+#include "profile.hpp"
+#include "test_check.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Test of the sampling heap profiler: lists of two node sizes allocated from two call sites, whose live bytes the samples
+ * must estimate within a few percent, with the tags and stacks telling the sites apart. Then frees, threads, a stopped
+ * profiler and a pprof profile written out, to look at with pprof -top -tagfocus=block=256B test_profile mem.pprof
+ *
+ * Usage: test_profile [profile file]
+ */
+
+struct Small {
+    char bytes[16];
+};
+struct Large {
+    char bytes[240];
+};
+using SmallList = std::list<Small, list::allocator<Small>>;
+using LargeList = std::list<Large, list::allocator<Large>>;
+
+// two call sites the stacks must tell apart
+[[gnu::noinline]] void fill_small(SmallList &list, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++) list.emplace_back();
+}
+[[gnu::noinline]] void fill_large(LargeList &list, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++) list.emplace_back();
+}
+
+struct Estimate {
+    double bytes = 0;
+    std::size_t samples = 0;
+};
+
+/** The live bytes the samples of one resource and block size stand for */
+Estimate estimate(const char *resource, std::size_t block)
+{
+    Estimate result;
+    for (const mem::profile::Sample &sample : mem::profile::live()) {
+        if (std::strcmp(sample.resource, resource) != 0 || sample.block != block) continue;
+        result.bytes += sample.weight * sample.size;
+        result.samples++;
+    }
+    return result;
+}
+
+bool close_to(double estimated, double actual, double tolerance) { return std::fabs(estimated - actual) <= tolerance * actual; }
+
+void test_sites()
+{
+    constexpr std::size_t small_nodes = 200000, large_nodes = 20000;
+    SmallList small;
+    LargeList large;
+    fill_small(small, small_nodes);
+    fill_large(large, large_nodes);
+
+    // the nodes hold two links besides the value, so the blocks are a little larger than the types
+    std::set<std::size_t> blocks;
+    for (const mem::profile::Sample &sample : mem::profile::live()) {
+        check(std::strcmp(sample.resource, "list::allocator") == 0, std::string("a sample is tagged ") + sample.resource);
+        blocks.insert(sample.block);
+    }
+    check(blocks.size() == 2, "the samples have " + std::to_string(blocks.size()) + " block sizes instead of two");
+    if (blocks.size() != 2) return;
+    std::size_t small_block = *blocks.begin(), large_block = *blocks.rbegin();
+
+    Estimate small_live = estimate("list::allocator", small_block), large_live = estimate("list::allocator", large_block);
+    double small_bytes = double(small_nodes * small_block), large_bytes = double(large_nodes * large_block);
+    std::cout << "[INFO] " << small_live.samples << " samples estimate " << small_live.bytes << " bytes of " << small_bytes << " in "
+              << small_block << " byte blocks, " << large_live.samples << " estimate " << large_live.bytes << " of " << large_bytes
+              << " in " << large_block << " byte blocks" << std::endl;
+    check(close_to(small_live.bytes, small_bytes, 0.15), "the estimate of the small blocks is off");
+    check(close_to(large_live.bytes, large_bytes, 0.15), "the estimate of the large blocks is off");
+
+    // no stack of a site is one of the other's
+    std::set<std::vector<void *>> small_stacks, large_stacks;
+    for (const mem::profile::Sample &sample : mem::profile::live()) {
+        check(sample.stack.size() >= 2, "a sample has a stack of " + std::to_string(sample.stack.size()) + " frames");
+        (sample.block == small_block ? small_stacks : large_stacks).insert(sample.stack);
+    }
+    for (const std::vector<void *> &stack : small_stacks) check(large_stacks.count(stack) == 0, "the two call sites share a stack");
+
+    // freeing every other small node halves its estimate, and leaves the large ones alone
+    bool odd = false;
+    for (auto it = small.begin(); it != small.end(); odd = !odd) it = odd ? small.erase(it) : std::next(it);
+    small_live = estimate("list::allocator", small_block);
+    check(close_to(small_live.bytes, small_bytes / 2, 0.2), "the estimate went to " + std::to_string(small_live.bytes) + " after freeing half the small nodes");
+    check(estimate("list::allocator", large_block).samples == large_live.samples, "freeing small nodes forgot large samples");
+
+    small.clear();
+    large.clear();
+    check(mem::profile::live().empty(), std::to_string(mem::profile::live().size()) + " samples are left after freeing everything");
+}
+
+void test_vector()
+{
+    std::vector<int, vector::allocator<int>> values;
+    values.reserve(1 << 18);  // a MiB, sampled whatever the count left was
+    Estimate live = estimate("vector::allocator", 1 << 20);
+    check(live.samples == 1 && close_to(live.bytes, 1 << 20, 0.01), "the reserve of a vector wasn't sampled in its size class");
+}
+
+void test_threads()
+{
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([] {
+            for (int round = 0; round < 20; round++) {
+                SmallList list;
+                fill_small(list, 5000);
+            }
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    check(mem::profile::live().empty(), "samples of the threads are left after they freed everything");
+}
+
+void test_stopped()
+{
+    std::size_t interval = mem::profile::interval();
+    mem::profile::set_interval(0);
+    SmallList list;
+    fill_small(list, 100000);
+    check(mem::profile::live().empty(), "a stopped profiler took samples");
+    list.clear();
+    mem::profile::set_interval(interval);
+}
+
+void test_pprof(const std::string &path)
+{
+    SmallList small;
+    LargeList large;
+    fill_small(small, 50000);
+    fill_large(large, 5000);
+    check(mem::profile::dump(path), "couldn't write " + path);
+
+    std::ifstream file(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::cout << "[INFO] " << mem::profile::live().size() << " live samples written to " << path << " in " << bytes.size() << " bytes" << std::endl;
+    check(bytes.size() > 100 && bytes[0] == 0x0a, "the profile doesn't start with a sample type");
+    for (const char *string : {"inuse_space", "list::allocator", "resource", "block"})
+        check(bytes.find(string) != std::string::npos, std::string("the profile has no string ") + string);
+}
+
+int main(int argc, char *argv[])
+{
+    mem::profile::set_interval(4096);
+    test_sites();
+    test_vector();
+    test_threads();
+    test_stopped();
+    test_pprof(argc > 1 ? argv[1] : "mem.pprof");
+
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " profile" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+#include "queue.hpp"
+#include "test_check.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Test of BlockQueue and ConcurrentPool: the ring keeps its order, its bounds and its blocks over many laps, the pool hands
+ * out every block once and only fails once nothing is free, even while other threads are freeing into it, and producers
+ * and consumers pass messages through a ring, each message a block of a pool shared by all of them. Every consumer must
+ * see the messages of a producer in order, none lost nor duplicated, and the pool must have all its blocks back at the end
+ *
+ * Usage: test_queue [MESSAGES_PER_PRODUCER]
+ */
+
+void *block_of(std::uintptr_t value) { return reinterpret_cast<void *>(value * 16); }
+
+void test_ring()
+{
+    mem::BlockQueue queue(5);
+    check(queue.capacity() == 8, "a ring of 5 has room for " + std::to_string(queue.capacity()) + " blocks instead of 8");
+    check(queue.pop() == nullptr && queue.empty(), "a new ring isn't empty");
+
+    std::uintptr_t pushed = 1, popped = 1;
+    for (int lap = 0; lap < 1000; lap++) {
+        // fill it up, then take some out so that the next lap starts somewhere else in the ring
+        while (queue.push(block_of(pushed))) pushed++;
+        check(queue.size() == queue.capacity(), "the ring is full with " + std::to_string(queue.size()) + " blocks");
+        for (int i = 0; i < 1 + lap % 7; i++) {
+            void *pblock = queue.pop();
+            check(pblock == block_of(popped++), "the ring gave a block out of order");
+        }
+    }
+    while (void *pblock = queue.pop()) check(pblock == block_of(popped++), "the ring gave a block out of order");
+    check(popped == pushed, std::to_string(pushed - popped) + " blocks were lost in the ring");
+}
+
+void test_pool()
+{
+    constexpr std::size_t num_blocks = 100;
+    mem::ConcurrentPool pool(32, num_blocks);
+    std::set<void *> blocks;
+    while (void *pblock = pool.get<mem::oom::Null>()) {
+        check(pool.owns(pblock), "a block isn't in the pool");
+        blocks.insert(pblock);
+    }
+    check(blocks.size() == num_blocks, "the pool handed out " + std::to_string(blocks.size()) + " distinct blocks instead of " + std::to_string(num_blocks));
+    check(pool.free_count() == 0 && pool.peak() == num_blocks, "an exhausted pool has free blocks");
+
+    bool thrown = false;
+    try {
+        pool.get();
+    } catch (const std::bad_alloc &) {
+        thrown = true;
+    }
+    check(thrown, "an exhausted pool didn't throw");
+
+    for (void *pblock : blocks) pool.free(pblock);
+    check(pool.free_count() == num_blocks && pool.size() == 0, "the pool didn't get every block back");
+    for (std::size_t i = 0; i < num_blocks; i++) check(blocks.count(pool.get()) == 1, "the pool handed out a block it didn't have");
+}
+
+/** Threads free a block and get one right away from a pool whose every other block is in use, get() must never fail */
+void test_full(std::uint32_t rounds)
+{
+    constexpr int num_threads = 4, per_thread = 2;  // as many blocks as the threads hold, a block is only free while it's passed on
+    mem::ConcurrentPool pool(32, num_threads * per_thread);
+    std::atomic<std::uint64_t> failed(0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&] {
+            void *held[per_thread];
+            for (void *&pblock : held) pblock = pool.get();
+            for (std::uint32_t i = 0; i < rounds; i++) {
+                void *&pblock = held[i % per_thread];
+                pool.free(pblock);
+                // the block we freed is in the ring or in a cell a free() is filling, the pool isn't exhausted
+                if ((pblock = pool.get<mem::oom::Null>()) == nullptr) failed.fetch_add(1, std::memory_order_relaxed);
+            }
+            for (void *pblock : held) pool.free(pblock);
+        });
+    }
+    for (auto &thread : threads) thread.join();
+
+    check(failed.load() == 0, "a full pool with free blocks in flight failed " + std::to_string(failed.load()) + " gets");
+    check(pool.free_count() == pool.capacity(), "blocks are missing after the gets on a full pool");
+}
+
+struct Message {
+    std::uint32_t producer;
+    std::uint32_t sequence;
+    std::uint64_t check;
+};
+
+std::uint64_t checksum(const Message &message) { return (std::uint64_t(message.producer) << 32 | message.sequence) * 0x9e3779b97f4a7c15 + 1; }
+
+/** Producers get a block, fill it and push it, consumers pop it, check it and free it, with a pool of twice the cells of the ring so that every block is recycled all the time */
+void test_pipeline(int producers, int consumers, std::uint32_t messages)
+{
+    mem::ConcurrentPool pool(sizeof(Message), 64);
+    mem::BlockQueue channel(32);
+    std::atomic<int> producing(producers);
+    std::atomic<std::uint64_t> received(0), sum(0), errors(0);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            for (std::uint32_t i = 0; i < messages; i++) {
+                void *pblock;
+                while ((pblock = pool.get<mem::oom::Null>()) == nullptr) std::this_thread::yield();  // the consumers hold them all
+                auto message = static_cast<Message *>(pblock);
+                message->producer = p;
+                message->sequence = i;
+                message->check = checksum(*message);
+                while (!channel.push(message)) std::this_thread::yield();
+            }
+            producing.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    for (int c = 0; c < consumers; c++) {
+        threads.emplace_back([&] {
+            std::vector<std::int64_t> last(producers, -1);  // a consumer sees the messages of a producer in the order they were pushed
+            std::uint64_t count = 0, total = 0;
+            for (;;) {
+                auto message = static_cast<Message *>(channel.pop());
+                if (message == nullptr) {
+                    if (producing.load(std::memory_order_acquire) == 0 && (message = static_cast<Message *>(channel.pop())) == nullptr) break;
+                    if (message == nullptr) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                }
+                if (message->check != checksum(*message) || message->producer >= std::uint32_t(producers) || message->sequence <= last[message->producer])
+                    errors.fetch_add(1, std::memory_order_relaxed);
+                else
+                    last[message->producer] = message->sequence;
+                count++;
+                total += message->sequence;
+                pool.free(message);
+            }
+            received.fetch_add(count);
+            sum.fetch_add(total);
+        });
+    }
+    for (auto &thread : threads) thread.join();
+
+    std::string name = std::to_string(producers) + " producers and " + std::to_string(consumers) + " consumers";
+    std::uint64_t expected = std::uint64_t(producers) * messages;
+    check(errors.load() == 0, std::to_string(errors.load()) + " messages were corrupted or out of order with " + name);
+    check(received.load() == expected, std::to_string(received.load()) + " messages of " + std::to_string(expected) + " arrived with " + name);
+    check(sum.load() == std::uint64_t(producers) * messages * (messages - 1) / 2, "messages were duplicated with " + name);
+    check(pool.free_count() == pool.capacity() && channel.empty(), "blocks are missing after the pipeline with " + name);
+}
+
+int main(int argc, char *argv[])
+{
+    std::uint32_t messages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+    test_ring();
+    test_pool();
+    test_full(messages);
+    for (auto [producers, consumers] : {std::pair(1, 1), std::pair(1, 4), std::pair(4, 1), std::pair(4, 4)}) test_pipeline(producers, consumers, messages);
+
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " queue" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+#include "shared.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sched.h>     // to use sched_yield
+#include <sys/mman.h>  // to use mmap
+#include <sys/wait.h>  // to use waitpid
+#include <unistd.h>    // to use fork
+
+/**
+ * Multi-process test of SharedPool: producer processes get blocks, write a message into them and pass their offsets
+ * to consumer processes, which check the message and free the block, all through one small pool so that blocks are
+ * recycled across processes all the time
+ * The producers open the pool by name and so map it at their own address, the consumers use the mapping inherited by fork
+ *
+ * Usage: test_shm [MESSAGES_PER_PRODUCER]
+ */
+
+constexpr int num_producers = 4;
+constexpr int num_consumers = 2;
+constexpr std::size_t num_blocks = 256;
+constexpr std::size_t ring_size = 1024;  // per producer, larger than the pool so that the pool is what runs out
+
+struct Message {
+    std::uint64_t producer;
+    std::uint64_t sequence;
+    std::uint64_t checksum;
+    std::uint64_t padding[5];  // a block of 64 bytes
+};
+
+std::uint64_t checksum(std::uint64_t producer, std::uint64_t sequence) { return (sequence * 0x9e3779b97f4a7c15) ^ producer; }
+
+/** Single producer single consumer ring of block offsets, in memory shared by fork */
+struct Ring {
+    alignas(64) std::atomic<std::uint64_t> head{0};  // next slot to read
+    alignas(64) std::atomic<std::uint64_t> tail{0};  // next slot to write
+    std::uint64_t slots[ring_size];
+};
+
+struct Shared {
+    Ring rings[num_producers];
+    std::atomic<std::uint64_t> consumed{0};
+    std::atomic<std::uint64_t> errors{0};
+};
+
+int produce(const std::string &name, Ring &ring, std::uint64_t producer, std::uint64_t num_messages)
+{
+    mem::SharedPool pool(name);  // a mapping of our own, most likely at another address than the consumers'
+    for (std::uint64_t sequence = 0; sequence < num_messages; sequence++) {
+        void *pblock;
+        while ((pblock = pool.get<mem::oom::Null>()) == nullptr) sched_yield();  // the consumers will free some
+
+        auto message = static_cast<Message *>(pblock);
+        message->producer = producer;
+        message->sequence = sequence;
+        message->checksum = checksum(producer, sequence);
+
+        std::uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        while (tail - ring.head.load(std::memory_order_acquire) == ring_size) sched_yield();
+        ring.slots[tail % ring_size] = pool.offset_of(pblock);
+        ring.tail.store(tail + 1, std::memory_order_release);
+    }
+    return 0;
+}
+
+int consume(mem::SharedPool &pool, Shared &shared, int consumer, std::uint64_t num_messages)
+{
+    std::vector<std::uint64_t> expected(num_producers, 0);
+    std::uint64_t remaining = 0;
+    for (int producer = consumer; producer < num_producers; producer += num_consumers) remaining += num_messages;
+
+    while (remaining > 0) {
+        bool idle = true;
+        for (int producer = consumer; producer < num_producers; producer += num_consumers) {
+            Ring &ring = shared.rings[producer];
+            std::uint64_t head = ring.head.load(std::memory_order_relaxed);
+            if (head == ring.tail.load(std::memory_order_acquire)) continue;
+
+            auto message = static_cast<Message *>(pool.at(ring.slots[head % ring_size]));
+            if (message->producer != std::uint64_t(producer) || message->sequence != expected[producer] ||
+                message->checksum != checksum(producer, message->sequence))
+                shared.errors.fetch_add(1);
+            expected[producer]++;
+            pool.free(message);
+            ring.head.store(head + 1, std::memory_order_release);
+
+            shared.consumed.fetch_add(1, std::memory_order_relaxed);
+            remaining--;
+            idle = false;
+        }
+        if (idle) sched_yield();
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    std::uint64_t num_messages = argc > 1 ? std::atoll(argv[1]) : 200000;
+    std::string name = "/allocpool_test_" + std::to_string(getpid());
+
+    void *mapping = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "mmap failed" << std::endl;
+        return 1;
+    }
+    Shared &shared = *new (mapping) Shared;
+
+    mem::SharedPool::unlink(name);  // a leftover of a crashed run
+    mem::SharedPool pool(name, sizeof(Message), num_blocks);
+    std::cout << "[INFO] " << num_producers << " producers send " << num_messages << " messages each to " << num_consumers
+              << " consumers through a shared pool of " << pool.capacity() << " blocks" << std::endl;
+
+    std::vector<pid_t> children;
+    for (int consumer = 0; consumer < num_consumers; consumer++) {
+        pid_t pid = fork();
+        if (pid == 0) _exit(consume(pool, shared, consumer, num_messages));
+        children.push_back(pid);
+    }
+    for (int producer = 0; producer < num_producers; producer++) {
+        pid_t pid = fork();
+        if (pid == 0) _exit(produce(name, shared.rings[producer], producer, num_messages));
+        children.push_back(pid);
+    }
+
+    int failures = 0;
+    for (pid_t pid : children) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failures++;
+    }
+    mem::SharedPool::unlink(name);
+
+    if (failures != 0) std::cout << "[FAILED] " << failures << " processes didn't exit cleanly" << std::endl;
+    if (shared.consumed != num_producers * num_messages) {
+        std::cout << "[FAILED] consumed " << shared.consumed << " messages" << std::endl;
+        failures++;
+    }
+    if (shared.errors != 0) {
+        std::cout << "[FAILED] " << shared.errors << " messages were corrupted" << std::endl;
+        failures++;
+    }
+
+    // every block has to be back exactly once, a lost or doubled one would show up here
+    std::size_t count = 0;
+    while (count <= pool.capacity() && pool.get<mem::oom::Null>() != nullptr) count++;
+    if (count != pool.capacity()) {
+        std::cout << "[FAILED] " << count << " blocks could be gotten after the run" << std::endl;
+        failures++;
+    }
+
+    // a segment larger than the address space can't be mapped, its name must not be left behind
+    try {
+        mem::SharedPool huge(name, sizeof(Message), (std::size_t(1) << 50) / sizeof(Message));
+        std::cout << "[FAILED] a segment larger than the address space was mapped" << std::endl;
+        failures++;
+    } catch (const std::runtime_error &e) {
+        std::cout << "[INFO] Expected: " << e.what() << std::endl;
+    }
+    try {
+        mem::SharedPool again(name, sizeof(Message), num_blocks);
+    } catch (const std::runtime_error &e) {
+        std::cout << "[FAILED] a failed create left its name behind: " << e.what() << std::endl;
+        failures++;
+    }
+    mem::SharedPool::unlink(name);
+
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " shared pool" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
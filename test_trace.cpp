@@ -0,0 +1,98 @@
+#include "test_check.hpp"
+#include "trace.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Test of the allocation traces: load a trace recorded by a test program, check that every deallocation matches an earlier
+ * allocation of the same size, then check that the loader rejects truncated and corrupt copies of the file
+ * Only built with ALLOCPOOL_TRACE, ctest records the trace with test_list first
+ *
+ * Usage: test_trace TRACE_FILE
+ */
+
+std::vector<char> read_file(const std::string &path)
+{
+    std::vector<char> bytes;
+    if (std::FILE *file = std::fopen(path.c_str(), "rb")) {
+        char buffer[4096];
+        for (std::size_t n; (n = std::fread(buffer, 1, sizeof(buffer), file)) > 0;) bytes.insert(bytes.end(), buffer, buffer + n);
+        std::fclose(file);
+    }
+    return bytes;
+}
+
+/** Write a copy of the trace spoiled by spoil and check that the loader throws on it */
+void expect_rejected(const std::vector<char> &trace, const std::string &what, const std::function<void(std::vector<char> &bytes)> &spoil)
+{
+    std::vector<char> bytes = trace;
+    spoil(bytes);
+    std::string path = "test_trace.spoiled";
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    std::fwrite(bytes.data(), 1, bytes.size(), file);
+    std::fclose(file);
+
+    bool thrown = false;
+    try {
+        mem::trace::load(path);
+    } catch (const std::runtime_error &e) {
+        std::cout << "[INFO] Expected: " << e.what() << std::endl;
+        thrown = true;
+    }
+    check(thrown, "a " + what + " trace is accepted");
+    std::remove(path.c_str());
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " TRACE_FILE" << std::endl;
+        return 1;
+    }
+
+    std::vector<mem::trace::Event> events;
+    try {
+        events = mem::trace::load(argv[1]);
+    } catch (const std::exception &e) {
+        std::cout << "[FAILED] " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << "[INFO] " << argv[1] << " holds " << events.size() << " events" << std::endl;
+    check(!events.empty(), "the trace is empty");
+
+    std::unordered_map<std::uint32_t, std::uint32_t> live;  // size of every id allocated and not deallocated yet
+    std::size_t unmatched = 0;
+    for (const mem::trace::Event &event : events) {
+        if (event.op == mem::trace::Op::allocate) {
+            unmatched += !live.emplace(event.id, event.size).second;
+        } else {
+            auto it = live.find(event.id);
+            unmatched += it == live.end() || it->second != event.size;
+            if (it != live.end()) live.erase(it);
+        }
+    }
+    check(unmatched == 0, std::to_string(unmatched) + " events don't match an allocation");
+
+    std::vector<char> trace = read_file(argv[1]);
+    expect_rejected(trace, "truncated", [](std::vector<char> &bytes) { bytes.resize(bytes.size() - sizeof(mem::trace::Event) / 2); });
+    expect_rejected(trace, "foreign", [](std::vector<char> &bytes) { std::memcpy(bytes.data(), "MPOL", 4); });
+    expect_rejected(trace, "miscounted", [](std::vector<char> &bytes) {
+        std::uint64_t count = std::uint64_t(1) << 60;
+        std::memcpy(bytes.data() + offsetof(mem::trace::Header, count), &count, sizeof(count));
+    });
+    expect_rejected(trace, "corrupt", [](std::vector<char> &bytes) {
+        bytes[sizeof(mem::trace::Header) + offsetof(mem::trace::Event, op)] = 7;
+    });
+
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " allocation trace" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+#include "pool.hpp"
+#include "scavenger.hpp"
+#include "test_check.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>  // to use mincore
+#include <unistd.h>    // to use sysconf
+
+/**
+ * Test of PoolMemory::trim() and the Scavenger: a pool goes through a burst, gives most of its blocks back and has the
+ * pages only free blocks cover released, which mincore() confirms, while the blocks still in use keep their contents
+ * and the released blocks can all be gotten again, before any new block is carved. Then a scavenger thread trims a pool
+ * shared with another thread
+ *
+ * Usage: test_trim
+ */
+
+constexpr std::size_t block_sz = 64;
+constexpr std::size_t num_blocks = 1 << 16;  // 4 MiB of blocks
+
+/** Return the bytes of the pages in [begin, end) that are resident */
+std::size_t resident(const void *begin, const void *end)
+{
+    static const std::uintptr_t page_sz = sysconf(_SC_PAGESIZE);
+    std::uintptr_t first = reinterpret_cast<std::uintptr_t>(begin) & ~(page_sz - 1);
+    std::uintptr_t last = reinterpret_cast<std::uintptr_t>(end);
+    std::vector<unsigned char> pages((last - first + page_sz - 1) / page_sz);
+    if (mincore(reinterpret_cast<void *>(first), last - first, pages.data()) != 0) return 0;
+    return std::count_if(pages.begin(), pages.end(), [](unsigned char page) { return page & 1; }) * page_sz;
+}
+
+std::uint64_t pattern(std::size_t i) { return i * 0x9e3779b97f4a7c15 + 7; }
+
+/** Get every block, in address order since the pool is fresh */
+std::vector<void *> burst(mem::PoolMemory &pool)
+{
+    std::vector<void *> blocks;
+    while (void *pblock = pool.get<mem::oom::Null>()) blocks.push_back(pblock);
+    for (std::size_t i = 0; i < blocks.size(); i++) {
+        std::uint64_t value = pattern(i);  // after the first 8 bytes, where a free block keeps its link
+        std::memcpy(static_cast<std::byte *>(blocks[i]) + 8, &value, sizeof(value));
+    }
+    return blocks;
+}
+
+void test_trim()
+{
+    mem::PoolMemory pool(block_sz, num_blocks);
+    std::vector<void *> blocks = burst(pool);
+    const void *begin = blocks.front(), *end = static_cast<std::byte *>(blocks.back()) + block_sz;
+    std::size_t touched = resident(begin, end);
+    check(touched >= num_blocks * block_sz * 9 / 10, "the burst left only " + std::to_string(touched) + " bytes resident");
+
+    // keep one block in 256, that is one page in four, and free the others in random order
+    std::vector<void *> freed;
+    std::vector<std::size_t> kept;
+    for (std::size_t i = 0; i < blocks.size(); i++) {
+        if (i % 256 == 100)
+            kept.push_back(i);
+        else
+            freed.push_back(blocks[i]);
+    }
+    std::shuffle(freed.begin(), freed.end(), std::mt19937(42));
+    for (void *pblock : freed) pool.free(pblock);
+
+    std::size_t limited = pool.trim(3 * 4096);
+    check(limited <= 3 * 4096, "trim(3 pages) released " + std::to_string(limited) + " bytes");
+    std::size_t released = limited + pool.trim();
+    std::size_t left = resident(begin, end);
+    std::cout << "[INFO] trim released " << released << " of " << touched << " bytes, " << left << " are still resident" << std::endl;
+    check(released >= touched / 2, "trim released only " + std::to_string(released) + " bytes");
+    check(left + released <= touched + 4096, "the released pages are still resident");
+    check(pool.trim() == 0, "a second trim released pages again");
+    check(pool.size() == kept.size(), "trim changed the number of blocks in use");
+
+    for (std::size_t i : kept) {
+        std::uint64_t value;
+        std::memcpy(&value, static_cast<std::byte *>(blocks[i]) + 8, sizeof(value));
+        check(value == pattern(i), "the block " + std::to_string(i) + " in use lost its contents");
+    }
+
+    // every free block comes back, the trimmed ones once the others are gone, and nothing twice
+    std::vector<void *> again;
+    while (void *pblock = pool.get<mem::oom::Null>()) {
+        std::memset(pblock, 0xab, block_sz);
+        again.push_back(pblock);
+    }
+    check(again.size() == freed.size(), "got " + std::to_string(again.size()) + " blocks back instead of " + std::to_string(freed.size()));
+    std::sort(again.begin(), again.end());
+    std::sort(freed.begin(), freed.end());
+    check(again == freed, "the blocks gotten after the trim aren't the ones freed before it");
+    check(pool.full(), "the pool isn't full after getting every block");
+
+    for (void *pblock : again) pool.free(pblock);
+    for (std::size_t i : kept) pool.free(blocks[i]);
+    check(pool.empty(), "the pool isn't empty after giving everything back");
+}
+
+/** After a trim, get() takes the trimmed blocks back before it carves new ones, neither the peak nor the resident pages grow */
+void test_reuse()
+{
+    mem::PoolMemory pool(block_sz, num_blocks);
+    std::vector<void *> blocks;
+    for (std::size_t i = 0; i < num_blocks / 2; i++) {
+        blocks.push_back(pool.get());
+        std::memset(blocks.back(), 0xab, block_sz);
+    }
+    const void *begin = pool.block(0), *end = static_cast<std::byte *>(pool.block(num_blocks - 1)) + block_sz;
+    std::size_t touched = resident(begin, end);
+
+    for (void *pblock : blocks) pool.free(pblock);
+    std::size_t released = pool.trim();
+    check(released >= touched / 2, "trim released only " + std::to_string(released) + " bytes of the half used pool");
+
+    for (std::size_t i = 0; i < num_blocks / 2; i++) std::memset(pool.get(), 0xcd, block_sz);
+    std::size_t after = resident(begin, end);
+    std::cout << "[INFO] " << touched << " bytes resident before the trim, " << after << " after getting as many blocks again" << std::endl;
+    check(pool.peak() == num_blocks / 2, "the peak went from " + std::to_string(num_blocks / 2) + " to " + std::to_string(pool.peak()) + " blocks across a trim");
+    check(after <= touched, "getting the trimmed blocks again made " + std::to_string(after - touched) + " more bytes resident");
+    // the first page of the upper half holds the last block carved and the last one may be shared with the heap after the pool
+    std::size_t fresh = resident(static_cast<std::byte *>(pool.block(num_blocks / 2)) + 4096, static_cast<const std::byte *>(end) - 4096);
+    check(fresh == 0, "getting the trimmed blocks again faulted in " + std::to_string(fresh) + " bytes never touched before");
+}
+
+void test_scavenger()
+{
+    mem::PoolMemory pool(block_sz, num_blocks);
+    std::mutex mutex;
+    std::vector<void *> blocks;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        blocks = burst(pool);
+    }
+
+    constexpr std::size_t rate = 1 << 20;  // a quarter of the pool per second
+    mem::Scavenger scavenger({std::chrono::milliseconds(10), rate});
+    std::size_t id = scavenger.add(pool, mutex);
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread user([&] {
+        for (void *pblock : blocks) {
+            std::lock_guard<std::mutex> lock(mutex);
+            pool.free(pblock);
+        }
+    });
+    user.join();
+
+    // long enough for a few passes, not for the whole pool at that rate
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    while (scavenger.released() == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::size_t released = scavenger.released();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "[INFO] the scavenger released " << released << " bytes in " << seconds << " seconds" << std::endl;
+    check(released > 0, "the scavenger released nothing");
+    check(released <= rate * seconds + 4096, "the scavenger released " + std::to_string(released) + " bytes, over its rate");
+
+    scavenger.remove(id);
+    std::size_t after_remove = scavenger.released();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    check(scavenger.released() == after_remove, "the scavenger trimmed a removed pool");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::size_t count = 0;
+    while (pool.get<mem::oom::Null>() != nullptr) count++;
+    check(count == num_blocks, "got " + std::to_string(count) + " blocks back from the scavenged pool");
+}
+
+int main()
+{
+    test_trim();
+    test_reuse();
+    test_scavenger();
+
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " trim" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
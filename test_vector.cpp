@@ -1,4 +1,5 @@
 #include "myAllocator.hpp"
+#include <cstdlib>
 #include <iostream>
 #include <memory>
 #include <vector>
@@ -6,11 +7,16 @@
 #include <chrono>
 #include <ratio>
 
-const int TestSize = 20000;     // total size for test vector.
+int TestSize = 20000;           // total size for test vector, can be overridden by the first argument.
 const int PickSize = 2000;      // the number to be randomly chosen from testsize.
 
+#ifdef MEM_TEST_STD_ALLOCATOR
+template <class T>
+using MyAllocator = std::allocator<T>;  // the baseline, to compare the whole process allocators of preload.cpp with
+#else
 template <class T>
 using MyAllocator = vector::allocator<T>;  // replace the std::allocator with my allocator.
+#endif
 using Point2D = std::pair<int, int>;
 using type_name = Point2D;
 using T_Vec = std::vector<type_name, MyAllocator<type_name>>;
@@ -22,8 +28,9 @@ using std::chrono::duration_cast;
 
 time_point a_begin, a_end;
 
-int main() {
-    
+int main(int argc, char **argv) {
+    if (argc > 1) TestSize = std::atoi(argv[1]);
+
     std::cout << "------------ Test case for MyAllocator of vector ------------" << std::endl;
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -0,0 +1,163 @@
+#include "test_check.hpp"
+#include "worker.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Test of WorkerHeap: a small work stealing scheduler runs a fork/join tree of tasks. Every task is gotten from the heap
+ * by the worker that spawns it and freed by the worker that runs it, which is another one whenever the task was stolen,
+ * and takes some scratch memory from the arena of the task group
+ *
+ * Usage: test_worker [DEPTH]
+ */
+
+constexpr std::size_t num_workers = 4;
+
+struct Task {
+    std::uint64_t id;  // position in the tree, the root is 1 and the children of n are 2n and 2n + 1
+    std::uint64_t check;
+    int depth;  // levels of children below this task
+};
+
+std::uint64_t checksum(std::uint64_t id) { return id * 0x9e3779b97f4a7c15 ^ 0x5555; }
+
+/** The deques of the workers, the owner pushes and pops at the back and the thieves steal from the front */
+struct Scheduler {
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<Task *> tasks;
+    };
+
+    mem::WorkerHeap heap{num_workers, 64};  // small pools, so that the classes grow and recycle
+    mem::WorkerHeap::Group group{heap, 4096};
+    Queue queues[num_workers];
+    std::atomic<std::uint64_t> pending{0};  // spawned tasks that haven't finished
+    std::atomic<std::uint64_t> leaves{0};
+    std::atomic<std::uint64_t> stolen{0};
+    std::atomic<std::uint64_t> errors{0};
+
+    void spawn(std::size_t worker, std::uint64_t id, int depth)
+    {
+        auto task = static_cast<Task *>(heap.get(worker, sizeof(Task)));
+        task->id = id;
+        task->check = checksum(id);
+        task->depth = depth;
+        pending.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(queues[worker].mutex);
+        queues[worker].tasks.push_back(task);
+    }
+
+    Task *next(std::size_t worker)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queues[worker].mutex);
+            if (!queues[worker].tasks.empty()) {
+                Task *task = queues[worker].tasks.back();
+                queues[worker].tasks.pop_back();
+                return task;
+            }
+        }
+        for (std::size_t i = 1; i < num_workers; i++) {
+            Queue &victim = queues[(worker + i) % num_workers];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                Task *task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    void run(std::size_t worker, Task *task)
+    {
+        if (task->check != checksum(task->id)) errors.fetch_add(1, std::memory_order_relaxed);
+        if (mem::WorkerHeap::owner(task) != worker) stolen.fetch_add(1, std::memory_order_relaxed);
+
+        // scratch memory of the group, of a size that varies with the task
+        std::size_t scratch_size = 8 + task->id % 200;
+        auto scratch = static_cast<unsigned char *>(group.get(worker, scratch_size));
+        if (reinterpret_cast<std::uintptr_t>(scratch) % 16 != 0) errors.fetch_add(1, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < scratch_size; i++) scratch[i] = static_cast<unsigned char>(task->id);
+
+        if (task->depth == 0) {
+            leaves.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            spawn(worker, task->id * 2, task->depth - 1);
+            spawn(worker, task->id * 2 + 1, task->depth - 1);
+        }
+        heap.free(worker, task);
+        pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    void work(std::size_t worker)
+    {
+        while (pending.load(std::memory_order_acquire) != 0) {
+            if (Task *task = next(worker))
+                run(worker, task);
+            else
+                std::this_thread::yield();
+        }
+    }
+};
+
+void test_classes()
+{
+    mem::WorkerHeap heap(2, 4);
+    std::vector<void *> blocks;
+    for (std::size_t size : {1, 16, 17, 100, 2048, 2049, 100000}) {
+        void *pblock = heap.get(0, size);
+        check(reinterpret_cast<std::uintptr_t>(pblock) % 16 == 0, "a block of " + std::to_string(size) + " bytes is misaligned");
+        check(mem::WorkerHeap::owner(pblock) == 0, "a block of " + std::to_string(size) + " bytes names another owner");
+        blocks.push_back(pblock);
+    }
+    for (std::size_t i = 0; i < blocks.size(); i++) heap.free(i % 2, blocks[i]);  // every other one from the other worker
+    check(heap.size(0) == 0, "the blocks freed by both workers aren't all back");
+
+    // a class that outgrows its pool adds a larger one, and recycles the blocks of all of them afterwards
+    for (int round = 0; round < 3; round++) {
+        blocks.clear();
+        for (int i = 0; i < 20; i++) blocks.push_back(heap.get(1, 64));
+        for (void *pblock : blocks) heap.free(1, pblock);
+    }
+    check(heap.pools(1) == 3, "a class grew " + std::to_string(heap.pools(1)) + " pools instead of 3 for 20 blocks");
+}
+
+void test_fork_join(int depth)
+{
+    Scheduler scheduler;
+    scheduler.spawn(0, 1, depth);
+
+    std::vector<std::thread> workers;
+    for (std::size_t worker = 0; worker < num_workers; worker++) workers.emplace_back([&scheduler, worker] { scheduler.work(worker); });
+    for (auto &thread : workers) thread.join();
+
+    std::cout << "[INFO] " << num_workers << " workers ran " << (std::uint64_t(2) << depth) - 1 << " tasks, " << scheduler.stolen
+              << " of them stolen, with " << scheduler.group.chunks() << " chunks of group memory" << std::endl;
+    check(scheduler.leaves == std::uint64_t(1) << depth, "the tree ran " + std::to_string(scheduler.leaves.load()) + " leaves");
+    check(scheduler.errors == 0, std::to_string(scheduler.errors.load()) + " tasks were corrupted");
+    for (std::size_t worker = 0; worker < num_workers; worker++)
+        check(scheduler.heap.size(worker) == 0, "worker " + std::to_string(worker) + " has blocks that never came back");
+
+    scheduler.group.reset();
+    check(scheduler.group.chunks() <= num_workers, "the group kept more than a chunk per worker after its reset");
+}
+
+int main(int argc, char **argv)
+{
+    int depth = argc > 1 ? std::atoi(argv[1]) : 18;
+
+    test_classes();
+    test_fork_join(depth);
+
+    std::cout << (failures == 0 ? "[PASSED]" : "[FAILED]") << " worker heap" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
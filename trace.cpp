@@ -0,0 +1,194 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace mem::trace;
+
+namespace
+{
+constexpr std::size_t buffer_events = 4096;  // events a thread buffers before taking the file lock
+
+std::atomic<bool> s_alive(false);  // trivially destructible, so it's still readable while statics are being destroyed
+
+/** Owns the trace file and the address to id mapping shared by all threads */
+class Recorder
+{
+   public:
+    static Recorder &instance()
+    {
+        static Recorder recorder;
+        return recorder;
+    }
+
+    Recorder() : m_begin(std::chrono::steady_clock::now())
+    {
+        const char *path = std::getenv("MEM_TRACE_FILE");
+        m_file = std::fopen(path ? path : "mem.trace", "wb");
+        if (m_file != nullptr) {
+            Header header = {{'M', 'T', 'R', 'C'}, version, 0};
+            std::fwrite(&header, sizeof(header), 1, m_file);
+        }
+        s_alive = true;
+    }
+
+    ~Recorder()
+    {
+        s_alive = false;
+        if (m_file != nullptr) {
+            std::lock_guard<std::mutex> lock(m_file_mutex);
+            patch_count();
+            std::fclose(m_file);
+        }
+    }
+
+    std::uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_begin).count();
+    }
+
+    std::uint16_t next_thread() { return m_threads++; }
+
+    /**
+     * Fill in the id of pblock, a fresh one on allocation and the last one given on deallocation (false if never seen)
+     * The timestamp is taken under the same lock so that a deallocation never sorts before its allocation
+     */
+    bool lookup(const void *pblock, Op op, std::uint32_t &id, std::uint64_t &time_ns)
+    {
+        std::lock_guard<std::mutex> lock(m_ids_mutex);
+        time_ns = now();
+        if (op == Op::allocate) {
+            id = m_next_id++;
+            m_ids[pblock] = id;
+            return true;
+        }
+        auto it = m_ids.find(pblock);
+        if (it == m_ids.end()) return false;  // allocated before we started recording
+        id = it->second;
+        m_ids.erase(it);
+        return true;
+    }
+
+    void write(std::vector<Event> &events)
+    {
+        std::lock_guard<std::mutex> lock(m_file_mutex);
+        if (m_file != nullptr && !events.empty()) {
+            std::fwrite(events.data(), sizeof(Event), events.size(), m_file);
+            m_count += events.size();
+        }
+        events.clear();
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(m_file_mutex);
+        if (m_file != nullptr) {
+            patch_count();
+            std::fflush(m_file);
+        }
+    }
+
+   private:
+    void patch_count()  // the caller holds m_file_mutex
+    {
+        long end = std::ftell(m_file);
+        std::fseek(m_file, offsetof(Header, count), SEEK_SET);
+        std::fwrite(&m_count, sizeof(m_count), 1, m_file);
+        std::fseek(m_file, end, SEEK_SET);
+    }
+
+    std::chrono::steady_clock::time_point m_begin;
+    std::FILE *m_file;
+    std::mutex m_file_mutex;
+    std::uint64_t m_count = 0;
+    std::mutex m_ids_mutex;
+    std::unordered_map<const void *, std::uint32_t> m_ids;
+    std::uint32_t m_next_id = 0;
+    std::atomic<std::uint16_t> m_threads{0};
+};
+
+/** Events of one thread, handed to the recorder in batches and when the thread exits */
+struct ThreadBuffer {
+    ThreadBuffer() : recorder(Recorder::instance()), thread(recorder.next_thread()) { events.reserve(buffer_events); }
+    ~ThreadBuffer()
+    {
+        if (s_alive) recorder.write(events);
+    }
+
+    Recorder &recorder;  // constructed first, so it outlives every thread buffer
+    std::uint16_t thread;
+    std::vector<Event> events;
+};
+
+ThreadBuffer &local()
+{
+    thread_local ThreadBuffer buffer;
+    return buffer;
+}
+
+void record(const void *pblock, std::size_t size, Op op)
+{
+    ThreadBuffer &buffer = local();
+    if (!s_alive) return;  // we're past the end of main
+
+    Event event;
+    std::memset(&event, 0, sizeof(event));
+    if (!buffer.recorder.lookup(pblock, op, event.id, event.time_ns)) return;
+    event.size = static_cast<std::uint32_t>(size);
+    event.thread = buffer.thread;
+    event.op = op;
+
+    buffer.events.push_back(event);
+    if (buffer.events.size() >= buffer_events) buffer.recorder.write(buffer.events);
+}
+}  // namespace
+
+void mem::trace::record_allocate(const void *pblock, std::size_t size) { record(pblock, size, Op::allocate); }
+void mem::trace::record_deallocate(const void *pblock, std::size_t size) { record(pblock, size, Op::deallocate); }
+
+void mem::trace::flush()
+{
+    ThreadBuffer &buffer = local();
+    buffer.recorder.write(buffer.events);
+    buffer.recorder.flush();
+}
+
+std::vector<Event> mem::trace::load(const std::string &path)
+{
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) throw std::runtime_error("cannot open trace " + path);
+
+    Header header;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, "MTRC", 4) != 0 || header.version != version) {
+        std::fclose(file);
+        throw std::runtime_error(path + " is not a version " + std::to_string(version) + " allocation trace");
+    }
+
+    // a corrupt count mustn't make us allocate more than the file could hold
+    long start = std::ftell(file);
+    std::fseek(file, 0, SEEK_END);
+    std::uint64_t available = (std::ftell(file) - start) / sizeof(Event);
+    std::fseek(file, start, SEEK_SET);
+    if (header.count > available) {
+        std::fclose(file);
+        throw std::runtime_error(path + " is truncated");
+    }
+
+    std::vector<Event> events(header.count);
+    std::size_t read = std::fread(events.data(), sizeof(Event), events.size(), file);
+    std::fclose(file);
+    if (read != events.size()) throw std::runtime_error(path + " is truncated");
+    for (const Event &event : events) {
+        if (event.op != Op::allocate && event.op != Op::deallocate) throw std::runtime_error(path + " holds an event of an unknown kind");
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const Event &lhs, const Event &rhs) { return lhs.time_ns < rhs.time_ns; });
+    return events;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace mem
+{
+namespace trace
+{
+/**
+ * Allocation trace recording and loading
+ * Build with MEM_TRACE defined and the allocators in myAllocator.hpp report every allocate/deallocate here
+ * The events are written to the file named by the MEM_TRACE_FILE environment variable (mem.trace by default)
+ *
+ * File layout: a Header followed by Header::count Events, all in the recording machine's byte order
+ */
+enum class Op : std::uint8_t {
+    allocate = 0,
+    deallocate = 1,
+};
+
+struct Header {
+    char magic[4];          // "MTRC"
+    std::uint32_t version;  // bumped on every layout change
+    std::uint64_t count;    // number of events following the header, patched when the recorder is closed
+};
+
+struct Event {
+    std::uint64_t time_ns;  // nanoseconds since the recorder started
+    std::uint32_t id;       // address id, shared by an allocation and its matching deallocation
+    std::uint32_t size;     // requested size in bytes
+    std::uint16_t thread;   // index of the recording thread, in order of their first event
+    Op op;                  // what happened
+    std::uint8_t reserved;  // padding, always zero
+};
+
+constexpr std::uint32_t version = 1;
+
+// record an event of the calling thread, called by the allocators when MEM_TRACE is defined
+void record_allocate(const void *pblock, std::size_t size);
+void record_deallocate(const void *pblock, std::size_t size);
+
+// write out what the calling thread has buffered and patch the event count in the header
+// other threads' events go out when their buffers fill up or they exit, everything is written at exit anyway
+void flush();
+
+// read a whole trace file, events sorted by time, throw std::runtime_error on a malformed file
+std::vector<Event> load(const std::string &path);
+}  // namespace trace
+}  // namespace mem
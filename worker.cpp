@@ -0,0 +1,90 @@
+#include "worker.hpp"
+
+#include <algorithm>
+#include <new>
+
+using mem::WorkerHeap;
+
+WorkerHeap::WorkerHeap(std::size_t num_workers, std::size_t blocks_per_pool, Budget *budget) : m_budget(budget)
+{
+    m_workers.reserve(num_workers);
+    for (std::size_t i = 0; i < num_workers; i++) m_workers.emplace_back(blocks_per_pool, budget);
+}
+
+std::size_t WorkerHeap::pools(std::size_t worker) { return m_workers[worker].classes.pools(); }
+
+std::size_t WorkerHeap::size(std::size_t worker) { return m_workers[worker].classes.size(); }
+
+/** A large block is its size, padded to a header, then the header, so that free_large() knows what to release */
+void *WorkerHeap::get_large(std::size_t worker, std::size_t size)
+{
+    if (m_budget != nullptr) m_budget->charge(size);
+    std::size_t *psize;
+    try {
+        psize = static_cast<std::size_t *>(::operator new(2 * header_size + size));
+    } catch (...) {
+        if (m_budget != nullptr) m_budget->release(size);
+        throw;
+    }
+    *psize = size;
+    auto header = reinterpret_cast<Header *>(reinterpret_cast<std::byte *>(psize) + header_size);
+    header->pool = nullptr;
+    header->owner = worker;
+    return reinterpret_cast<std::byte *>(header) + header_size;
+}
+
+void WorkerHeap::free_large(Header *header)
+{
+    auto psize = reinterpret_cast<std::size_t *>(reinterpret_cast<std::byte *>(header) - header_size);
+    if (m_budget != nullptr) m_budget->release(*psize);
+    ::operator delete(psize);
+}
+
+WorkerHeap::Group::Group(WorkerHeap &heap, std::size_t chunk_size) : Group(heap, chunk_size, heap.budget()) {}
+
+WorkerHeap::Group::Group(WorkerHeap &heap, std::size_t chunk_size, Budget *budget)
+    : m_slots(heap.workers()), m_chunk_size(std::max<std::size_t>(chunk_size, 16)), m_budget(budget)
+{
+}
+
+WorkerHeap::Group::~Group()
+{
+    for (Slot &slot : m_slots)
+        for (auto &chunk : slot.chunks) release(*chunk);
+}
+
+void WorkerHeap::Group::reset()
+{
+    for (Slot &slot : m_slots) {
+        if (slot.chunks.empty()) continue;
+        for (std::size_t i = 1; i < slot.chunks.size(); i++) release(*slot.chunks[i]);
+        slot.chunks.resize(1);
+        slot.chunks.front()->reset();
+    }
+}
+
+void WorkerHeap::Group::release(MonoMemory &chunk)
+{
+    if (m_budget != nullptr) m_budget->release(chunk.capacity());
+}
+
+std::size_t WorkerHeap::Group::chunks()
+{
+    std::size_t count = 0;
+    for (Slot &slot : m_slots) count += slot.chunks.size();
+    return count;
+}
+
+void *WorkerHeap::Group::grow(Slot &slot, std::size_t size)
+{
+    // a request larger than a chunk gets a chunk of its own, it's the only one in it
+    std::size_t chunk_size = std::max(m_chunk_size, size);
+    if (m_budget != nullptr) m_budget->charge(chunk_size);
+    try {
+        slot.chunks.push_back(std::make_unique<MonoMemory>(chunk_size));
+    } catch (...) {
+        if (m_budget != nullptr) m_budget->release(chunk_size);
+        throw;
+    }
+    return slot.chunks.back()->get(size);
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "budget.hpp"
+#include "classes.hpp"
+#include "pool.hpp"
+
+namespace mem
+{
+/**
+ * Per-Worker Heap, for task schedulers whose workers allocate many small task objects and free them wherever they run
+ * Every worker has its own PoolMemory per size class and gets from them without any synchronization. A block freed by
+ * the worker that got it goes back with free(), one freed by another worker, like a stolen task, with remote_free(),
+ * so a worker never touches another worker's free list and no worker ever waits for another
+ *
+ * Each block has a 16 byte header in front of it naming its pool and the worker that got it, so free() needs neither
+ * the size nor a lookup. Requests larger than the largest class go to operator new, with the same header
+ * The classes of a worker grow like any SizeClasses, see classes.hpp
+ *
+ * With a Budget, every pool and every large block is charged to it when it's added and released when it goes away, a class
+ * whose budget can't take a pool twice as large falls back to a pool of the first size, and get() throws std::bad_alloc
+ * once not even that fits, so neither get() nor free() of the pooled blocks ever touch the budget
+ *
+ * The blocks are aligned to 16 bytes
+ * Only the worker itself may call get() and group gets with its id, free() may be called with any id
+ */
+class WorkerHeap
+{
+   public:
+    class Group;
+
+    static constexpr std::size_t header_size = 16;  // bytes in front of every block
+    static constexpr std::size_t min_size = 16;     // payload of the smallest class, the classes double up to max_size
+    static constexpr std::size_t num_classes = 8;
+    static constexpr std::size_t max_size = min_size << (num_classes - 1);  // larger requests go to operator new
+
+    // a heap for num_workers workers, each class of each worker starts with a pool of blocks_per_pool blocks
+    // the memory it takes is charged to budget if there is one, which has to outlive the heap
+    explicit WorkerHeap(std::size_t num_workers, std::size_t blocks_per_pool = 1024, Budget *budget = nullptr);
+
+    WorkerHeap(const WorkerHeap &heap) = delete;            // delete copy constructor
+    WorkerHeap &operator=(const WorkerHeap &rhs) = delete;  // delete copy-assignment operator
+    WorkerHeap(WorkerHeap &&heap) = delete;                 // delete move constructor
+    WorkerHeap &operator=(WorkerHeap &&rhs) = delete;       // delete move-assignment operator
+
+    ~WorkerHeap() = default;  // release every pool, every block of every worker is invalidated
+
+    std::size_t workers() { return m_workers.size(); }  // return the number of workers
+    Budget *budget() { return m_budget; }                // return the budget of the heap, nullptr if it has none
+    std::size_t pools(std::size_t worker);              // return the number of pools the worker has grown so far
+    std::size_t size(std::size_t worker);               // return the number of blocks the worker got that aren't back, from the worker or once the workers stopped
+
+    // return size bytes for the worker calling it, throw std::bad_alloc if the system or the budget is out of memory
+    void *get(std::size_t worker, std::size_t size);
+
+    // give back a block of this heap from the worker calling it, whichever worker got it
+    void free(std::size_t worker, void *pblock);
+
+    // return the worker that got the block
+    static std::size_t owner(void *pblock) { return header_of(pblock)->owner; }
+
+    // return the bytes the heap takes for a request of size bytes, its header included
+    static std::size_t block_size(std::size_t size) { return size > max_size ? 2 * header_size + size : Classes::block_size(Classes::class_of(size)); }
+
+    // call visit(PoolMemory &pool) on every pool of the worker, smallest class first, from the worker or once the workers stopped
+    template <class Visit>
+    void for_each_pool(std::size_t worker, Visit visit)
+    {
+        m_workers[worker].classes.for_each_pool(visit);
+    }
+
+   private:
+    using Classes = SizeClasses<header_size, min_size, num_classes>;
+
+    struct Header {
+        PoolMemory *pool;   // pool the block came from, nullptr for a block of operator new
+        std::size_t owner;  // worker that got the block
+    };
+    static_assert(sizeof(Header) == header_size, "the header has to keep the blocks aligned");
+
+    struct alignas(64) Worker {  // a cache line of its own, the workers never write to each other's
+        explicit Worker(std::size_t blocks_per_pool, Budget *budget) : classes(blocks_per_pool, 0, budget) {}
+        Classes classes;
+    };
+
+    static Header *header_of(void *pblock) { return reinterpret_cast<Header *>(static_cast<std::byte *>(pblock) - header_size); }
+
+    MEM_COLD void *get_large(std::size_t worker, std::size_t size);
+    MEM_COLD void free_large(Header *header);
+
+    std::vector<Worker> m_workers;
+    Budget *m_budget;
+};
+
+/**
+ * Arena of a task group: the workers running the tasks of a group bump allocate from chunks of their own, nothing is freed
+ * one by one and the whole group's memory goes away at once when the group is done, with reset() or the destructor
+ * Only call reset() or destroy the group once every task of the group has completed
+ */
+class WorkerHeap::Group
+{
+   public:
+    // chunk_size is the size in bytes of the chunks each worker bump allocates from
+    // they're charged to budget, the heap's by default, which may be a child of the heap's to cap the group alone
+    explicit Group(WorkerHeap &heap, std::size_t chunk_size = 64 * 1024);
+    Group(WorkerHeap &heap, std::size_t chunk_size, Budget *budget);
+
+    Group(const Group &group) = delete;           // delete copy constructor
+    Group &operator=(const Group &rhs) = delete;  // delete copy-assignment operator
+
+    ~Group();
+
+    // return size bytes aligned to 16 for the worker calling it, throw std::bad_alloc if the system is out of memory
+    void *get(std::size_t worker, std::size_t size);
+
+    // release the memory of the group, every worker keeps its first chunk for the next group
+    void reset();
+
+    std::size_t chunks();  // return the number of chunks the group holds
+
+   private:
+    struct alignas(64) Slot {
+        std::vector<std::unique_ptr<MonoMemory>> chunks;  // the worker bump allocates from the last one
+    };
+
+    MEM_COLD void *grow(Slot &slot, std::size_t size);
+    void release(MonoMemory &chunk);  // give the chunk's bytes back to the budget
+
+    std::vector<Slot> m_slots;
+    std::size_t m_chunk_size;
+    Budget *m_budget;
+};
+
+/** Per-Worker Heap Fast Path, inlined into the callers */
+inline void *WorkerHeap::get(std::size_t worker, std::size_t size)
+{
+    if (size > max_size) MEM_UNLIKELY {
+        return get_large(worker, size);
+    }
+    PoolMemory *pool;
+    auto header = static_cast<Header *>(m_workers[worker].classes.get(Classes::class_of(size), pool));
+    header->pool = pool;
+    header->owner = worker;
+    return reinterpret_cast<std::byte *>(header) + header_size;
+}
+
+inline void WorkerHeap::free(std::size_t worker, void *pblock)
+{
+    if (pblock == nullptr) return;
+    Header *header = header_of(pblock);
+    if (header->pool == nullptr) MEM_UNLIKELY {
+        free_large(header);
+    } else if (header->owner == worker) MEM_LIKELY {
+        header->pool->free(header);
+    } else {
+        header->pool->remote_free(header);  // a stolen task, its worker reclaims it when it runs out
+    }
+}
+
+/** Task Group Arena Fast Path, inlined into the callers */
+inline void *WorkerHeap::Group::get(std::size_t worker, std::size_t size)
+{
+    size = (size + 15) / 16 * 16;  // every chunk starts 16 aligned, so every allocation does
+    Slot &slot = m_slots[worker];
+    void *ptr = slot.chunks.empty() ? nullptr : slot.chunks.back()->get<oom::Null>(size);
+    if (ptr == nullptr) MEM_UNLIKELY {
+        ptr = grow(slot, size);
+    }
+    return ptr;
+}
+}  // namespace mem